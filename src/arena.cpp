@@ -0,0 +1,73 @@
+#include "arena.h"
+#include <stdlib.h>
+
+using namespace std;
+
+thread_local Arena *ast_arena;
+
+static const size_t ARENA_ALIGN = alignof(max_align_t);
+
+Arena::Arena(size_t block_size){
+  this->block_size = block_size;
+  this->cur = NULL;
+  this->left = 0;
+  this->num_allocs = 0;
+  this->num_blocks = 0;
+  this->bytes_used = 0;
+}
+
+Arena::~Arena(){
+  Release();
+}
+
+void *Arena::Allocate(size_t size){
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  num_allocs++;
+  bytes_used += size;
+  if(size > left){
+    // Oversized requests get a block of their own so that the current
+    // block keeps serving small nodes
+    size_t bs = size > block_size ? size : block_size;
+    char *block = (char *) malloc(bs);
+    if(block == NULL)
+      throw bad_alloc();
+    blocks.push_back(block);
+    num_blocks++;
+    if(bs == size)
+      return block;
+    cur = block;
+    left = bs;
+  }
+  void *p = cur;
+  cur += size;
+  left -= size;
+  return p;
+}
+
+void Arena::Release(){
+  // Destroy in reverse order of construction, like automatic objects
+  for(int i = (int) finalizers.size() - 1; i >= 0; i--){
+    finalizers[i].second(finalizers[i].first);
+  }
+  finalizers.clear();
+  for(int i = 0; i < blocks.size(); i++){
+    free(blocks[i]);
+  }
+  blocks.clear();
+  cur = NULL;
+  left = 0;
+}
+
+void Arena::Absorb(Arena &other){
+  finalizers.insert(finalizers.end(), other.finalizers.begin(), other.finalizers.end());
+  blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+  num_allocs += other.num_allocs;
+  num_blocks += other.num_blocks;
+  bytes_used += other.bytes_used;
+  other.finalizers.clear();
+  other.blocks.clear();
+  other.cur = NULL;
+  other.left = 0;
+  other.num_allocs = other.num_blocks = 0;
+  other.bytes_used = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+using namespace std;
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Bump-pointer allocator owning everything built for one compilation:
+// AST nodes, their locations and the lists/maps hanging off them.
+// Nothing is freed individually; Release() runs the registered
+// destructors and hands every block back in one step.
+class Arena{
+public:
+  int num_allocs;       // allocations served (each one a heap new before)
+  int num_blocks;       // heap allocations actually made
+  size_t bytes_used;
+
+  Arena(size_t block_size = ARENA_BLOCK_SIZE);
+  ~Arena();
+
+  void *Allocate(size_t size);
+  void Release();
+  // Takes over the objects and blocks of other, which is left empty, so
+  // that they are released with this arena
+  void Absorb(Arena &other);
+
+  // Objects with a non-trivial destructor are remembered so that
+  // Release() can tear them down before the memory goes away.
+  template <typename T> void Track(T *obj){
+    finalizers.push_back(Finalizer(obj, &Destroy<T>));
+  }
+
+  template <typename T, typename... Args> T *New(Args... args){
+    T *obj = new (Allocate(sizeof(T))) T(args...);
+    if(!is_trivially_destructible<T>::value)
+      Track(obj);
+    return obj;
+  }
+
+private:
+  typedef pair<void *, void (*)(void *)> Finalizer;
+
+  size_t block_size;
+  vector<char *> blocks;
+  char *cur;
+  size_t left;
+  vector<Finalizer> finalizers;
+
+  template <typename T> static void Destroy(void *obj){
+    ((T *) obj)->~T();
+  }
+};
+
+// Arena of the compilation in progress. Worker threads allocate from
+// arenas of their own, released with the compilation.
+extern thread_local Arena *ast_arena;
+
+#endif
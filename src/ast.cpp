@@ -1,15 +1,15 @@
 #include <vector>
 #include "ast.h"
+#include "options.h"
 #include <string.h>
 #include <iostream>
-#include <typeinfo>
 
 using namespace std;
 
 const int VAR_SIZE = 4;
 const int OFFSET_FIRST_PARAM = 4;
 const int OFFSET_FIRST_LOCAL = -4;
-map<string, Declaration *> *global_sym_table;
+thread_local map<string, Declaration *> *global_sym_table;
 string TypeNames[] = {"void", "char", "int", "float", "bool", "string", "error"};
 
 void CheckAndInsertIntoSymTable(vector<Identifier *> *v, Identifier *d){
@@ -24,53 +24,83 @@ void CheckAndInsertIntoSymTable(vector<Identifier *> *v, Identifier *d){
 }
 
 Ast::Ast(YYLTYPE loc){
-	this->loc = new YYLTYPE(loc);
+  this->kind = K_NONE;
+	this->loc = ast_arena->New<YYLTYPE>(loc);
 	this->parent = NULL;
+  ast_arena->Track(this);
 }
 
 Ast::Ast(){
+  this->kind = K_NONE;
 	this->loc = NULL;
 	this->parent = NULL;
+  ast_arena->Track(this);
 }
 
-Identifier::Identifier(YYLTYPE loc, enum Type t, char *name, vector<IntConst *> *dimList) : Declaration(loc){
-	this->name.assign(name);
+Identifier::Identifier(YYLTYPE loc, enum Type t, int sym, vector<IntConst *> *dimList) : Declaration(loc){
+  this->kind = KIND;
+	this->sym = sym;
+	this->name = symbols->Name(sym);
 	this->is_array  = true;
 	this->elem_type = t;
   this->is_global = false;
+  this->reg = -1;
   this->dim_list = dimList;
   setParent(dimList, this);
+  this->strides.resize(dimList->size());
+  int stride = VAR_SIZE;
+  for(int i = dimList->size() - 1; i >= 0; i--){
+    this->strides[i] = stride;
+    stride *= (*dimList)[i]->val;
+  }
+}
+
+Identifier::Identifier(YYLTYPE loc, enum Type t, int sym) : Declaration(loc){
+  this->kind = KIND;
+	this->sym = sym;
+	this->name = symbols->Name(sym);
+	this->elem_type = t;
+	this->is_array = false;
+  this->is_global = false;
+  this->reg = -1;
 }
 
-Identifier::Identifier(YYLTYPE loc, enum Type t, char *name) : Declaration(loc){
-	this->name.assign(name);
+Identifier::Identifier(YYLTYPE loc, enum Type t, const string &name) : Declaration(loc){
+  this->kind = KIND;
+	this->name = name;
 	this->elem_type = t;
 	this->is_array = false;
   this->is_global = false;
+  this->reg = -1;
 }
 
 IntConst::IntConst(YYLTYPE loc, int val) : Expression(loc){
+  this->kind = KIND;
 	this->val = val;
 	this->type = T_INT;
 
 }
 
 StringConst::StringConst(YYLTYPE loc, string val) : Expression(loc){
+  this->kind = KIND;
 	this->val = val;
 	this->type = T_STRING;
 }
 
 BoolConst::BoolConst(YYLTYPE loc, bool val) : Expression(loc){
+  this->kind = KIND;
 	this->val = val;
 	this->type = T_BOOL;
 }
 
 DoubleConst::DoubleConst(YYLTYPE loc, double val) : Expression(loc){
+  this->kind = KIND;
 	this->val = val;
 	this->type = T_FLOAT;
 }
 
 StatementBlock::StatementBlock(map<string, Identifier *> *m, vector<Statement *> *v){
+  this->kind = KIND;
 	this->stmt_list = v;
 	this->symbol_table = m;
   this->frame_size = 0;
@@ -79,49 +109,67 @@ StatementBlock::StatementBlock(map<string, Identifier *> *m, vector<Statement *>
 	setParent(m, this);
 }
 
-FuncDecl::FuncDecl(YYLTYPE loc, YYLTYPE ret_loc, enum Type t, char *name, 
+FuncDecl::FuncDecl(YYLTYPE loc, YYLTYPE ret_loc, enum Type t, int sym, 
 	vector<Identifier *> *pl, StatementBlock *sb) : Declaration(loc){
+  this->kind = KIND;
 	this->return_type = t;
 	this->return_loc = ret_loc;
 	this->param_list = pl;
 	this->stmt_block = sb;
-	this->name = name;
+	this->sym = sym;
+	this->name = symbols->Name(sym);
+  this->frame_size = 0;
+  this->saves_ra = true;
+  this->self_tail_calls = false;
   
 	setParent(this->param_list, this);
 	this->stmt_block->parent = this;
 }
 
 ExprStatement::ExprStatement(Expression *e){
+  this->kind = KIND;
 	this->expr = e;
-	e->parent = this;
+  if(e != NULL)
+    e->parent = this;
 }
 
 ReturnStatement::ReturnStatement(YYLTYPE loc, Expression *expr) : Statement(loc){
+  this->kind = KIND;
   this->expr= expr;
   this->expr->parent = this;
+  this->tail_call = false;
 }
 
-Access::Access(YYLTYPE loc, string name) : Expression(loc){
-	this->name = name;
+Access::Access(YYLTYPE loc, int sym) : Expression(loc){
+  this->kind = KIND;
+	this->sym = sym;
+  this->id = NULL;
   this->is_array = false;
+  this->access_list = NULL;
+  this->base_offset = NULL;
 }
 
-Access::Access(YYLTYPE loc, string name, vector<Expression *> *v) : Expression(loc){
-	this->name = name;
+Access::Access(YYLTYPE loc, int sym, vector<Expression *> *v) : Expression(loc){
+  this->kind = KIND;
+	this->sym = sym;
+  this->id = NULL;
   this->access_list = v;
   this->is_array = true;
+  this->base_offset = NULL;
 
   setParent(v, this);
 }
 
-Call::Call(YYLTYPE loc, string name, vector<Expression *> *args) : Expression(loc){
-	this->name = name;
+Call::Call(YYLTYPE loc, int sym, vector<Expression *> *args) : Expression(loc){
+  this->kind = KIND;
+	this->sym = sym;
   this->args = args;
 
   setParent(args, this);
 }
 
 OpExpression::OpExpression(Operator *op, Expression *lhs, Expression *rhs){
+  this->kind = KIND;
 	this->op = op;
 	this->lhs = lhs;
 	this->rhs = rhs;
@@ -132,6 +180,7 @@ OpExpression::OpExpression(Operator *op, Expression *lhs, Expression *rhs){
 }
 
 OpExpression::OpExpression(Operator *op, Expression *rhs){
+  this->kind = KIND;
 	this->op = op;
 	this->lhs = NULL;
 	this->rhs = rhs;
@@ -154,10 +203,12 @@ void OpExpression::CheckExpression(){
 }
 
 Operator::Operator(YYLTYPE loc, int op) : Ast(loc){
+  this->kind = KIND;
 	this->op = op;
 }
 
 SelStatement::SelStatement(Expression *e, Statement *s1, Statement *s2){
+  this->kind = KIND;
 	this->test = e;
 	this->body_true = s1;
 	this->body_false = s2;
@@ -169,6 +220,7 @@ SelStatement::SelStatement(Expression *e, Statement *s1, Statement *s2){
 }
 
 SelStatement::SelStatement(Expression *e, Statement *s1){
+  this->kind = KIND;
 	this->test = e;
 	this->body_true = s1;
 	this->body_false = NULL;
@@ -178,6 +230,7 @@ SelStatement::SelStatement(Expression *e, Statement *s1){
 }
 
 IterStatement::IterStatement(Expression *e, Statement *s){
+  this->kind = KIND;
 	this->loop_type = WHILE;
 	this->expr = e;
 	this->body = s;
@@ -187,6 +240,7 @@ IterStatement::IterStatement(Expression *e, Statement *s){
 }
 
 IterStatement::IterStatement(ExprStatement *i, ExprStatement *c, Expression *e, Statement *s){
+  this->kind = KIND;
 	this->loop_type = FOR;
 	this->init = i;
 	this->cond = c;
@@ -199,13 +253,35 @@ IterStatement::IterStatement(ExprStatement *i, ExprStatement *c, Expression *e,
 	e->parent = this;
 }
 
+// Statement::CheckStatement() and Expression::CheckExpression() reach
+// the method of the concrete class through its kind; constants are
+// typed when they are made
+class CheckDispatch : public AstVisitor<CheckDispatch>{
+public:
+  void VisitExprStatement(ExprStatement *n) {n->CheckStatement();}
+  void VisitSelStatement(SelStatement *n) {n->CheckStatement();}
+  void VisitIterStatement(IterStatement *n) {n->CheckStatement();}
+  void VisitStatementBlock(StatementBlock *n) {n->CheckStatement();}
+  void VisitReturnStatement(ReturnStatement *n) {n->CheckStatement();}
+  void VisitAccess(Access *n) {n->CheckExpression();}
+  void VisitCall(Call *n) {n->CheckExpression();}
+  void VisitOpExpression(OpExpression *n) {n->CheckExpression();}
+};
+
+void Statement::CheckStatement(){
+  CheckDispatch().Visit(this);
+}
+
+void Expression::CheckExpression(){
+  CheckDispatch().Visit(this);
+}
+
 void StatementBlock::CheckStatement(){
 	//stmt list is public member
 	for (int i = 0; i < stmt_list->size(); ++i)
 	{	
 		(*stmt_list)[i]->CheckStatement();
 	}
-  this->CalcOffsets();
 }
 
 //Override Base class function
@@ -255,6 +331,7 @@ void ReturnStatement::CheckStatement(){
     if(this->expr->type != fd->return_type){
       ReturnMismatch(this->loc, this->expr->type, fd->return_type);
     }
+    this->MarkTailCall();
   }
   else{
     if(T_VOID != fd->return_type){
@@ -263,54 +340,35 @@ void ReturnStatement::CheckStatement(){
   }
 }
 
-void Access::CheckExpression(){
-  StatementBlock *sb;
-  FuncDecl *f;
-  sb = GetEnclosingStatementBlockParent((Ast *) this);
-
-  // Check all statementblocks starting from innermost
-  while(sb != NULL){
-    if(sb->symbol_table->find(this->name) != sb->symbol_table->end()){
-      this->id = (*(sb->symbol_table))[this->name];
-      this->type = this->id->elem_type;
-      goto check_for_array;
-    }
-    sb = GetEnclosingStatementBlockParent((Ast *) sb);
-  }
-
-  // Check Enclosing function's parameter list
-  f = GetEnclosingFuncParent(this);
-  for (int i = 0; i < f->param_list->size(); ++i)
-  {
-    if((*f->param_list)[i]->name == this->name){
-      this->id = (*f->param_list)[i];
-      this->type = this->id->elem_type;
-      goto check_for_array;
-    }
-  }
+// Nothing of the frame is needed once the callee starts, except in
+// main(), whose return ends the program
+void ReturnStatement::MarkTailCall(){
+  Call *call = As<Call>(this->expr);
+  this->tail_call = options.tail_calls && call != NULL && call->fd != NULL &&
+    this->fd->name != "main";
+  if(this->tail_call && call->fd == this->fd)
+    this->fd->self_tail_calls = true;
+}
 
-  // Check global symbol table
-  if(global_sym_table->find(this->name) == global_sym_table->end()){
-    IdentifierNotDeclared(this->loc, this->name);
-    this->id = NULL;
-    this->type = T_ERROR;
-    return;
-  }
-  else{
-    if(typeid(Identifier) != typeid(*((*global_sym_table)[this->name]))){
-      InvalidFuncCall(this->loc, this->name);
-      this->id = NULL;
+void Access::CheckExpression(){
+  // Locals and parameters were found in the scope stack by the parser;
+  // anything else has to be a global variable
+  if(this->id == NULL){
+    Declaration *d = symbols->LookupGlobal(this->sym);
+    if(d == NULL){
+      IdentifierNotDeclared(this->loc, symbols->Name(this->sym));
       this->type = T_ERROR;
       return;
     }
-    else{
-      this->id = dynamic_cast<Identifier *>((*global_sym_table)[this->name]);
-      this->type = this->id->elem_type;
-      goto check_for_array;
+    if(!Is<Identifier>(d)){
+      InvalidFuncCall(this->loc, symbols->Name(this->sym));
+      this->type = T_ERROR;
+      return;
     }
+    this->id = As<Identifier>(d);
   }
+  this->type = this->id->elem_type;
 
-check_for_array:
   if(this->id->is_array && !this->is_array){
     ArrayWithoutDim(this);
     this->id = NULL;
@@ -348,19 +406,20 @@ check_for_array:
 }
 
 void Call::CheckExpression(){
-  if(global_sym_table->find(this->name) == global_sym_table->end()){
-    IdentifierNotDeclared(this->loc, this->name);
+  Declaration *d = symbols->LookupGlobal(this->sym);
+  if(d == NULL){
+    IdentifierNotDeclared(this->loc, symbols->Name(this->sym));
     this->fd = NULL;
     this->type = T_ERROR;
   }
   else{
-    if(typeid(Identifier) == typeid(*((*global_sym_table)[this->name]))){
-      VariableNotFunction(this->loc, this->name);
+    if(Is<Identifier>(d)){
+      VariableNotFunction(this->loc, symbols->Name(this->sym));
       this->fd = NULL;
       this->type = T_ERROR;
     }
     else{
-      this->fd = dynamic_cast<FuncDecl *>((*global_sym_table)[this->name]);
+      this->fd = As<FuncDecl>(d);
       this->type = this->fd->return_type;
       //printf("Type: %s", TypeNames[this->fd->return_type].c_str());
       
@@ -388,8 +447,8 @@ FuncDecl* GetEnclosingFuncParent(Ast *a){
 	Ast *parent = a->parent;
 	FuncDecl *f = NULL;
 	while(parent){
-		if(typeid(FuncDecl) == typeid(*parent)){
-			f = dynamic_cast<FuncDecl *>(parent);
+		if(Is<FuncDecl>(parent)){
+			f = As<FuncDecl>(parent);
 			break;
 		}
 		parent = parent->parent;
@@ -397,21 +456,6 @@ FuncDecl* GetEnclosingFuncParent(Ast *a){
 	return f;
 }
 
-StatementBlock* GetEnclosingStatementBlockParent(Ast *a){
-  if(a != NULL){
-    Ast *parent = a->parent;
-    StatementBlock *sb = NULL;
-    while(parent != NULL){
-      if(typeid(StatementBlock) == typeid(*parent)){
-        sb = dynamic_cast<StatementBlock *>(parent);
-        break;
-      }
-      parent = parent->parent;
-    }
-    return sb;
-  }
-}
-
 enum Type Coercible(Operator *op, enum Type t1, enum Type t2){
 	// Note break statements are absent on purpose
   int oper = op->op;
@@ -2,10 +2,13 @@
 #define AST_H
 
 #include "location.h"
+#include "arena.h"
+#include "symbols.h"
 #include <vector>
 #include <string.h>
 #include <iostream>
 #include <map>
+#include <set>
 
 using namespace std;
 
@@ -40,64 +43,103 @@ extern string TypeNames[];
 #include "grammar.tab.hpp"          
 #endif
 
-extern map<string, Declaration *> *global_sym_table;
+// Functions and globals of the compilation in progress on this thread
+extern thread_local map<string, Declaration *> *global_sym_table;
+
+// Concrete class of a node, so that passes can branch on it without RTTI
+enum NodeKind : unsigned char {
+  K_NONE,
+  K_IDENTIFIER, K_FUNC_DECL,
+  K_EXPR_STMT, K_SEL_STMT, K_ITER_STMT, K_STMT_BLOCK, K_RETURN_STMT,
+  K_OPERATOR,
+  K_ACCESS, K_CALL, K_OP_EXPR,
+  K_INT_CONST, K_STRING_CONST, K_BOOL_CONST, K_DOUBLE_CONST,
+  NUM_NODE_KINDS
+};
 
 class Ast{
 public:
 	YYLTYPE *loc;
 	Ast *parent;
+  NodeKind kind;    // last, so subclasses can pack their fields after it
 
 	Ast();
 	Ast(YYLTYPE loc);
-  virtual void Emit() {}
+  // Emission, checking and layout dispatch on kind to the method of the
+  // concrete class (see AstVisitor below), which hides these
+  void Emit();
 	virtual ~Ast() {}
+
+  // Nodes live in the compilation's arena and are released with it
+  static void *operator new(size_t size) {return ast_arena->Allocate(size);}
+  static void operator delete(void *) {}
 };
 
 class Declaration : public Ast{
 public:
 	string name;
+  int sym;      // interned name
   int offset;
-  string label;
+  int label;    // id in the instruction stream's label table
   
-  Declaration(YYLTYPE loc) : Ast(loc) {offset = -1;}
+  Declaration(YYLTYPE loc) : Ast(loc) {sym = NO_SYMBOL; offset = -1; label = -1;}
 };
 
 class Identifier : public Declaration{
 public:
+  static const NodeKind KIND = K_IDENTIFIER;
 	bool is_array;
 	enum Type elem_type;
 	vector<IntConst *> *dim_list;
+  vector<int> strides;  // row-major byte distance between indices of each dimension
 	bool is_global;
+  int reg;      // register holding a scalar local/param, -1 if in memory
 
 	Identifier();
-	Identifier(YYLTYPE, enum Type, char *, vector<IntConst *> *);
-	Identifier(YYLTYPE, enum Type, char *);
+	Identifier(YYLTYPE, enum Type, int, vector<IntConst *> *);
+	Identifier(YYLTYPE, enum Type, int);
+  // A local made by the compiler, not named in the program
+	Identifier(YYLTYPE, enum Type, const string &);
 };
 
 class FuncDecl : public Declaration{
 public:
+  static const NodeKind KIND = K_FUNC_DECL;
 	YYLTYPE return_loc;
 	enum Type return_type;
   
 	vector<Identifier *> *param_list;
 	StatementBlock *stmt_block;
+  vector<int> saved_regs;   // callee-saved registers used by the body
+  int frame_size;           // saved registers + locals below $ra
+  bool saves_ra;            // some call returns to it, so $ra needs a slot
+  set<Identifier *> mods;   // globals it may assign, itself or through calls
+  bool self_tail_calls;     // some return calls the function itself
+  int body_label;           // past the prologue, where those calls jump
+  int exit_label;           // the epilogue every return jumps to
   
 	FuncDecl();
-	FuncDecl(YYLTYPE loc, YYLTYPE ret_loc, enum Type t, char *name, 
+	FuncDecl(YYLTYPE loc, YYLTYPE ret_loc, enum Type t, int sym, 
 	vector<Identifier *> *pl, StatementBlock *sb);
   void CalcOffsets();
+  void CalcFrame();
   void Emit();
+  void EmitEpilogue();
 };
 
 class Statement : public Ast{
 public:
   Statement() {}
   Statement(YYLTYPE loc) : Ast(loc) {}
-	virtual void CheckStatement() {}
+	void CheckStatement();
+  // Lays out the locals of nested blocks starting at first_offset and
+  // returns the bytes of frame they need
+  int CalcOffsets(int first_offset);
 };
 
 class ExprStatement : public Statement{
 public:
+  static const NodeKind KIND = K_EXPR_STMT;
 	Expression *expr;
 	ExprStatement(Expression *);
 	void CheckStatement();
@@ -106,6 +148,7 @@ public:
 
 class SelStatement : public Statement{
 public:
+  static const NodeKind KIND = K_SEL_STMT;
 	Expression *test;
 	Statement *body_true;
 	Statement *body_false;
@@ -113,11 +156,13 @@ public:
 	SelStatement (Expression *, Statement*, Statement*);
 	SelStatement (Expression *, Statement *);
   void CheckStatement();
+  int CalcOffsets(int);
   void Emit();
 };
 
 class IterStatement : public Statement{
 public:
+  static const NodeKind KIND = K_ITER_STMT;
 	int loop_type;
 	ExprStatement *init;
 	ExprStatement *cond;
@@ -127,35 +172,41 @@ public:
 	IterStatement(Expression *, Statement *);
 	IterStatement(ExprStatement *, ExprStatement *, Expression *, Statement *);
   void CheckStatement();
+  int CalcOffsets(int);
   void Emit();
 };
 
 class StatementBlock : public Statement{
 public:
+  static const NodeKind KIND = K_STMT_BLOCK;
 	vector<Statement *> *stmt_list;
 	map<string, Identifier *> *symbol_table;
-  int frame_size;
+  int frame_size;   // own locals plus the deepest nested block
   
-	StatementBlock() {frame_size = 0;}
+	StatementBlock() {kind = KIND; frame_size = 0;}
 	StatementBlock(map<string, Identifier *> *, vector<Statement *> *);
 	void CheckStatement();
-  void CalcOffsets();
+  int CalcOffsets(int);
   void Emit();
 };
 
 class ReturnStatement : public Statement{
 public:
+  static const NodeKind KIND = K_RETURN_STMT;
   Expression *expr;
   FuncDecl *fd;
+  bool tail_call;   // returns what a call returns, which can reuse the frame
   
-  ReturnStatement(YYLTYPE loc) : Statement(loc) {expr = NULL;}
+  ReturnStatement(YYLTYPE loc) : Statement(loc) {kind = KIND; expr = NULL; tail_call = false;}
   ReturnStatement(YYLTYPE, Expression *);
 	void CheckStatement();
+  void MarkTailCall();
   void Emit();
 };
 
 class Operator : public Ast{
 public:
+  static const NodeKind KIND = K_OPERATOR;
 	int op;
 	Operator(YYLTYPE loc, int op);
 };
@@ -167,31 +218,35 @@ public:
 	Expression() {}
 	Expression(YYLTYPE loc) : Ast(loc) {}
 
-	virtual void CheckExpression() {}  
+	void CheckExpression();
 };
 
 class Access : public Expression{
 public:
-	Identifier *id;
-	string name;
+  static const NodeKind KIND = K_ACCESS;
+	Identifier *id;   // locals and parameters are bound while parsing
+	int sym;
   bool is_array;
   vector<Expression *> * access_list;
+  Expression *base_offset;  // bytes added to the element address, hoisted out of a loop
   
-	Access(YYLTYPE, string);
-	Access(YYLTYPE, string, vector<Expression *> *);
+	Access(YYLTYPE, int);
+	Access(YYLTYPE, int, vector<Expression *> *);
 
 	void CheckExpression();
+  bool EmitIndex(int *disp);
   void Emit();
   void EmitLval();
 };
 
 class Call : public Expression{
 public:
+  static const NodeKind KIND = K_CALL;
 	FuncDecl *fd;
-	string name;
+	int sym;
   vector<Expression *> *args;
   
-	Call(YYLTYPE, string, vector<Expression *> *);
+	Call(YYLTYPE, int, vector<Expression *> *);
 
 	void CheckExpression();
   void Emit();
@@ -199,6 +254,7 @@ public:
 
 class OpExpression : public Expression {
 public:
+  static const NodeKind KIND = K_OP_EXPR;
 	Operator *op;
 	Expression *lhs;
 	Expression *rhs;
@@ -212,33 +268,93 @@ public:
 
 class IntConst : public Expression{
 public:
+  static const NodeKind KIND = K_INT_CONST;
 	int val;
-	IntConst() {type = T_INT;}
+	IntConst() {kind = KIND; type = T_INT;}
 	IntConst(YYLTYPE, int);
   void Emit();
 };
 
 class StringConst : public Expression{
 public:
+  static const NodeKind KIND = K_STRING_CONST;
 	string val;
-	StringConst() {type = T_STRING;}
+	StringConst() {kind = KIND; type = T_STRING;}
 	StringConst(YYLTYPE, string);
 };
 
 class BoolConst : public Expression{
 public:
+  static const NodeKind KIND = K_BOOL_CONST;
 	bool val;
-	BoolConst() {type = T_BOOL;}
+	BoolConst() {kind = KIND; type = T_BOOL;}
 	BoolConst(YYLTYPE, bool);
+  void Emit();
 };
 
 class DoubleConst : public Expression{
 public:
+  static const NodeKind KIND = K_DOUBLE_CONST;
 	double val;
-	DoubleConst() {type = T_FLOAT;}
+	DoubleConst() {kind = KIND; type = T_FLOAT;}
 	DoubleConst(YYLTYPE, double);
 };
 
+// The node as a T if that is its concrete class, otherwise NULL
+template <typename T> bool Is(Ast *node) {return node->kind == T::KIND;}
+template <typename T> T *As(Ast *node){
+  return node != NULL && node->kind == T::KIND ? static_cast<T *>(node) : NULL;
+}
+
+// Static double dispatch over the concrete node classes: Visit() switches
+// on the kind tag and calls Derived's VisitX(X *). Whatever Derived does
+// not define ends up in VisitAst(), which does nothing.
+template <typename Derived, typename R = void>
+class AstVisitor{
+public:
+  R Visit(Ast *node){
+    Derived *d = static_cast<Derived *>(this);
+    switch(node->kind){
+    case K_IDENTIFIER: return d->VisitIdentifier(static_cast<Identifier *>(node));
+    case K_FUNC_DECL: return d->VisitFuncDecl(static_cast<FuncDecl *>(node));
+    case K_EXPR_STMT: return d->VisitExprStatement(static_cast<ExprStatement *>(node));
+    case K_SEL_STMT: return d->VisitSelStatement(static_cast<SelStatement *>(node));
+    case K_ITER_STMT: return d->VisitIterStatement(static_cast<IterStatement *>(node));
+    case K_STMT_BLOCK: return d->VisitStatementBlock(static_cast<StatementBlock *>(node));
+    case K_RETURN_STMT: return d->VisitReturnStatement(static_cast<ReturnStatement *>(node));
+    case K_OPERATOR: return d->VisitOperator(static_cast<Operator *>(node));
+    case K_ACCESS: return d->VisitAccess(static_cast<Access *>(node));
+    case K_CALL: return d->VisitCall(static_cast<Call *>(node));
+    case K_OP_EXPR: return d->VisitOpExpression(static_cast<OpExpression *>(node));
+    case K_INT_CONST: return d->VisitIntConst(static_cast<IntConst *>(node));
+    case K_STRING_CONST: return d->VisitStringConst(static_cast<StringConst *>(node));
+    case K_BOOL_CONST: return d->VisitBoolConst(static_cast<BoolConst *>(node));
+    case K_DOUBLE_CONST: return d->VisitDoubleConst(static_cast<DoubleConst *>(node));
+    default: return d->VisitAst(node);
+    }
+  }
+
+  R VisitAst(Ast *) {return R();}
+  R VisitIdentifier(Identifier *n) {return Default(n);}
+  R VisitFuncDecl(FuncDecl *n) {return Default(n);}
+  R VisitExprStatement(ExprStatement *n) {return Default(n);}
+  R VisitSelStatement(SelStatement *n) {return Default(n);}
+  R VisitIterStatement(IterStatement *n) {return Default(n);}
+  R VisitStatementBlock(StatementBlock *n) {return Default(n);}
+  R VisitReturnStatement(ReturnStatement *n) {return Default(n);}
+  R VisitOperator(Operator *n) {return Default(n);}
+  R VisitAccess(Access *n) {return Default(n);}
+  R VisitCall(Call *n) {return Default(n);}
+  R VisitOpExpression(OpExpression *n) {return Default(n);}
+  R VisitIntConst(IntConst *n) {return Default(n);}
+  R VisitStringConst(StringConst *n) {return Default(n);}
+  R VisitBoolConst(BoolConst *n) {return Default(n);}
+  R VisitDoubleConst(DoubleConst *n) {return Default(n);}
+
+private:
+  R Default(Ast *n) {return static_cast<Derived *>(this)->VisitAst(n);}
+};
+
 template <typename TemplateType>
 void setParent(vector<TemplateType *> *node, Ast *parent){
 	for (int i = 0; i < node->size(); ++i)
@@ -275,7 +391,6 @@ void CheckAndInsertIntoSymTable(map<string, TemplateType *> *m, TemplateType *d)
 }
 
 void CheckAndInsertIntoSymTable(vector<Identifier *> *, Identifier *);
-StatementBlock* GetEnclosingStatementBlockParent(Ast *);
 FuncDecl* GetEnclosingFuncParent(Ast *);
 enum Type Coercible(Operator *, enum Type, enum Type);
 enum Type Coercible(Operator *, enum Type);
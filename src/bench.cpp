@@ -0,0 +1,191 @@
+#include "synth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern char **environ;
+
+// Phases of -time-report=json that are checked for growth
+static const char *phases[] = {
+  "lex", "parse", "check", "optimize", "regalloc", "offsets", "emit", "peephole", "output"};
+
+#define NUM_PHASES (sizeof(phases) / sizeof(phases[0]))
+// Phases faster than this on the largest input are noise
+#define MIN_PHASE_MS 5.0
+
+// A knob and how it grows from one run of its series to the next
+struct Series{
+  const char *name;
+  int SynthOptions::*field;
+  int start;
+  bool doubles;         // otherwise steps by one
+};
+
+static const Series series[] = {
+  {"functions", &SynthOptions::functions, 25, true},
+  {"statements", &SynthOptions::statements, 40, true},
+  {"identifiers", &SynthOptions::identifiers, 8, true},
+  {"depth", &SynthOptions::depth, 1, false},
+  {"expr-depth", &SynthOptions::expr_depth, 1, false},
+  {"dims", &SynthOptions::dims, 1, false},
+};
+
+#define NUM_SERIES (sizeof(series) / sizeof(series[0]))
+
+// One compilation of a generated program
+struct Run{
+  int value;
+  int lines;
+  int tokens;
+  double total_ms;
+  double ms[NUM_PHASES];
+  long peak_rss;        // KB, of the parser process
+};
+
+static const char *parser = "./parser";
+static int steps = 5;
+static double limit = 2.0;
+static bool strict = false;
+
+// The number after "key": in the report, or after "key": {"ms": for a phase
+static double Field(const string &json, const string &key){
+  size_t at = json.find("\"" + key + "\": ");
+  if(at == string::npos)
+    return -1;
+  at += key.size() + 4;
+  if(json.compare(at, 7, "{\"ms\": ") == 0)
+    at += 7;
+  return strtod(json.c_str() + at, NULL);
+}
+
+static string ReadFile(const char *name){
+  string s;
+  FILE *f = fopen(name, "r");
+  if(f == NULL)
+    return s;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    s.append(buf, n);
+  fclose(f);
+  return s;
+}
+
+// Compiles the program with the parser on one thread, the way a user
+// would run it, and takes the figures from its report
+static bool Measure(const string &program, Run &run){
+  char source[] = "/tmp/benchXXXXXX";
+  char report[] = "/tmp/benchXXXXXX";
+  int fd = mkstemp(source);
+  write(fd, program.data(), program.size());
+  close(fd);
+  close(mkstemp(report));
+
+  char *args[] = {(char *) parser, (char *) "-jobs=1", (char *) "-time-report=json", NULL};
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, source, O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, 2, report, O_WRONLY, 0);
+  pid_t pid;
+  int status = -1;
+  struct rusage usage;
+  bool ok = posix_spawnp(&pid, parser, &actions, NULL, args, environ) == 0 &&
+            wait4(pid, &status, 0, &usage) == pid && status == 0;
+  posix_spawn_file_actions_destroy(&actions);
+
+  string json = ReadFile(report);
+  unlink(source);
+  unlink(report);
+  if(!ok){
+    fprintf(stderr, "bench: %s failed on a generated program:\n%s", parser, json.c_str());
+    return false;
+  }
+  run.lines = 0;
+  for(size_t i = 0; i<program.size(); i++)
+    run.lines += program[i] == '\n';
+  run.tokens = (int) Field(json, "tokens");
+  run.total_ms = Field(json, "total_ms");
+  for(int p = 0; p<NUM_PHASES; p++)
+    run.ms[p] = Field(json, phases[p]);
+  run.peak_rss = usage.ru_maxrss;
+  return true;
+}
+
+// Compile time per token should stay flat as a knob grows; says which
+// phases it grew more than limit times for. Returns how many.
+static int CheckGrowth(const Series &s, const vector<Run> &runs){
+  const Run &first = runs.front(), &last = runs.back();
+  int found = 0;
+  for(int p = 0; p<NUM_PHASES; p++){
+    if(last.ms[p] < MIN_PHASE_MS || first.ms[p] <= 0)
+      continue;
+    double growth = (last.ms[p] / last.tokens) / (first.ms[p] / first.tokens);
+    if(growth > limit){
+      printf("  SUPER-LINEAR: %s takes %.1fx the time per token at %s=%d as at %s=%d\n",
+             phases[p], growth, s.name, last.value, s.name, first.value);
+      found++;
+    }
+  }
+  return found;
+}
+
+static void Usage(const char *prog){
+  fprintf(stderr, "usage: %s [-parser=PATH] [-steps=N] [-limit=X] [-strict]\n", prog);
+  fprintf(stderr, "  -parser=PATH  compiler to measure (default ./parser)\n");
+  fprintf(stderr, "  -steps=N      runs per knob, doubling it or adding one (default 5)\n");
+  fprintf(stderr, "  -limit=X      growth of time per token that counts as super-linear (default 2)\n");
+  fprintf(stderr, "  -strict       exit with 1 when a phase grew super-linearly\n");
+}
+
+int main(int argc, char **argv){
+  for(int i = 1; i<argc; i++){
+    if(strncmp(argv[i], "-parser=", 8) == 0)
+      parser = argv[i] + 8;
+    else if(strncmp(argv[i], "-steps=", 7) == 0 && atoi(argv[i] + 7) >= 2)
+      steps = atoi(argv[i] + 7);
+    else if(strncmp(argv[i], "-limit=", 7) == 0 && atof(argv[i] + 7) > 1)
+      limit = atof(argv[i] + 7);
+    else if(strcmp(argv[i], "-strict") == 0)
+      strict = true;
+    else{
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+
+  int found = 0;
+  for(int i = 0; i<NUM_SERIES; i++){
+    const Series &s = series[i];
+    printf("%-12s %8s %9s %10s %12s %12s %12s\n", s.name, "lines", "tokens", "ms",
+           "lines/sec", "tokens/sec", "peak RSS KB");
+    vector<Run> runs;
+    SynthOptions o = DefaultSynthOptions();
+    o.*s.field = s.start;
+    for(int step = 0; step<steps; step++){
+      Run run;
+      run.value = o.*s.field;
+      if(!Measure(SynthProgram(o), run))
+        return 1;
+      double secs = run.total_ms / 1000;
+      printf("%12d %8d %9d %10.1f %12.0f %12.0f %12ld\n", run.value, run.lines, run.tokens,
+             run.total_ms, run.lines / secs, run.tokens / secs, run.peak_rss);
+      fflush(stdout);
+      runs.push_back(run);
+      o.*s.field = s.doubles ? 2 * o.*s.field : o.*s.field + 1;
+    }
+    found += CheckGrowth(s, runs);
+  }
+  if(found)
+    printf("%d phase(s) grew super-linearly\n", found);
+  return strict && found > 0;
+}
@@ -0,0 +1,57 @@
+#include "compiler.h"
+#include "driver.h"
+#include "errors.h"
+#include "lexer.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+// Takes what was written to a memory stream and frees it
+static string Collect(FILE *f, char *&buf, size_t &size){
+  fclose(f);
+  string s(buf, size);
+  free(buf);
+  return s;
+}
+
+CompileResult CompileSource(const char *source, size_t len, const Options &opts){
+  CompileResult result;
+
+  // The thread's settings are put back as they were for whatever runs on
+  // it next
+  Options saved_options = options;
+  FILE *saved_diag = diag_out;
+  int saved_errors = numErrors;
+  vector<Diagnostic> *saved_diagnostics = diagnostics;
+  int saved_jobs = function_jobs;
+  vector<string> *saved_lines = source_lines;
+
+  options = opts;
+  function_jobs = opts.jobs;
+  numErrors = 0;
+  diagnostics = &result.diagnostics;
+  char *assembly, *log;
+  size_t assembly_size, log_size;
+  FILE *out = open_memstream(&assembly, &assembly_size);
+  diag_out = open_memstream(&log, &log_size);
+
+  yyscan_t scanner = NewScanner(source, len);
+  int ret = Compile(scanner, out);
+  DeleteScanner(scanner);
+
+  result.ok = ret == 0 && numErrors == 0;
+  result.assembly = Collect(out, assembly, assembly_size);
+  if(!result.ok)
+    result.assembly.clear();
+  result.log = Collect(diag_out, log, log_size);
+
+  options = saved_options;
+  diag_out = saved_diag;
+  numErrors = saved_errors;
+  diagnostics = saved_diagnostics;
+  function_jobs = saved_jobs;
+  source_lines = saved_lines;
+  return result;
+}
@@ -0,0 +1,36 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "options.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// In-process interface to the compiler, for programs that link
+// libcompiler.a instead of running ./parser
+
+// One error of a compilation
+struct Diagnostic{
+  int line;                     // 0 for errors without a position
+  int first_column, last_column;
+  string message;
+};
+
+struct CompileResult{
+  bool ok;                      // parsed, and no errors were reported
+  string assembly;              // MIPS assembly, empty unless ok
+  vector<Diagnostic> diagnostics;
+  // Everything the command line would have printed on stderr: the
+  // errors with their source lines, and the reports asked for in options
+  string log;
+};
+
+// Compiles the program in source[0..len) with opts (DefaultOptions() for
+// the usual ones; opts.files is ignored). Every bit of compilation state
+// is made for the call and freed before it returns, so calls can run at
+// once on any number of threads and nothing carries over between them.
+CompileResult CompileSource(const char *source, size_t len, const Options &opts);
+
+#endif
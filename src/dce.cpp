@@ -0,0 +1,270 @@
+#include "opt.h"
+#include <set>
+
+using namespace std;
+
+// Locals and parameters: nothing outside the function sees them, so a
+// value nobody reads afterwards need not be stored
+static bool Tracked(Identifier *id){
+  return !id->is_array && !id->is_global;
+}
+
+static bool IsConstant(Expression *e, int *val){
+  if(IntConst *c = As<IntConst>(e)){
+    *val = c->val;
+    return true;
+  }
+  if(BoolConst *c = As<BoolConst>(e)){
+    *val = c->val;
+    return true;
+  }
+  return false;
+}
+
+// Calls and assignments; everything else only computes a value
+static bool HasEffects(Expression *e){
+  if(e == NULL)
+    return false;
+  if(Is<Call>(e))
+    return true;
+  if(Is<Access>(e)){
+    Access *a = As<Access>(e);
+    if(!a->is_array)
+      return false;
+    for(int i = 0; i<a->access_list->size(); i++)
+      if(HasEffects((*a->access_list)[i]))
+        return true;
+    return HasEffects(a->base_offset);
+  }
+  if(Is<OpExpression>(e)){
+    OpExpression *o = As<OpExpression>(e);
+    return o->op->op == ASSIGN || HasEffects(o->lhs) || HasEffects(o->rhs);
+  }
+  return false;
+}
+
+// The tracked scalar a statement-level expression assigns, if any
+static Identifier *AssignedVar(Expression *e){
+  OpExpression *o = As<OpExpression>(e);
+  if(o == NULL || o->op->op != ASSIGN)
+    return NULL;
+  Access *a = As<Access>(o->lhs);
+  return !a->is_array && Tracked(a->id) ? a->id : NULL;
+}
+
+static bool IsEmpty(Statement *s){
+  if(s == NULL)
+    return true;
+  if(ExprStatement *es = As<ExprStatement>(s))
+    return es->expr == NULL;
+  if(StatementBlock *sb = As<StatementBlock>(s))
+    return sb->stmt_list->empty();
+  return false;
+}
+
+class DeadCodeEliminator{
+public:
+  DeadCodeStats *stats;
+  bool remove;          // false while a loop's live sets are still growing
+
+  DeadCodeEliminator(DeadCodeStats *s) {stats = s; remove = false;}
+
+  // Puts replacement where s was in its parent; NULL leaves an empty
+  // statement, which blocks then drop
+  void Replace(Statement *s, Statement *replacement){
+    Ast *parent = s->parent;
+    if(replacement == NULL)
+      replacement = new ExprStatement(NULL);
+    replacement->parent = parent;
+    if(StatementBlock *sb = As<StatementBlock>(parent)){
+      for(int i = 0; i<sb->stmt_list->size(); i++){
+        if((*sb->stmt_list)[i] == s)
+          (*sb->stmt_list)[i] = replacement;
+      }
+    }
+    else if(SelStatement *sel = As<SelStatement>(parent)){
+      if(sel->body_true == s)
+        sel->body_true = replacement;
+      else
+        sel->body_false = replacement;
+    }
+    else if(IterStatement *it = As<IterStatement>(parent))
+      it->body = replacement;
+  }
+
+  // Drops branches and loops whose test is a constant and statements no
+  // control reaches. Returns whether control never comes out of s, either
+  // because it returns or because it loops forever (there is no break).
+  bool Prune(Statement *s){
+    int val;
+    if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      if(IsConstant(sel->test, &val)){
+        Statement *taken = val ? sel->body_true : sel->body_false;
+        stats->branches++;
+        Replace(sel, taken);
+        return taken ? Prune(taken) : false;
+      }
+      bool t = Prune(sel->body_true);
+      bool f = sel->body_false ? Prune(sel->body_false) : false;
+      return t && f;
+    }
+    if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      Expression *test = it->loop_type == FOR ? it->cond->expr : it->expr;
+      if(test && IsConstant(test, &val) && !val){
+        stats->branches++;
+        Replace(it, it->loop_type == FOR ? it->init : NULL);
+        return false;
+      }
+      Prune(it->body);
+      return test == NULL || IsConstant(test, &val);
+    }
+    if(Is<StatementBlock>(s)){
+      vector<Statement *> *list = As<StatementBlock>(s)->stmt_list;
+      for(int i = 0; i<list->size(); i++){
+        if(!Prune((*list)[i]))
+          continue;
+        stats->unreachable += list->size() - i - 1;
+        list->erase(list->begin() + i + 1, list->end());
+        return true;
+      }
+      return false;
+    }
+    return Is<ReturnStatement>(s);
+  }
+
+  // Adds the tracked scalars e reads. The destination of an assignment
+  // is not a read, its subscripts are.
+  void Uses(Expression *e, set<Identifier *> &live){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(!a->is_array){
+        if(Tracked(a->id))
+          live.insert(a->id);
+        return;
+      }
+      for(int i = 0; i<a->access_list->size(); i++)
+        Uses((*a->access_list)[i], live);
+      Uses(a->base_offset, live);
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        Uses((*c->args)[i], live);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      Uses(o->rhs, live);
+      if(o->op->op != ASSIGN)
+        Uses(o->lhs, live);
+      else if(As<Access>(o->lhs)->is_array)
+        Uses(o->lhs, live);
+    }
+  }
+
+  // Live before an expression evaluated for its effect, with live after
+  void ExprLive(Expression *e, set<Identifier *> &live){
+    Identifier *v = AssignedVar(e);
+    if(v)
+      live.erase(v);
+    Uses(e, live);
+  }
+
+  // Turns live (the scalars read after s) into those read from the start
+  // of s on; in removal mode also drops what writes nothing anyone reads.
+  // A store to a variable that is dead here is not a read of its right
+  // hand side, so chains of stores feeding only each other all go.
+  void Live(Statement *s, set<Identifier *> &live){
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      if(es->expr == NULL)
+        return;
+      Identifier *v = AssignedVar(es->expr);
+      if(v && live.count(v) == 0){
+        Expression *rhs = As<OpExpression>(es->expr)->rhs;
+        bool effects = HasEffects(rhs);
+        if(remove){
+          stats->dead_stores++;
+          es->expr = effects ? rhs : NULL;
+          if(effects)
+            rhs->parent = es;
+        }
+        if(effects)
+          Uses(rhs, live);
+        return;
+      }
+      if(v == NULL && !HasEffects(es->expr)){
+        if(remove){
+          stats->dead_exprs++;
+          es->expr = NULL;
+        }
+        return;
+      }
+      ExprLive(es->expr, live);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      set<Identifier *> other = live;
+      Live(sel->body_true, live);
+      if(sel->body_false)
+        Live(sel->body_false, other);
+      live.insert(other.begin(), other.end());
+      Uses(sel->test, live);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      Expression *test = it->loop_type == FOR ? it->cond->expr : it->expr;
+      // Live at the test: what the exit needs, the test reads and the
+      // body (then the update) needs on the way back round
+      bool outer = remove;
+      remove = false;
+      set<Identifier *> head = live;
+      Uses(test, head);
+      while(true){
+        set<Identifier *> back = head;
+        if(it->loop_type == FOR)
+          ExprLive(it->expr, back);
+        Live(it->body, back);
+        size_t n = head.size();
+        head.insert(back.begin(), back.end());
+        if(head.size() == n)
+          break;
+      }
+      remove = outer;
+      if(remove){
+        set<Identifier *> back = head;
+        if(it->loop_type == FOR)
+          ExprLive(it->expr, back);
+        Live(it->body, back);
+      }
+      live = head;
+      if(it->loop_type == FOR)
+        Live(it->init, live);
+    }
+    else if(Is<StatementBlock>(s)){
+      vector<Statement *> *list = As<StatementBlock>(s)->stmt_list;
+      for(int i = list->size() - 1; i>=0; i--){
+        Live((*list)[i], live);
+        if(remove && IsEmpty((*list)[i]))
+          list->erase(list->begin() + i);
+      }
+    }
+    else if(Is<ReturnStatement>(s)){
+      // Locals die with the frame
+      live.clear();
+      Uses(As<ReturnStatement>(s)->expr, live);
+    }
+  }
+};
+
+void EliminateDeadCode(FuncDecl *fd, DeadCodeStats *stats){
+  DeadCodeStats dummy;
+  DeadCodeEliminator d(stats ? stats : &dummy);
+  d.Prune(fd->stmt_block);
+  set<Identifier *> live;
+  d.remove = true;
+  d.Live(fd->stmt_block, live);
+}
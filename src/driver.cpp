@@ -0,0 +1,189 @@
+#include "driver.h"
+#include "ast.h"
+#include "errors.h"
+#include "lexer.h"
+#include "mips.h"
+#include "options.h"
+#include "parallel.h"
+#include "report.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+
+extern char **environ;
+
+int Compile(yyscan_t scanner, FILE *out){
+  ast_arena = new Arena();
+  symbols = new SymbolTable();
+  code = new InstrStream();
+  global_sym_table = NULL;
+  asm_out = out;
+  //yydebug = 1;
+  CompileStats report;
+  if(options.time_report){
+    stats = &report;
+    report.StartParse();
+  }
+  steady_clock::time_point start = steady_clock::now();
+  int ret = yyparse(scanner);
+  double secs = duration<double>(steady_clock::now() - start).count();
+  if(stats){
+    // A program with syntax errors never reaches the program action
+    report.EndParse();
+    report.total_secs = secs;
+    report.symbols = symbols->NumSymbols();
+    PrintReport(report, diag_out, options.time_report_json);
+    stats = NULL;
+  }
+
+  if(options.arena_stats){
+    fprintf(diag_out, "arena: %d allocations from %d blocks, %d heap allocations saved, %lu bytes\n",
+            ast_arena->num_allocs, ast_arena->num_blocks,
+            ast_arena->num_allocs - ast_arena->num_blocks,
+            (unsigned long) ast_arena->bytes_used);
+    fprintf(diag_out, "arena: compilation took %.3f ms\n", secs * 1000);
+  }
+  // Every node of this compilation goes away in one step
+  delete ast_arena;
+  ast_arena = NULL;
+  delete code;
+  code = NULL;
+  delete symbols;
+  symbols = NULL;
+  global_sym_table = NULL;
+  asm_out = stdout;
+  return ret;
+}
+
+int CompileFile(FILE *in, FILE *out){
+  yyscan_t scanner = NewScanner(in);
+  int ret = Compile(scanner, out);
+  DeleteScanner(scanner);
+  return ret;
+}
+
+// What compiling one file of the batch left behind
+struct FileResult{
+  char *diag;
+  size_t diag_size;
+  bool failed;
+};
+
+// foo.c -> foo.s, in the directory of the source
+static string AsmName(const char *file){
+  string name = file;
+  size_t dot = name.rfind('.');
+  if(dot != string::npos && name.find('/', dot) == string::npos)
+    name.erase(dot);
+  return name + ".s";
+}
+
+// Compiles every file with a process of its own, the way a build without
+// batch mode does, width at a time. Each writes the .s the batch wrote,
+// which is removed again where the batch failed.
+static double TimeProcessPerFile(const char *prog, int width, const vector<FileResult> &results){
+  vector<string> flags = CompilationFlags();
+  flags.push_back("-jobs=1");
+  vector<char *> args;
+  args.push_back((char *) prog);
+  for(int i = 0; i<flags.size(); i++)
+    args.push_back((char *) flags[i].c_str());
+  args.push_back(NULL);
+
+  steady_clock::time_point start = steady_clock::now();
+  int running = 0;
+  for(int i = 0; i<options.files.size(); i++){
+    if(running == width){
+      wait(NULL);
+      running--;
+    }
+    string asm_name = AsmName(options.files[i]);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, options.files[i], O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, asm_name.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    if(posix_spawnp(&pid, args[0], &actions, NULL, &args[0], environ) == 0)
+      running++;
+    posix_spawn_file_actions_destroy(&actions);
+  }
+  for(; running > 0; running--)
+    wait(NULL);
+  double secs = duration<double>(steady_clock::now() - start).count();
+  for(int i = 0; i<options.files.size(); i++){
+    if(results[i].failed)
+      remove(AsmName(options.files[i]).c_str());
+  }
+  return secs;
+}
+
+int CompileBatch(char **argv){
+  const vector<const char *> &files = options.files;
+  vector<FileResult> results(files.size());
+  WorkStealingPool pool(options.jobs);
+  const Options &batch_options = options;
+
+  steady_clock::time_point start = steady_clock::now();
+  pool.Run(files.size(), [&](int i, int t){
+      FileResult &r = results[i];
+      if(t > 0)
+        options = batch_options;
+      diag_out = open_memstream(&r.diag, &r.diag_size);
+      numErrors = 0;
+      // The files already keep every thread busy
+      function_jobs = 1;
+
+      string asm_name = AsmName(files[i]);
+      FILE *in = fopen(files[i], "r");
+      FILE *out = in ? fopen(asm_name.c_str(), "w") : NULL;
+      if(out == NULL){
+        fprintf(diag_out, "\n*** Error.\n*** Can't open %s\n\n", in ? asm_name.c_str() : files[i]);
+        r.failed = true;
+      }
+      else
+        r.failed = CompileFile(in, out) != 0 || numErrors > 0;
+      if(in)
+        fclose(in);
+      if(out){
+        fclose(out);
+        if(r.failed)
+          remove(asm_name.c_str());
+      }
+
+      fclose(diag_out);
+      diag_out = stderr;
+      numErrors = 0;
+    });
+  double secs = duration<double>(steady_clock::now() - start).count();
+
+  int failed = 0;
+  for(int i = 0; i<files.size(); i++){
+    FileResult &r = results[i];
+    if(r.diag_size > 0){
+      fprintf(stderr, "%s:\n", files[i]);
+      fwrite(r.diag, 1, r.diag_size, stderr);
+    }
+    free(r.diag);
+    if(r.failed)
+      failed++;
+  }
+
+  if(options.batch_stats){
+    int n = files.size();
+    int width = n < pool.NumThreads() ? n : pool.NumThreads();
+    fprintf(stderr, "batch: %d files in %.3f s on %d threads, %.1f files/sec\n",
+            n, secs, width, n / secs);
+    double process_secs = TimeProcessPerFile(argv[0], width, results);
+    fprintf(stderr, "batch: a process per file, %d at a time: %.3f s, %.1f files/sec (batch %.2fx)\n",
+            width, process_secs, n / process_secs, process_secs / secs);
+  }
+  return failed > 0;
+}
@@ -0,0 +1,22 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "lexer.h"
+#include <stdio.h>
+
+// Compiles the program the scanner reads and writes its assembly to out,
+// the diagnostics going to this thread's diag_out. The arena, symbol
+// table and instruction stream are the compilation's own and freed before
+// it returns, so several programs can be compiled at once on different
+// threads. Returns yyparse()'s result.
+int Compile(yyscan_t scanner, FILE *out);
+// Compile() of the program read from in
+int CompileFile(FILE *in, FILE *out);
+
+// Compiles every file named in options.files to a .s beside it,
+// options.jobs files at a time in this process. Each file's diagnostics
+// are printed as one block under its name, in command line order, and no
+// .s is left for a file with errors. Returns nonzero if any file failed.
+int CompileBatch(char **argv);
+
+#endif
@@ -8,23 +8,35 @@
 
 using namespace std;
 
+thread_local int numErrors = 0;
+thread_local FILE *diag_out = stderr;
+thread_local vector<Diagnostic> *diagnostics;
+
 void UnderlineErrorInLine(const char *line, YYLTYPE *pos) {
   if (!line) return;
-  cerr << line << endl;
+  fprintf(diag_out, "%s\n", line);
   for (int i = 1; i <= pos->last_column; i++)
-    cerr << (i >= pos->first_column ? '^' : ' ');
-  cerr << endl;
+    fputc(i >= pos->first_column ? '^' : ' ', diag_out);
+  fputc('\n', diag_out);
 }
 
 void OutputError(YYLTYPE *loc, string msg) {
   numErrors++;
   fflush(stdout); // make sure any buffered text has been output
   if (loc) {
-    cerr << endl << "*** Error line " << loc->first_line << "." << endl;
+    fprintf(diag_out, "\n*** Error line %d.\n", loc->first_line);
     UnderlineErrorInLine(GetLineNumbered(loc->first_line), loc);
   } else
-    cerr << endl << "*** Error." << endl;
-  cerr << "*** " << msg << endl << endl;
+    fprintf(diag_out, "\n*** Error.\n");
+  fprintf(diag_out, "*** %s\n\n", msg.c_str());
+  if (diagnostics) {
+    Diagnostic d;
+    d.line = loc ? loc->first_line : 0;
+    d.first_column = loc ? loc->first_column : 0;
+    d.last_column = loc ? loc->last_column : 0;
+    d.message = msg;
+    diagnostics->push_back(d);
+  }
 }
 
 void Formatted(YYLTYPE *loc, const char *format, ...) {
@@ -92,8 +104,8 @@ void NoMainFound() {
   OutputError(NULL, "Linker: function 'main' not defined");
 }
 
-void yyerror(const char *msg) {
-  Formatted(&yylloc, "%s", msg);
+void yyerror(YYLTYPE *loc, yyscan_t scanner, const char *msg) {
+  Formatted(loc, "%s", msg);
 }
 
 void NumArgsMismatch(FuncDecl *fn, int numExpected, int numGiven) {
@@ -132,7 +144,7 @@ void ArrayWithoutDim(Access *access) {
 
 void NumDimsMismatch(Access *access, int numExpected, int numGiven) {
   ostringstream s;
-  s << " '"<< access->name <<
+  s << " '"<< symbols->Name(access->sym) <<
     "' expects " << numExpected << " dimesions(s)" << numGiven << " given";
   OutputError(access->loc, s.str());
 }
@@ -141,8 +153,6 @@ void SubscriptNotInteger(Expression *subscriptExpr) {
   OutputError(subscriptExpr->loc, "Array subscript must be an integer");
 }
 
-int numErrors = 0;
-
 /*
   void ReportError::UntermString(yyltype *loc, const char *str) {
   ostringstream s;
@@ -3,6 +3,8 @@
 
 #define MAX_ID_LEN 255
 #include "location.h"
+#include "lexer.h"
+#include "compiler.h"
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
@@ -31,8 +33,14 @@ void BracketsOnNonArray(Access *);
 void ArrayWithoutDim(Access *);
 void NumDimsMismatch(Access *, int, int);
 void SubscriptNotInteger(Expression *);
-void yyerror(const char *);
+void yyerror(YYLTYPE *, yyscan_t, const char *);
 
-extern int numErrors;
+// Errors reported by the current thread and where its diagnostics go.
+// Functions compiled on worker threads collect theirs apart and have
+// them written out in program order.
+extern thread_local int numErrors;
+extern thread_local FILE *diag_out;
+// When set, every error is also added here (CompileSource())
+extern thread_local vector<Diagnostic> *diagnostics;
 
 #endif
@@ -0,0 +1,329 @@
+#include "opt.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#define MAX_FOLD_ROUNDS 8
+
+static bool IsConst(Expression *e){
+  return Is<IntConst>(e) || Is<BoolConst>(e);
+}
+
+static int ConstValue(Expression *e){
+  if(Is<IntConst>(e))
+    return As<IntConst>(e)->val;
+  return As<BoolConst>(e)->val;
+}
+
+static Expression *MakeConst(YYLTYPE *loc, enum Type t, int val){
+  YYLTYPE l;
+  if(loc)
+    l = *loc;
+  else
+    l.first_line = l.first_column = l.last_line = l.last_column = 0;
+  if(t == T_BOOL)
+    return new BoolConst(l, val != 0);
+  return new IntConst(l, val);
+}
+
+// Arithmetic wraps around like the 32-bit MIPS registers do
+static bool Evaluate(int op, int l, int r, int *result){
+  unsigned int ul = l, ur = r;
+  switch(op){
+  case PLUS: *result = (int) (ul + ur); return true;
+  case MINUS: *result = (int) (ul - ur); return true;
+  case STAR: *result = (int) (ul * ur); return true;
+  case DIVIDE:
+  case MODULUS:
+    // Leave traps and the one overflowing quotient to the hardware
+    if(r == 0 || (l == (int) 0x80000000 && r == -1))
+      return false;
+    *result = op == DIVIDE ? l / r : l % r;
+    return true;
+  case LT: *result = l < r; return true;
+  case GT: *result = l > r; return true;
+  case EQ_OP: *result = l == r; return true;
+  case NE_OP: *result = l != r; return true;
+  case AND_OP: *result = l && r; return true;
+  case OR_OP: *result = l || r; return true;
+  }
+  return false;
+}
+
+static bool EvaluateUnary(int op, int v, int *result){
+  unsigned int uv = v;
+  switch(op){
+  case NOT: *result = !v; return true;
+  case PLUS: *result = v; return true;
+  case MINUS: *result = (int) (0u - uv); return true;
+  case INC_OP: *result = (int) (uv + 1); return true;
+  case DEC_OP: *result = (int) (uv - 1); return true;
+  }
+  return false;
+}
+
+class Folder{
+public:
+  map<Identifier *, Expression *> consts;
+  bool changed;
+
+  Expression *FoldExpr(Expression *e){
+    if(e == NULL)
+      return NULL;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->is_array){
+        FoldList(a->access_list, a);
+        FoldOffset(a);
+        return a;
+      }
+      map<Identifier *, Expression *>::iterator i = consts.find(a->id);
+      if(i != consts.end()){
+        changed = true;
+        return MakeConst(a->loc, a->type, ConstValue(i->second));
+      }
+      return a;
+    }
+    if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      FoldList(c->args, c);
+      return c;
+    }
+    if(!Is<OpExpression>(e))
+      return e;
+
+    OpExpression *o = As<OpExpression>(e);
+    o->rhs = FoldExpr(o->rhs);
+    o->rhs->parent = o;
+    if(o->op->op == ASSIGN){
+      // Only the subscripts of the destination can be folded
+      Access *a = As<Access>(o->lhs);
+      if(a->is_array){
+        FoldList(a->access_list, a);
+        FoldOffset(a);
+      }
+      return o;
+    }
+    if(o->lhs){
+      o->lhs = FoldExpr(o->lhs);
+      o->lhs->parent = o;
+    }
+
+    int result;
+    if(o->lhs == NULL){
+      if(IsConst(o->rhs) && EvaluateUnary(o->op->op, ConstValue(o->rhs), &result)){
+        changed = true;
+        return MakeConst(o->op->loc, o->type, result);
+      }
+    }
+    else if(IsConst(o->lhs) && IsConst(o->rhs) &&
+            Evaluate(o->op->op, ConstValue(o->lhs), ConstValue(o->rhs), &result)){
+      changed = true;
+      return MakeConst(o->op->loc, o->type, result);
+    }
+    return o;
+  }
+
+  void FoldOffset(Access *a){
+    if(a->base_offset){
+      a->base_offset = FoldExpr(a->base_offset);
+      a->base_offset->parent = a;
+    }
+  }
+
+  void FoldList(vector<Expression *> *v, Ast *parent){
+    for(int i = 0; i<v->size(); i++){
+      (*v)[i] = FoldExpr((*v)[i]);
+      (*v)[i]->parent = parent;
+    }
+  }
+
+  void FoldStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      if(es->expr){
+        es->expr = FoldExpr(es->expr);
+        es->expr->parent = es;
+      }
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      sel->test = FoldExpr(sel->test);
+      sel->test->parent = sel;
+      FoldStmt(sel->body_true);
+      FoldStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        FoldStmt(it->init);
+        FoldStmt(it->cond);
+      }
+      it->expr = FoldExpr(it->expr);
+      it->expr->parent = it;
+      FoldStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        FoldStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ReturnStatement *r = As<ReturnStatement>(s);
+      if(r->expr){
+        r->expr = FoldExpr(r->expr);
+        r->expr->parent = r;
+      }
+    }
+  }
+};
+
+// Assignments and uses of the scalar locals of one function, numbered in
+// program order so that "every use follows the assignment" is a compare
+class AssignmentScan{
+public:
+  struct VarInfo{
+    int num_assigns;
+    OpExpression *assign;
+    int assign_end;         // last number inside the assigning statement
+    int first_use;
+    VarInfo() {num_assigns = 0; assign = NULL; assign_end = -1; first_use = -1;}
+  };
+  map<Identifier *, VarInfo> vars;
+  int seq;
+
+  AssignmentScan() {seq = 0;}
+
+  static bool Candidate(Identifier *id){
+    return id && !id->is_array && !id->is_global;
+  }
+
+  void ScanExpr(Expression *e){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->is_array){
+        ScanList(a->access_list);
+        ScanExpr(a->base_offset);
+      }
+      else if(Candidate(a->id)){
+        VarInfo &v = vars[a->id];
+        if(v.first_use < 0)
+          v.first_use = seq;
+        seq++;
+      }
+    }
+    else if(Is<Call>(e)){
+      ScanList(As<Call>(e)->args);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      ScanExpr(o->rhs);
+      if(o->op->op == ASSIGN){
+        Access *a = As<Access>(o->lhs);
+        if(a->is_array){
+          ScanList(a->access_list);
+          ScanExpr(a->base_offset);
+        }
+        else if(Candidate(a->id)){
+          VarInfo &v = vars[a->id];
+          v.num_assigns++;
+          v.assign = o;
+        }
+      }
+      else
+        ScanExpr(o->lhs);
+    }
+  }
+
+  void ScanList(vector<Expression *> *v){
+    for(int i = 0; i<v->size(); i++)
+      ScanExpr((*v)[i]);
+  }
+
+  void ScanStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      ScanExpr(es->expr);
+      // Remember where the statement holding a top-level assignment ends
+      if(es->expr && Is<OpExpression>(es->expr)){
+        OpExpression *o = As<OpExpression>(es->expr);
+        if(o->op->op == ASSIGN){
+          Access *a = As<Access>(o->lhs);
+          if(Candidate(a->id) && !a->is_array)
+            vars[a->id].assign_end = seq++;
+        }
+      }
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      ScanExpr(sel->test);
+      ScanStmt(sel->body_true);
+      ScanStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        ScanStmt(it->init);
+        ScanStmt(it->cond);
+      }
+      ScanExpr(it->expr);
+      ScanStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        ScanStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ScanExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+};
+
+// The single assignment must be a statement of the block declaring the
+// variable: every later statement of that block then runs after it, and
+// scoping keeps all other uses inside the block.
+static bool Dominates(OpExpression *assign, Identifier *id){
+  Ast *es = assign->parent;
+  if(es == NULL || !Is<ExprStatement>(es))
+    return false;
+  Ast *block = es->parent;
+  if(block == NULL || !Is<StatementBlock>(block))
+    return false;
+  map<string, Identifier *> *symbols = As<StatementBlock>(block)->symbol_table;
+  map<string, Identifier *>::iterator i = symbols->find(id->name);
+  return i != symbols->end() && i->second == id;
+}
+
+void FoldConstants(FuncDecl *fd){
+  Folder f;
+  for(int round = 0; round < MAX_FOLD_ROUNDS; round++){
+    f.changed = false;
+    f.FoldStmt(fd->stmt_block);
+
+    AssignmentScan scan;
+    scan.ScanStmt(fd->stmt_block);
+    for(map<Identifier *, AssignmentScan::VarInfo>::iterator i = scan.vars.begin();
+        i != scan.vars.end(); ++i)
+    {
+      AssignmentScan::VarInfo &v = i->second;
+      if(v.num_assigns != 1 || f.consts.count(i->first) || !IsConst(v.assign->rhs))
+        continue;
+      if(v.assign_end < 0 || (v.first_use >= 0 && v.first_use < v.assign_end))
+        continue;
+      if(!Dominates(v.assign, i->first))
+        continue;
+      f.consts[i->first] = v.assign->rhs;
+      f.changed = true;
+    }
+    if(!f.changed)
+      break;
+  }
+}
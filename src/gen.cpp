@@ -0,0 +1,60 @@
+#include "synth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+struct Knob{
+  const char *name;
+  int SynthOptions::*field;
+  const char *help;
+};
+
+static const Knob knobs[] = {
+  {"functions", &SynthOptions::functions, "functions besides main()"},
+  {"statements", &SynthOptions::statements, "statements per function"},
+  {"depth", &SynthOptions::depth, "nesting of if/for/while/blocks"},
+  {"expr-depth", &SynthOptions::expr_depth, "operators on the longest path of an expression"},
+  {"dims", &SynthOptions::dims, "dimensions of the arrays (0: no arrays)"},
+  {"identifiers", &SynthOptions::identifiers, "scalar locals per function"},
+};
+
+#define NUM_KNOBS (sizeof(knobs) / sizeof(knobs[0]))
+
+static void Usage(const char *prog){
+  SynthOptions o = DefaultSynthOptions();
+  fprintf(stderr, "usage: %s [-knob=N]... > file.c\n", prog);
+  for(int i = 0; i<NUM_KNOBS; i++){
+    fprintf(stderr, "  -%s=N%*s %s (default %d)\n", knobs[i].name,
+            (int) (13 - strlen(knobs[i].name)), "", knobs[i].help, o.*knobs[i].field);
+  }
+  fprintf(stderr, "  -seed=N          a different program of the same shape\n");
+}
+
+int main(int argc, char **argv){
+  SynthOptions o = DefaultSynthOptions();
+  for(int i = 1; i<argc; i++){
+    const char *arg = argv[i];
+    const char *eq = strchr(arg, '=');
+    int j = NUM_KNOBS;
+    if(arg[0] == '-' && eq){
+      string name(arg + 1, eq - arg - 1);
+      if(name == "seed"){
+        o.seed = strtoul(eq + 1, NULL, 10);
+        continue;
+      }
+      for(j = 0; j<NUM_KNOBS; j++){
+        if(name == knobs[j].name)
+          break;
+      }
+    }
+    if(j == NUM_KNOBS || atoi(eq + 1) < 0){
+      Usage(argv[0]);
+      return 2;
+    }
+    o.*knobs[j].field = atoi(eq + 1);
+  }
+  fputs(SynthProgram(o).c_str(), stdout);
+  return 0;
+}
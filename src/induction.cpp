@@ -0,0 +1,648 @@
+#include "opt.h"
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+// How often each scalar is read or written, and how often assigned
+class UseCount{
+public:
+  map<Identifier *, int> uses;
+  map<Identifier *, int> assigns;
+
+  void CountExpr(Expression *e){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->is_array){
+        for(int i = 0; i<a->access_list->size(); i++)
+          CountExpr((*a->access_list)[i]);
+        CountExpr(a->base_offset);
+      }
+      else
+        uses[a->id]++;
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        CountExpr((*c->args)[i]);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      CountExpr(o->rhs);
+      CountExpr(o->lhs);
+      if(o->op->op == ASSIGN && !As<Access>(o->lhs)->is_array)
+        assigns[As<Access>(o->lhs)->id]++;
+    }
+  }
+
+  void CountStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      CountExpr(As<ExprStatement>(s)->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      CountExpr(sel->test);
+      CountStmt(sel->body_true);
+      CountStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        CountStmt(it->init);
+        CountStmt(it->cond);
+      }
+      CountExpr(it->expr);
+      CountStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        CountStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      CountExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+
+  // Adds the counts of c, or takes them away with sign -1
+  void Add(UseCount &c, int sign){
+    for(map<Identifier *, int>::iterator i = c.uses.begin(); i != c.uses.end(); i++)
+      uses[i->first] += sign * i->second;
+    for(map<Identifier *, int>::iterator i = c.assigns.begin(); i != c.assigns.end(); i++)
+      assigns[i->first] += sign * i->second;
+  }
+};
+
+// "v = v + c", "v = c + v" or "v = v - c": returns v and the step
+static Identifier *BasicStep(Expression *e, int *step){
+  if(e == NULL || !Is<OpExpression>(e))
+    return NULL;
+  OpExpression *o = As<OpExpression>(e);
+  if(o->op->op != ASSIGN || !Is<OpExpression>(o->rhs))
+    return NULL;
+  Access *lhs = As<Access>(o->lhs);
+  OpExpression *r = As<OpExpression>(o->rhs);
+  if(lhs->is_array || lhs->id->is_global || r->lhs == NULL)
+    return NULL;
+  Access *var = As<Access>(r->lhs);
+  IntConst *c = As<IntConst>(r->rhs);
+  if(r->op->op == PLUS && c == NULL){
+    var = As<Access>(r->rhs);
+    c = As<IntConst>(r->lhs);
+  }
+  if((r->op->op != PLUS && r->op->op != MINUS) || var == NULL || c == NULL ||
+     var->is_array || var->id != lhs->id || c->val == 0)
+    return NULL;
+  *step = r->op->op == PLUS ? c->val : -c->val;
+  return lhs->id;
+}
+
+class InductionReducer{
+public:
+  FuncDecl *fd;
+  bool changed;
+
+  // State of the loop being processed
+  Identifier *iv;               // the basic induction variable
+  int step;
+  Expression *start;            // value iv enters with, NULL when set before the loop
+  set<Identifier *> variant;
+  vector<Statement *> preheader;
+  vector<Statement *> updates;  // run after the body, next to iv's own step
+  struct Pointer{
+    Identifier *var;
+    Expression *derived;        // what var tracks, in terms of iv
+  };
+  vector<Pointer> pointers;
+
+  // A first pass only collects the derived expressions, so that pointers
+  // are made just where they pay for their own update
+  bool dry_run;
+  bool reduce_all;
+  vector<pair<Expression *, int> > found;  // with the instructions a pointer saves
+  int found_iv_uses;
+
+  // Counts over the whole function, kept up to date as loops are
+  // rewritten, and those of single statements as they are asked for
+  UseCount all;
+  map<Ast *, UseCount> counts;
+
+  InductionReducer(FuncDecl *f) {fd = f; changed = false; all.CountStmt(fd->stmt_block);}
+
+  UseCount &CountsOf(Statement *s){
+    if(counts.find(s) == counts.end())
+      counts[s].CountStmt(s);
+    return counts[s];
+  }
+
+  // e = coef * iv + (something the loop never changes)
+  bool Linear(Expression *e, int *coef){
+    if(Is<Access>(e) && As<Access>(e)->id == iv &&
+       !As<Access>(e)->is_array){
+      *coef = 1;
+      return true;
+    }
+    if(InvariantIn(e, variant)){
+      *coef = 0;
+      return true;
+    }
+    if(!Is<OpExpression>(e))
+      return false;
+    OpExpression *o = As<OpExpression>(e);
+    int l, r;
+    switch(o->op->op){
+    case PLUS:
+    case MINUS:
+      if(o->lhs == NULL){
+        if(!Linear(o->rhs, &r))
+          return false;
+        *coef = o->op->op == PLUS ? r : -r;
+        return true;
+      }
+      if(!Linear(o->lhs, &l) || !Linear(o->rhs, &r))
+        return false;
+      *coef = o->op->op == PLUS ? l + r : l - r;
+      return true;
+    case STAR:
+      if(Is<IntConst>(o->rhs) && Linear(o->lhs, &l)){
+        *coef = l * As<IntConst>(o->rhs)->val;
+        return true;
+      }
+      if(Is<IntConst>(o->lhs) && Linear(o->rhs, &r)){
+        *coef = r * As<IntConst>(o->lhs)->val;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Copy of a pure expression with iv replaced by its value on entry
+  Expression *AtStart(Expression *e){
+    YYLTYPE loc = LocOf(e);
+    Expression *copy;
+    if(Is<IntConst>(e))
+      return new IntConst(loc, As<IntConst>(e)->val);
+    if(Is<BoolConst>(e))
+      return new BoolConst(loc, As<BoolConst>(e)->val);
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      return a->id == iv && start ? AtStart(start) : UseOf(a->id, loc);
+    }
+    OpExpression *o = As<OpExpression>(e);
+    Operator *op = new Operator(LocOf(o->op), o->op->op);
+    if(o->lhs)
+      copy = new OpExpression(op, AtStart(o->lhs), AtStart(o->rhs));
+    else
+      copy = new OpExpression(op, AtStart(o->rhs));
+    copy->type = o->type;
+    return copy;
+  }
+
+  // var starts at the entry value of derived and moves with iv
+  void Track(Identifier *var, Expression *derived, int coef){
+    preheader.push_back(AssignTo(var, AtStart(derived)));
+    YYLTYPE loc = LocOf(derived);
+    OpExpression *bump = new OpExpression(new Operator(loc, PLUS), UseOf(var, loc),
+                                          new IntConst(loc, coef * step));
+    bump->type = T_INT;
+    updates.push_back(AssignTo(var, bump));
+    Pointer p;
+    p.var = var;
+    p.derived = derived;
+    pointers.push_back(p);
+    changed = true;
+  }
+
+  // Instructions it takes to compute e from values in registers
+  static int Cost(Expression *e){
+    if(e == NULL || !Is<OpExpression>(e))
+      return 0;
+    OpExpression *o = As<OpExpression>(e);
+    int c = Cost(o->lhs) + Cost(o->rhs) + 1;
+    if(o->op->op == STAR){
+      IntConst *k = As<IntConst>(o->rhs);
+      if(k == NULL)
+        k = As<IntConst>(o->lhs);
+      if(k == NULL || k->val <= 0 || (k->val & (k->val - 1)) != 0)
+        c += 2;           // li, mult, mflo instead of sll
+    }
+    return c;
+  }
+
+  // Worth a pointer when the expressions it replaces cost more per
+  // iteration than the addiu that bumps it. A subscript still has to
+  // move the pointer into $a0, so it saves one less than its cost.
+  bool Wanted(Expression *derived, int saving){
+    if(dry_run){
+      found.push_back(make_pair(derived, saving));
+      UseCount c;
+      c.CountExpr(derived);
+      found_iv_uses += c.uses[iv];
+      return false;
+    }
+    if(reduce_all)
+      return true;
+    int saved = 0;
+    for(int i = 0; i<found.size(); i++){
+      if(SameExpr(found[i].first, derived))
+        saved += found[i].second;
+    }
+    return saved > 1;
+  }
+
+  Identifier *PointerFor(Expression *derived, int coef){
+    for(int i = 0; i<pointers.size(); i++){
+      if(SameExpr(pointers[i].derived, derived))
+        return pointers[i].var;
+    }
+    Identifier *p = NewTemp(fd, T_INT, "iv");
+    Track(p, derived, coef);
+    return p;
+  }
+
+  // Subscripts moving with iv become pointers added to the address
+  void ReduceExpr(Expression *e){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(!a->is_array)
+        return;
+      for(int i = 0; i<a->access_list->size(); i++){
+        Expression *sub = (*a->access_list)[i];
+        int coef;
+        if(Is<IntConst>(sub) || !Linear(sub, &coef) || coef == 0){
+          ReduceExpr(sub);
+          continue;
+        }
+        YYLTYPE loc = LocOf(sub);
+        int stride = a->id->strides[i];
+        Expression *derived = new OpExpression(new Operator(loc, STAR), sub,
+                                               new IntConst(loc, stride));
+        derived->type = T_INT;
+        if(!Wanted(derived, Cost(derived) - 1)){
+          sub->parent = a;
+          continue;
+        }
+        Expression *use = UseOf(PointerFor(derived, coef * stride), loc);
+        if(a->base_offset){
+          use = new OpExpression(new Operator(loc, PLUS), a->base_offset, use);
+          use->type = T_INT;
+        }
+        a->base_offset = use;
+        use->parent = a;
+        (*a->access_list)[i] = new IntConst(loc, 0);
+        (*a->access_list)[i]->parent = a;
+      }
+      ReduceExpr(a->base_offset);
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        ReduceExpr((*c->args)[i]);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      ReduceExpr(o->rhs);
+      ReduceExpr(o->lhs);
+    }
+  }
+
+  void ReduceStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ReduceExpr(As<ExprStatement>(s)->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      ReduceExpr(sel->test);
+      ReduceStmt(sel->body_true);
+      ReduceStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        ReduceStmt(it->init);
+        ReduceStmt(it->cond);
+      }
+      ReduceExpr(it->expr);
+      ReduceStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        ReduceStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ReduceExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+
+  // A local assigned once, from a linear function of iv, at the top level
+  // of the body and only read after that in the same iteration (such as
+  // a row offset left by loop-invariant code motion) is a derived
+  // induction variable itself: it can be bumped instead of recomputed.
+  void ReduceDerived(StatementBlock *body, int end){
+    vector<Statement *> &list = *body->stmt_list;
+    for(int d = 0; d<end; d++){
+      ExprStatement *es = As<ExprStatement>(list[d]);
+      if(es == NULL || es->expr == NULL || !Is<OpExpression>(es->expr))
+        continue;
+      OpExpression *o = As<OpExpression>(es->expr);
+      if(o->op->op != ASSIGN)
+        continue;
+      Access *lhs = As<Access>(o->lhs);
+      Identifier *t = lhs->id;
+      int coef;
+      if(lhs->is_array || t->is_global || t == iv || all.assigns[t] != 1 ||
+         !Linear(o->rhs, &coef) || coef == 0)
+        continue;
+      UseCount later;
+      for(int i = d + 1; i<end; i++)
+        later.CountStmt(list[i]);
+      if(all.uses[t] != later.uses[t] + 1 || !Wanted(o->rhs, Cost(o->rhs)))
+        continue;
+      Track(t, o->rhs, coef);
+      RemoveStatement(es);
+      d--;
+      end--;
+    }
+  }
+
+  // Does every path from after s assign v before reading it? Follows
+  // the statements after s outwards through enclosing blocks. At the end
+  // of an enclosing loop's body the next trip is a path too: its test and
+  // update must not read v and its body must assign v first.
+  bool DeadAfter(Statement *s, Identifier *v){
+    for(Ast *a = s; a->parent != fd; a = a->parent){
+      Ast *p = a->parent;
+      if(Is<IterStatement>(p)){
+        if(!KilledOnNextTrip(As<IterStatement>(p), v))
+          return false;
+        continue;
+      }
+      if(!Is<StatementBlock>(p))
+        continue;
+      vector<Statement *> &list = *As<StatementBlock>(p)->stmt_list;
+      int i = 0;
+      while(list[i] != a)
+        i++;
+      for(i++; i<list.size(); i++){
+        if(Kills(list[i], v))
+          return true;
+        if(CountsOf(list[i]).uses[v])
+          return false;
+      }
+    }
+    return true;
+  }
+
+  bool KilledOnNextTrip(IterStatement *it, Identifier *v){
+    UseCount c;
+    c.CountExpr(it->expr);
+    if(it->loop_type == FOR)
+      c.CountStmt(it->cond);
+    if(c.uses[v])
+      return false;
+    StatementBlock *body = As<StatementBlock>(it->body);
+    if(body == NULL)
+      return it->body && Kills(it->body, v);
+    for(int i = 0; i<body->stmt_list->size(); i++){
+      Statement *t = (*body->stmt_list)[i];
+      if(Kills(t, v))
+        return true;
+      if(CountsOf(t).uses[v])
+        return false;
+    }
+    return false;
+  }
+
+  // Starts by assigning v a value computed without it
+  static bool Kills(Statement *s, Identifier *v){
+    ExprStatement *es = As<ExprStatement>(s);
+    if(Is<IterStatement>(s) && As<IterStatement>(s)->loop_type == FOR)
+      es = As<IterStatement>(s)->init;
+    if(es == NULL || es->expr == NULL || !Is<OpExpression>(es->expr))
+      return false;
+    OpExpression *o = As<OpExpression>(es->expr);
+    if(o->op->op != ASSIGN || As<Access>(o->lhs)->id != v)
+      return false;
+    UseCount c;
+    c.CountExpr(o->rhs);
+    return c.uses[v] == 0;
+  }
+
+  // "iv < N" or "iv > N" with a constant N, and iv dead once the loop
+  // is done
+  bool CounterTest(IterStatement *it, Expression ***var, IntConst **n){
+    OpExpression *test = As<OpExpression>(it->cond->expr);
+    if(!DeadAfter(it, iv) || test == NULL ||
+       (test->op->op != LT && test->op->op != GT) || test->lhs == NULL)
+      return false;
+    *var = &test->lhs;
+    *n = As<IntConst>(test->rhs);
+    if(!Is<Access>(test->lhs)){
+      *var = &test->rhs;
+      *n = As<IntConst>(test->lhs);
+    }
+    Access *a = As<Access>(**var);
+    return a && !a->is_array && a->id == iv && *n;
+  }
+
+  // The multiple k > 0 when derived is iv * k
+  int CounterMultiple(Expression *derived){
+    OpExpression *d = As<OpExpression>(derived);
+    if(d == NULL || d->op->op != STAR || !Is<Access>(d->lhs) ||
+       As<Access>(d->lhs)->id != iv || !Is<IntConst>(d->rhs))
+      return 0;
+    int k = As<IntConst>(d->rhs)->val;
+    return k > 0 ? k : 0;
+  }
+
+  // With every other use gone, the test can compare a pointer tracking
+  // iv * k against N * k instead, and iv itself disappears
+  void RemoveCounter(IterStatement *it){
+    UseCount loop;
+    loop.CountStmt(it);
+    Expression **var;
+    IntConst *n;
+    if(loop.uses[iv] != 4 || !CounterTest(it, &var, &n))
+      return;
+    for(int i = 0; i<pointers.size(); i++){
+      int k = CounterMultiple(pointers[i].derived);
+      if(k == 0)
+        continue;
+      OpExpression *test = As<OpExpression>(it->cond->expr);
+      YYLTYPE loc = LocOf(test);
+      Expression **bound = var == &test->lhs ? &test->rhs : &test->lhs;
+      *var = UseOf(pointers[i].var, loc);
+      (*var)->parent = test;
+      *bound = new IntConst(loc, n->val * k);
+      (*bound)->parent = test;
+
+      // The pointer's own start and step take over from iv's
+      ExprStatement *init = As<ExprStatement>(preheader[i]);
+      ExprStatement *bump = As<ExprStatement>(updates[i]);
+      it->init->expr = init->expr;
+      init->expr->parent = it->init;
+      it->expr = bump->expr;
+      bump->expr->parent = it;
+      preheader.erase(preheader.begin() + i);
+      updates.erase(updates.begin() + i);
+      return;
+    }
+  }
+
+  void Reduce(IterStatement *it, StatementBlock *body, int end){
+    if(body)
+      ReduceDerived(body, end);
+    if(it->loop_type == FOR)
+      ReduceStmt(it->cond);
+    else
+      ReduceExpr(it->expr);
+    if(body){
+      for(int i = 0; i<end; i++)
+        ReduceStmt((*body->stmt_list)[i]);
+    }
+    else
+      ReduceStmt(it->body);
+  }
+
+  void ReduceLoop(IterStatement *it){
+    StatementBlock *body = NULL;
+    if(Is<StatementBlock>(it->body))
+      body = As<StatementBlock>(it->body);
+    bool from_init = false;
+    int end;
+
+    // Find the basic induction variable and the value it starts from
+    if(it->loop_type == FOR){
+      iv = BasicStep(it->expr, &step);
+      if(iv == NULL)
+        return;
+      OpExpression *init = As<OpExpression>(it->init->expr);
+      if(init && init->op->op == ASSIGN && As<Access>(init->lhs)->id == iv){
+        set<Identifier *> just_iv;
+        just_iv.insert(iv);
+        if(!InvariantIn(init->rhs, just_iv))
+          return;
+        start = init->rhs;
+        from_init = true;
+      }
+      else
+        start = NULL;
+      end = body ? body->stmt_list->size() : 0;
+    }
+    else{
+      if(body == NULL || body->stmt_list->empty())
+        return;
+      ExprStatement *last = As<ExprStatement>(body->stmt_list->back());
+      if(last == NULL || (iv = BasicStep(last->expr, &step)) == NULL)
+        return;
+      start = NULL;
+      end = body->stmt_list->size() - 1;
+    }
+    if(iv->is_array)
+      return;
+
+    // iv must change in one place only: its step
+    UseCount repeated;
+    if(it->loop_type == FOR)
+      repeated.CountStmt(it->cond);
+    repeated.CountExpr(it->expr);
+    repeated.CountStmt(it->body);
+    if(repeated.assigns[iv] != 1)
+      return;
+
+    VariantInLoop(it, variant);
+    preheader.clear();
+    updates.clear();
+    pointers.clear();
+
+    dry_run = true;
+    found.clear();
+    found_iv_uses = 0;
+    Reduce(it, body, end);
+
+    // Bumping every pointer is no worse than recomputing the cheap ones
+    // when it lets the counter go: its uses apart from the test, the
+    // initialization and the step are all in derived expressions
+    Expression **var;
+    IntConst *n;
+    reduce_all = false;
+    UseCount loop;
+    loop.CountStmt(it);
+    if(from_init && loop.uses[iv] == found_iv_uses + 4 && CounterTest(it, &var, &n)){
+      for(int i = 0; i<found.size(); i++){
+        if(CounterMultiple(found[i].first))
+          reduce_all = true;
+      }
+    }
+    dry_run = false;
+    Reduce(it, body, end);
+
+    if(pointers.empty())
+      return;
+    if(from_init)
+      RemoveCounter(it);
+
+    if(!preheader.empty())
+      InsertBefore(it, preheader);
+    if(body == NULL){
+      vector<Statement *> *list = ast_arena->New<vector<Statement *> >();
+      list->push_back(it->body);
+      body = new StatementBlock(ast_arena->New<map<string, Identifier *> >(), list);
+      body->parent = it;
+      it->body = body;
+    }
+    for(int i = 0; i<updates.size(); i++){
+      body->stmt_list->push_back(updates[i]);
+      updates[i]->parent = body;
+    }
+
+    // Only this loop and the preheader changed: trade their old counts
+    // for the new ones, and forget those of the statements around them
+    UseCount now;
+    now.CountStmt(it);
+    for(int i = 0; i<preheader.size(); i++)
+      now.CountStmt(preheader[i]);
+    all.Add(now, 1);
+    all.Add(loop, -1);
+    for(Ast *a = it; a != fd; a = a->parent)
+      counts.erase(a);
+  }
+
+  // Inner loops first; their pointers are set up in the outer body
+  void Walk(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      Walk(sel->body_true);
+      Walk(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      Walk(it->body);
+      ReduceLoop(it);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      vector<Statement *> list = *sb->stmt_list;
+      for(int i = 0; i<list.size(); i++)
+        Walk(list[i]);
+    }
+  }
+};
+
+bool ReduceInductionVariables(FuncDecl *fd){
+  InductionReducer r(fd);
+  r.Walk(fd->stmt_block);
+  return r.changed;
+}
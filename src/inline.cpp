@@ -0,0 +1,619 @@
+#include "opt.h"
+#include "options.h"
+#include "errors.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+
+using namespace std;
+
+// A callee is substituted when its body, returns rewritten, has at most
+// this many nodes plus ARG_CREDIT for each argument, whose push and
+// reload the call no longer needs
+#define INLINE_BUDGET 24
+#define ARG_CREDIT 4
+// Nodes all the substitutions into one caller may add up to
+#define CALLER_GROWTH 400
+
+// How the value of an inlined call is used, and so what its returns become
+enum InlineUse{
+  U_DISCARD,    // f(...);            returns evaluate their value
+  U_ASSIGN,     // x = f(...);        returns assign it
+  U_RETURN      // return f(...);     returns return from the caller
+};
+
+// Calls anywhere in an expression
+static void FindCalls(Expression *e, vector<Call *> &calls){
+  if(e == NULL)
+    return;
+  if(Call *c = As<Call>(e)){
+    for(int i = 0; i<c->args->size(); i++)
+      FindCalls((*c->args)[i], calls);
+    calls.push_back(c);
+  }
+  else if(Access *a = As<Access>(e)){
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+      FindCalls((*a->access_list)[i], calls);
+    FindCalls(a->base_offset, calls);
+  }
+  else if(OpExpression *o = As<OpExpression>(e)){
+    FindCalls(o->lhs, calls);
+    FindCalls(o->rhs, calls);
+  }
+}
+
+static int Nodes(Expression *e){
+  if(e == NULL)
+    return 0;
+  int n = 1;
+  if(Call *c = As<Call>(e)){
+    for(int i = 0; i<c->args->size(); i++)
+      n += Nodes((*c->args)[i]);
+  }
+  else if(Access *a = As<Access>(e)){
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+      n += Nodes((*a->access_list)[i]);
+  }
+  else if(OpExpression *o = As<OpExpression>(e))
+    n += Nodes(o->lhs) + Nodes(o->rhs);
+  return n;
+}
+
+static int Nodes(Statement *s){
+  if(s == NULL)
+    return 0;
+  if(ExprStatement *es = As<ExprStatement>(s))
+    return Nodes(es->expr);
+  if(SelStatement *sel = As<SelStatement>(s))
+    return 1 + Nodes(sel->test) + Nodes(sel->body_true) + Nodes(sel->body_false);
+  if(IterStatement *it = As<IterStatement>(s)){
+    int n = 1 + Nodes(it->expr) + Nodes(it->body);
+    if(it->loop_type == FOR)
+      n += Nodes(it->init) + Nodes(it->cond);
+    return n;
+  }
+  if(StatementBlock *sb = As<StatementBlock>(s)){
+    int n = 0;
+    for(int i = 0; i<sb->stmt_list->size(); i++)
+      n += Nodes((*sb->stmt_list)[i]);
+    return n;
+  }
+  return 1 + Nodes(As<ReturnStatement>(s)->expr);
+}
+
+static bool ContainsReturn(Statement *s){
+  if(s == NULL)
+    return false;
+  if(Is<ReturnStatement>(s))
+    return true;
+  if(SelStatement *sel = As<SelStatement>(s))
+    return ContainsReturn(sel->body_true) || ContainsReturn(sel->body_false);
+  if(IterStatement *it = As<IterStatement>(s))
+    return ContainsReturn(it->body);
+  if(StatementBlock *sb = As<StatementBlock>(s)){
+    for(int i = 0; i<sb->stmt_list->size(); i++)
+      if(ContainsReturn((*sb->stmt_list)[i]))
+        return true;
+  }
+  return false;
+}
+
+static bool AlwaysReturns(Statement *s){
+  if(s == NULL)
+    return false;
+  if(Is<ReturnStatement>(s))
+    return true;
+  if(SelStatement *sel = As<SelStatement>(s))
+    return AlwaysReturns(sel->body_true) && AlwaysReturns(sel->body_false);
+  if(StatementBlock *sb = As<StatementBlock>(s)){
+    for(int i = 0; i<sb->stmt_list->size(); i++)
+      if(AlwaysReturns((*sb->stmt_list)[i]))
+        return true;
+  }
+  return false;
+}
+
+// Scalar locals of every block of a body; false if one is an array
+static bool FindLocals(Statement *s, vector<Identifier *> &locals){
+  if(s == NULL)
+    return true;
+  if(SelStatement *sel = As<SelStatement>(s))
+    return FindLocals(sel->body_true, locals) && FindLocals(sel->body_false, locals);
+  if(IterStatement *it = As<IterStatement>(s))
+    return FindLocals(it->body, locals);
+  if(StatementBlock *sb = As<StatementBlock>(s)){
+    for(map<string, Identifier *>::iterator i = sb->symbol_table->begin();
+        i != sb->symbol_table->end(); ++i){
+      if(i->second->is_array)
+        return false;
+      locals.push_back(i->second);
+    }
+    for(int i = 0; i<sb->stmt_list->size(); i++)
+      if(!FindLocals((*sb->stmt_list)[i], locals))
+        return false;
+  }
+  return true;
+}
+
+static StatementBlock *NewBlock(const vector<Statement *> &stmts){
+  return new StatementBlock(ast_arena->New<map<string, Identifier *> >(),
+                            ast_arena->New<vector<Statement *> >(stmts));
+}
+
+// Copies a callee's body with its variables replaced by those in vars.
+// Blocks come out without locals, which all become the caller's. Once
+// use is set, returns become what that kind of call site needs.
+class BodyCopier{
+public:
+  map<Identifier *, Identifier *> vars;
+  bool rewrite_returns;
+  InlineUse use;
+  Identifier *into;     // U_ASSIGN: the scalar the value goes to
+  FuncDecl *caller;
+
+  BodyCopier() {rewrite_returns = false; into = NULL; caller = NULL;}
+
+  Expression *Expr(Expression *e){
+    if(e == NULL)
+      return NULL;
+    YYLTYPE loc = LocOf(e);
+    Expression *copy;
+    if(IntConst *c = As<IntConst>(e))
+      return new IntConst(loc, c->val);
+    if(BoolConst *c = As<BoolConst>(e))
+      return new BoolConst(loc, c->val);
+    if(Access *a = As<Access>(e)){
+      Access *na;
+      if(a->is_array){
+        vector<Expression *> *list = ast_arena->New<vector<Expression *> >();
+        for(int i = 0; i<a->access_list->size(); i++)
+          list->push_back(Expr((*a->access_list)[i]));
+        na = new Access(loc, a->sym, list);
+      }
+      else
+        na = new Access(loc, a->sym);
+      na->id = vars.count(a->id) ? vars[a->id] : a->id;
+      na->sym = na->id->sym;
+      na->type = a->type;
+      na->base_offset = Expr(a->base_offset);
+      if(na->base_offset)
+        na->base_offset->parent = na;
+      return na;
+    }
+    if(Call *c = As<Call>(e)){
+      vector<Expression *> *args = ast_arena->New<vector<Expression *> >();
+      for(int i = 0; i<c->args->size(); i++)
+        args->push_back(Expr((*c->args)[i]));
+      Call *nc = new Call(loc, c->sym, args);
+      nc->fd = c->fd;
+      nc->type = c->type;
+      return nc;
+    }
+    OpExpression *o = As<OpExpression>(e);
+    Operator *op = new Operator(LocOf(o->op), o->op->op);
+    if(o->lhs)
+      copy = new OpExpression(op, Expr(o->lhs), Expr(o->rhs));
+    else
+      copy = new OpExpression(op, Expr(o->rhs));
+    copy->type = o->type;
+    return copy;
+  }
+
+  Statement *Stmt(Statement *s){
+    if(s == NULL)
+      return NULL;
+    if(ExprStatement *es = As<ExprStatement>(s))
+      return new ExprStatement(Expr(es->expr));
+    if(SelStatement *sel = As<SelStatement>(s))
+      return new SelStatement(Expr(sel->test), Stmt(sel->body_true), Stmt(sel->body_false));
+    if(IterStatement *it = As<IterStatement>(s)){
+      if(it->loop_type == WHILE)
+        return new IterStatement(Expr(it->expr), Stmt(it->body));
+      return new IterStatement(As<ExprStatement>(Stmt(it->init)),
+                               As<ExprStatement>(Stmt(it->cond)),
+                               Expr(it->expr), Stmt(it->body));
+    }
+    if(StatementBlock *sb = As<StatementBlock>(s)){
+      vector<Statement *> list;
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        list.push_back(Stmt((*sb->stmt_list)[i]));
+      return NewBlock(list);
+    }
+    ReturnStatement *r = As<ReturnStatement>(s);
+    Expression *value = Expr(r->expr);
+    if(rewrite_returns && use == U_DISCARD)
+      return new ExprStatement(value);
+    if(rewrite_returns && use == U_ASSIGN)
+      return value ? AssignTo(into, value) : new ExprStatement(NULL);
+    ReturnStatement *nr = value ? new ReturnStatement(LocOf(r), value) :
+      new ReturnStatement(LocOf(r));
+    nr->fd = rewrite_returns ? caller : r->fd;
+    nr->MarkTailCall();
+    return nr;
+  }
+};
+
+// Gives every return of a body in statement list form the end of its
+// path to itself, so that it can fall through to the join point at the
+// end of the inlined code: what follows an if that may return moves
+// into the branches of it that do not. Nested blocks are flattened,
+// their locals being the caller's by then. False for a return inside a
+// loop, which only a jump could leave.
+static bool EndPaths(vector<Statement *> &list){
+  for(int i = 0; i<list.size(); i++){
+    Statement *s = list[i];
+    if(StatementBlock *sb = As<StatementBlock>(s)){
+      list.erase(list.begin() + i);
+      list.insert(list.begin() + i, sb->stmt_list->begin(), sb->stmt_list->end());
+      i--;
+      continue;
+    }
+    if(Is<ReturnStatement>(s)){
+      list.resize(i + 1);
+      return true;
+    }
+    if(Is<IterStatement>(s) && ContainsReturn(s))
+      return false;
+    SelStatement *sel = As<SelStatement>(s);
+    if(sel == NULL || !ContainsReturn(sel))
+      continue;
+
+    vector<Statement *> rest(list.begin() + i + 1, list.end());
+    list.resize(i + 1);
+    bool rest_used = false;
+    Statement **branches[2] = {&sel->body_true, &sel->body_false};
+    for(int b = 0; b<2; b++){
+      vector<Statement *> branch;
+      if(*branches[b])
+        branch.push_back(*branches[b]);
+      if(!AlwaysReturns(*branches[b])){
+        // Both branches may fall through: the second gets a copy
+        BodyCopier copier;
+        for(int j = 0; j<rest.size(); j++)
+          branch.push_back(rest_used ? copier.Stmt(rest[j]) : rest[j]);
+        rest_used = true;
+      }
+      if(!EndPaths(branch))
+        return false;
+      *branches[b] = NewBlock(branch);
+      (*branches[b])->parent = sel;
+    }
+    return true;
+  }
+  return true;
+}
+
+// The call evaluated first in e, if all that is evaluated before it
+// outside of it are reads of locals, which no callee can see or change.
+// Its body can then go in front of the statement. Sets blocked once
+// something else has been evaluated.
+static Call *FirstCall(Expression *e, bool &blocked){
+  if(e == NULL || blocked)
+    return NULL;
+  Call *found;
+  if(Call *c = As<Call>(e)){
+    // Its arguments go along with it, whatever they read; a call among
+    // them comes first if it can
+    bool in_args = false;
+    for(int i = c->args->size() - 1; i>=0 && !in_args; i--)
+      if((found = FirstCall((*c->args)[i], in_args)))
+        return found;
+    return c;
+  }
+  if(Access *a = As<Access>(e)){
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+      if((found = FirstCall((*a->access_list)[i], blocked)) || blocked)
+        return found;
+    if((found = FirstCall(a->base_offset, blocked)) || blocked)
+      return found;
+    blocked = a->id->is_global;
+    return NULL;
+  }
+  if(OpExpression *o = As<OpExpression>(e)){
+    // The right operand of && and || may not be evaluated at all
+    if(o->op->op == AND_OP || o->op->op == OR_OP){
+      if((found = FirstCall(o->lhs, blocked)) || blocked)
+        return found;
+      blocked = true;
+      return NULL;
+    }
+    if((found = FirstCall(o->rhs, blocked)) || blocked)
+      return found;
+    if(o->op->op != ASSIGN)
+      return FirstCall(o->lhs, blocked);
+    // The subscripts of the element assigned come before the store
+    Access *a = As<Access>(o->lhs);
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+      if((found = FirstCall((*a->access_list)[i], blocked)) || blocked)
+        return found;
+    if((found = FirstCall(a->base_offset, blocked)) || blocked)
+      return found;
+    blocked = true;
+    return NULL;
+  }
+  return NULL;
+}
+
+// Puts e in the place of old in the node holding it
+static void ReplaceExpr(Expression *old, Expression *e){
+  Ast *parent = old->parent;
+  e->parent = parent;
+  if(OpExpression *o = As<OpExpression>(parent)){
+    if(o->lhs == old)
+      o->lhs = e;
+    else
+      o->rhs = e;
+  }
+  else if(Call *c = As<Call>(parent)){
+    for(int i = 0; i<c->args->size(); i++)
+      if((*c->args)[i] == old)
+        (*c->args)[i] = e;
+  }
+  else if(Access *a = As<Access>(parent)){
+    if(a->base_offset == old)
+      a->base_offset = e;
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+      if((*a->access_list)[i] == old)
+        (*a->access_list)[i] = e;
+  }
+  else if(ExprStatement *es = As<ExprStatement>(parent))
+    es->expr = e;
+  else if(SelStatement *sel = As<SelStatement>(parent))
+    sel->test = e;
+  else
+    As<ReturnStatement>(parent)->expr = e;
+}
+
+// A call evaluated first in its statement, see FirstCall()
+struct CallSite{
+  Statement *stmt;
+  Call *call;
+  InlineUse use;
+};
+
+class Inliner{
+public:
+  map<FuncDecl *, vector<FuncDecl *> > callees;      // in the order of their first call
+  set<FuncDecl *> recursive;
+  set<FuncDecl *> done;
+
+  void FindCallees(Statement *s, vector<FuncDecl *> &found){
+    vector<Call *> calls;
+    vector<Statement *> stmts;
+    Walk(s, stmts);
+    for(int i = 0; i<stmts.size(); i++)
+      StatementCalls(stmts[i], calls);
+    for(int i = 0; i<calls.size(); i++)
+      if(find(found.begin(), found.end(), calls[i]->fd) == found.end())
+        found.push_back(calls[i]->fd);
+  }
+
+  // Every statement, outer ones first
+  static void Walk(Statement *s, vector<Statement *> &stmts){
+    if(s == NULL)
+      return;
+    stmts.push_back(s);
+    if(SelStatement *sel = As<SelStatement>(s)){
+      Walk(sel->body_true, stmts);
+      Walk(sel->body_false, stmts);
+    }
+    else if(IterStatement *it = As<IterStatement>(s))
+      Walk(it->body, stmts);
+    else if(StatementBlock *sb = As<StatementBlock>(s)){
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        Walk((*sb->stmt_list)[i], stmts);
+    }
+  }
+
+  // Calls in the statement's own expressions, not in nested statements
+  static void StatementCalls(Statement *s, vector<Call *> &calls){
+    if(ExprStatement *es = As<ExprStatement>(s))
+      FindCalls(es->expr, calls);
+    else if(SelStatement *sel = As<SelStatement>(s))
+      FindCalls(sel->test, calls);
+    else if(IterStatement *it = As<IterStatement>(s)){
+      if(it->loop_type == FOR){
+        FindCalls(it->init->expr, calls);
+        FindCalls(it->cond->expr, calls);
+      }
+      FindCalls(it->expr, calls);
+    }
+    else if(ReturnStatement *r = As<ReturnStatement>(s))
+      FindCalls(r->expr, calls);
+  }
+
+  // Whether f can reach itself through the call graph
+  bool Reaches(FuncDecl *from, FuncDecl *to, set<FuncDecl *> &seen){
+    vector<FuncDecl *> &next = callees[from];
+    for(vector<FuncDecl *>::iterator i = next.begin(); i != next.end(); ++i){
+      if(*i == to)
+        return true;
+      if(seen.insert(*i).second && Reaches(*i, to, seen))
+        return true;
+    }
+    return false;
+  }
+
+  static bool SiteOf(Statement *s, CallSite &site){
+    // Loop headers have no place in front of them to put statements
+    if(IterStatement *it = As<IterStatement>(s->parent)){
+      if(it->body != s)
+        return false;
+    }
+    Expression *e = NULL;
+    if(ExprStatement *es = As<ExprStatement>(s))
+      e = es->expr;
+    else if(SelStatement *sel = As<SelStatement>(s))
+      e = sel->test;
+    else if(ReturnStatement *r = As<ReturnStatement>(s))
+      e = r->expr;
+    bool blocked = false;
+    site.stmt = s;
+    site.call = FirstCall(e, blocked);
+    if(site.call == NULL)
+      return false;
+    if(site.call != e || Is<SelStatement>(s))
+      site.use = U_ASSIGN;
+    else
+      site.use = Is<ReturnStatement>(s) ? U_RETURN : U_DISCARD;
+    return true;
+  }
+
+  // Substitutes the callee at the site if the cost model allows, saying
+  // why not in why otherwise. removed tells whether the statement went
+  // with the call.
+  bool Substitute(FuncDecl *caller, CallSite &site, int &growth, string &why,
+                  bool &removed){
+    FuncDecl *callee = site.call->fd;
+    char buf[128];
+    if(recursive.count(callee)){
+      why = "recursive";
+      return false;
+    }
+    vector<Identifier *> locals;
+    if(!FindLocals(callee->stmt_block, locals)){
+      why = "declares a local array";
+      return false;
+    }
+    int limit = INLINE_BUDGET + ARG_CREDIT * site.call->args->size();
+    int cost = Nodes(callee->stmt_block);
+    vector<Statement *> body;
+    if(cost <= limit){
+      BodyCopier copier;
+      body = *As<StatementBlock>(copier.Stmt(callee->stmt_block))->stmt_list;
+      if(site.use != U_RETURN && !EndPaths(body)){
+        why = "returns from inside a loop";
+        return false;
+      }
+      cost = 0;
+      for(int i = 0; i<body.size(); i++)
+        cost += Nodes(body[i]);
+    }
+    if(cost > limit){
+      sprintf(buf, "cost %d over %d", cost, limit);
+      why = buf;
+      return false;
+    }
+    if(growth + cost > CALLER_GROWTH){
+      sprintf(buf, "%s has grown by %d nodes already", caller->name.c_str(), growth);
+      why = buf;
+      return false;
+    }
+    growth += cost;
+    sprintf(buf, "cost %d of %d", cost, limit);
+    why = buf;
+
+    // Parameters and locals become fresh locals of the caller, the
+    // parameters bound last to first as the arguments are evaluated
+    BodyCopier copier;
+    vector<Statement *> stmts;
+    vector<Identifier *> *params = callee->param_list;
+    for(int i = params->size() - 1; i>=0; i--){
+      Identifier *p = (*params)[i];
+      copier.vars[p] = NewTemp(caller, p->elem_type, (callee->name + "." + p->name).c_str());
+      stmts.push_back(AssignTo(copier.vars[p], (*site.call->args)[i]));
+    }
+    for(int i = 0; i<locals.size(); i++){
+      Identifier *l = locals[i];
+      copier.vars[l] = NewTemp(caller, l->elem_type, (callee->name + "." + l->name).c_str());
+      stmts.push_back(AssignTo(copier.vars[l], new IntConst(LocOf(NULL), 0)));
+    }
+
+    // Where the value goes: straight into a scalar the statement does
+    // nothing but assign it to, otherwise into a temporary the statement
+    // then reads instead
+    Statement *s = site.stmt;
+    copier.rewrite_returns = true;
+    copier.use = site.use;
+    copier.caller = caller;
+    removed = site.use != U_ASSIGN;
+    if(site.use == U_ASSIGN){
+      ExprStatement *es = As<ExprStatement>(s);
+      OpExpression *assign = es ? As<OpExpression>(es->expr) : NULL;
+      Access *target = assign ? As<Access>(assign->lhs) : NULL;
+      if(assign && assign->op->op == ASSIGN && assign->rhs == site.call && !target->is_array){
+        copier.into = target->id;
+        removed = true;
+      }
+      else
+        copier.into = NewTemp(caller, callee->return_type, (callee->name + ".ret").c_str());
+    }
+    vector<Statement *> inlined;
+    for(int i = 0; i<body.size(); i++)
+      inlined.push_back(copier.Stmt(body[i]));
+    if(site.use == U_RETURN && (body.empty() || !AlwaysReturns(body.back()))){
+      ReturnStatement *r = new ReturnStatement(LocOf(s));
+      r->fd = caller;
+      inlined.push_back(r);
+    }
+    stmts.push_back(NewBlock(inlined));
+    InsertBefore(s, stmts);
+    if(removed)
+      RemoveStatement(s);
+    else
+      ReplaceExpr(site.call, UseOf(copier.into, LocOf(site.call)));
+    return true;
+  }
+
+  void InlineInto(FuncDecl *caller){
+    if(!done.insert(caller).second)
+      return;
+    // Callees first, so that what they inline is part of their cost
+    vector<FuncDecl *> &next = callees[caller];
+    for(vector<FuncDecl *>::iterator i = next.begin(); i != next.end(); ++i)
+      InlineInto(*i);
+
+    vector<Statement *> stmts;
+    Walk(caller->stmt_block, stmts);
+    int growth = 0;
+    for(int i = 0; i<stmts.size(); i++){
+      Statement *s = stmts[i];
+      set<Call *> decided;
+      // Once the first call is done the next one may come first
+      CallSite site;
+      bool removed = false;
+      while(!removed && SiteOf(s, site)){
+        string why;
+        bool inlined = Substitute(caller, site, growth, why, removed);
+        Report(caller, site.call, inlined, why);
+        decided.insert(site.call);
+        if(!inlined)
+          break;
+      }
+      if(removed)
+        continue;
+      vector<Call *> calls;
+      StatementCalls(s, calls);
+      for(int j = 0; j<calls.size(); j++){
+        if(decided.count(calls[j]))
+          continue;
+        if(Is<IterStatement>(s))
+          Report(caller, calls[j], false, "in a loop header");
+        else
+          Report(caller, calls[j], false, "evaluated after what it could interfere with");
+      }
+    }
+  }
+
+  static void Report(FuncDecl *caller, Call *c, bool inlined, const string &why){
+    if(options.inline_report)
+      fprintf(diag_out, "inline: %s, line %d: %s %s, %s\n", caller->name.c_str(),
+              LocOf(c).first_line, c->fd->name.c_str(),
+              inlined ? "inlined" : "not inlined", why.c_str());
+  }
+};
+
+void InlineCalls(const vector<FuncDecl *> &functions){
+  Inliner inliner;
+  for(int i = 0; i<functions.size(); i++)
+    inliner.FindCallees(functions[i]->stmt_block, inliner.callees[functions[i]]);
+  for(int i = 0; i<functions.size(); i++){
+    set<FuncDecl *> seen;
+    if(inliner.Reaches(functions[i], functions[i], seen))
+      inliner.recursive.insert(functions[i]);
+  }
+  for(int i = 0; i<functions.size(); i++)
+    inliner.InlineInto(functions[i]);
+}
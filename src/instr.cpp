@@ -0,0 +1,239 @@
+#include "instr.h"
+#include <string.h>
+
+using namespace std;
+
+const char *RegNames[] = {
+  "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+  "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+  "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+  "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"};
+
+const char *OpNames[] = {
+  "li", "la", "lw", "sw", "addiu", "add", "sub", "and", "or", "slt",
+  "xori", "sll", "mult", "div", "mflo", "mfhi", "move", "beq", "bne",
+  "blt", "bge", "j", "jal", "jr",
+  "syscall", "", ".data", ".text", ".align", ".globl", ".word"};
+
+InstrStream::InstrStream(){
+  parent = NULL;
+  label_base = 0;
+  num_generated = 0;
+}
+
+InstrStream::InstrStream(InstrStream *parent){
+  this->parent = parent;
+  label_base = parent->label_base + parent->label_names.size();
+  num_generated = 0;
+}
+
+int InstrStream::NewLabel(){
+  label_names.push_back("");
+  label_nums.push_back(num_generated++);
+  return label_base + label_names.size() - 1;
+}
+
+int InstrStream::NamedLabel(const string &name){
+  map<string, int>::iterator i;
+  for(InstrStream *s = parent; s; s = s->parent){
+    i = s->named_labels.find(name);
+    if(i != s->named_labels.end())
+      return i->second;
+  }
+  i = named_labels.find(name);
+  if(i != named_labels.end())
+    return i->second;
+  label_names.push_back(name);
+  label_nums.push_back(-1);
+  return named_labels[name] = label_base + label_names.size() - 1;
+}
+
+string InstrStream::LabelName(int label){
+  if(label < label_base)
+    return parent->LabelName(label);
+  label -= label_base;
+  if(label_nums[label] < 0)
+    return label_names[label];
+  char buf[32];
+  sprintf(buf, "_label%d", label_nums[label]);
+  return buf;
+}
+
+void InstrStream::Splice(InstrStream &piece){
+  vector<int> labels(piece.label_names.size());
+  for(int i = 0; i<labels.size(); i++){
+    labels[i] = piece.label_nums[i] < 0 ? NamedLabel(piece.label_names[i])
+      : NewLabel();
+  }
+  for(int n = 0; n<piece.instrs.size(); n++){
+    Instr i = piece.instrs[n];
+    if(i.label >= piece.label_base)
+      i.label = labels[i.label - piece.label_base];
+    instrs.push_back(i);
+  }
+}
+
+void InstrStream::Append(int op, int rd, int rs, int rt, int imm, int label){
+  Instr i;
+  i.op = op;
+  i.rd = rd;
+  i.rs = rs;
+  i.rt = rt;
+  i.imm = imm;
+  i.label = label;
+  instrs.push_back(i);
+}
+
+static void PutReg(string &buf, int reg){
+  buf += " $";
+  buf += RegNames[reg];
+}
+
+static void PutInt(string &buf, int val){
+  char tmp[16];
+  int n = 0;
+  unsigned int u = val < 0 ? -(unsigned int) val : val;
+  do{
+    tmp[n++] = '0' + u % 10;
+    u /= 10;
+  }while(u);
+  if(val < 0)
+    buf += '-';
+  while(n)
+    buf += tmp[--n];
+}
+
+void InstrStream::Write(FILE *out){
+  string buf;
+  vector<string> names(label_base + label_names.size());
+  for(int i = 0; i<names.size(); i++){
+    names[i] = LabelName(i);
+  }
+  buf.reserve(instrs.size() * 16);
+
+  for(int n = 0; n<instrs.size(); n++){
+    Instr &i = instrs[n];
+    switch(i.op){
+    case I_LABEL:
+      buf += names[i.label];
+      buf += ":\n";
+      continue;
+    case D_WORD:
+      buf += names[i.label];
+      buf += ": .word ";
+      for(int j = 0; j<i.imm-1; j++){
+        buf += "0, ";
+      }
+      buf += "0 \n";
+      continue;
+    case D_ALIGN:
+      buf += ".align 2\n";
+      continue;
+    }
+
+    buf += OpNames[i.op];
+    switch(i.op){
+    case I_LW:
+    case I_SW:
+      PutReg(buf, i.rd);
+      buf += ' ';
+      if(i.label != NO_LABEL){
+        buf += names[i.label];
+        if(i.imm > 0)
+          buf += '+';
+        if(i.imm != 0)
+          PutInt(buf, i.imm);
+      }
+      else{
+        PutInt(buf, i.imm);
+        buf += "($";
+        buf += RegNames[i.rs];
+        buf += ')';
+      }
+      break;
+    case I_LI:
+      PutReg(buf, i.rd);
+      buf += ' ';
+      PutInt(buf, i.imm);
+      break;
+    case I_ADDIU:
+    case I_XORI:
+    case I_SLL:
+      PutReg(buf, i.rd);
+      PutReg(buf, i.rs);
+      buf += ' ';
+      PutInt(buf, i.imm);
+      break;
+    default:
+      // Register operands in positional order, then the label if any
+      if(i.rd != R_NONE)
+        PutReg(buf, i.rd);
+      if(i.rs != R_NONE)
+        PutReg(buf, i.rs);
+      if(i.rt != R_NONE)
+        PutReg(buf, i.rt);
+      if(i.label != NO_LABEL){
+        buf += ' ';
+        buf += names[i.label];
+      }
+      break;
+    }
+    buf += '\n';
+  }
+
+  fwrite(buf.data(), 1, buf.size(), out);
+  fflush(out);
+}
+
+bool IsBarrier(const Instr &i){
+  switch(i.op){
+  case I_BEQ: case I_BNE: case I_BLT: case I_BGE: case I_J: case I_JAL: case I_JR: case I_SYSCALL: case I_LABEL:
+    return true;
+  }
+  return i.op >= D_DATA;
+}
+
+// Register written by the instruction (R_NONE for none); mult/div write
+// both halves of the product and report $lo through second_def
+int InstrDef(const Instr &i, int *second_def){
+  if(second_def)
+    *second_def = R_NONE;
+  switch(i.op){
+  case I_LI: case I_LA: case I_LW: case I_ADDIU: case I_ADD: case I_SUB:
+  case I_AND: case I_OR: case I_SLT: case I_XORI: case I_SLL: case I_MFLO:
+  case I_MFHI: case I_MOVE:
+    return i.rd;
+  case I_MULT: case I_DIV:
+    if(second_def)
+      *second_def = R_LO;
+    return R_HI;
+  case I_JAL:
+    return R_RA;
+  }
+  return R_NONE;
+}
+
+bool InstrUses(const Instr &i, int reg){
+  switch(i.op){
+  case I_LI: case I_LA: case I_J: case I_LABEL:
+    return false;
+  case I_LW:
+    return i.label == NO_LABEL && i.rs == reg;
+  case I_SW:
+    return i.rd == reg || (i.label == NO_LABEL && i.rs == reg);
+  case I_MFLO:
+    return reg == R_LO;
+  case I_MFHI:
+    return reg == R_HI;
+  case I_SYSCALL:
+    return reg == R_V0 || reg == R_A0;
+  }
+  if(i.op >= D_DATA)
+    return false;
+  return i.rs == reg || i.rt == reg;
+}
+
+bool InstrTouches(const Instr &i, int reg){
+  int second;
+  return InstrUses(i, reg) || InstrDef(i, &second) == reg || second == reg;
+}
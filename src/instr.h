@@ -0,0 +1,116 @@
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <map>
+
+using namespace std;
+
+// MIPS register numbers
+enum Reg {R_NONE = -1, R_ZERO = 0, R_V0 = 2, R_V1, R_A0 = 4, R_A1, R_A2, R_A3,
+          R_T0 = 8, R_T1, R_T2, R_T3, R_T4, R_T5, R_T6, R_T7,
+          R_S0 = 16, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7,
+          R_T8 = 24, R_T9, R_SP = 29, R_FP = 30, R_RA = 31, NUM_REGS = 32,
+          R_HI = NUM_REGS, R_LO, NUM_DATAFLOW_REGS};
+
+enum Opcode {
+  I_LI, I_LA, I_LW, I_SW, I_ADDIU, I_ADD, I_SUB, I_AND, I_OR, I_SLT,
+  I_XORI, I_SLL, I_MULT, I_DIV, I_MFLO, I_MFHI, I_MOVE, I_BEQ, I_BNE,
+  I_BLT, I_BGE, I_J, I_JAL, I_JR,
+  I_SYSCALL,
+  I_LABEL,                      // definition of label
+  D_DATA, D_TEXT, D_ALIGN, D_GLOBL,
+  D_WORD,                       // label: .word 0 repeated imm times
+  NUM_OPCODES
+};
+
+#define NO_LABEL -1
+
+// One instruction or directive. Operands are positional as in the
+// assembly text: for lw/sw rd is the data register and the address is
+// either imm(rs) or label+imm; branches compare rs and rt.
+struct Instr{
+  unsigned char op;
+  signed char rd, rs, rt;
+  int imm;
+  int label;
+};
+
+class InstrStream{
+public:
+  vector<Instr> instrs;
+
+  InstrStream();
+  // Stream for one piece of the program, made while parent is left
+  // alone: it can refer to parent's labels and makes new ones of its own
+  // until Splice() moves it onto the end of parent
+  InstrStream(InstrStream *parent);
+
+  int NewLabel();
+  int NumNewLabels() const {return num_generated;}
+  int NamedLabel(const string &name);
+  string LabelName(int label);
+
+  void Append(int op, int rd, int rs, int rt, int imm, int label);
+
+  void Li(int rd, int imm)              {Append(I_LI, rd, R_NONE, R_NONE, imm, NO_LABEL);}
+  void La(int rd, int label)            {Append(I_LA, rd, R_NONE, R_NONE, 0, label);}
+  void Lw(int rd, int imm, int rs)      {Append(I_LW, rd, rs, R_NONE, imm, NO_LABEL);}
+  void Lw(int rd, int label)            {LwLabel(rd, label, 0);}
+  void LwLabel(int rd, int label, int disp) {Append(I_LW, rd, R_NONE, R_NONE, disp, label);}
+  void Sw(int rd, int imm, int rs)      {Append(I_SW, rd, rs, R_NONE, imm, NO_LABEL);}
+  void Sw(int rd, int label)            {SwLabel(rd, label, 0);}
+  void SwLabel(int rd, int label, int disp) {Append(I_SW, rd, R_NONE, R_NONE, disp, label);}
+  void Addiu(int rd, int rs, int imm)   {Append(I_ADDIU, rd, rs, R_NONE, imm, NO_LABEL);}
+  void Xori(int rd, int rs, int imm)    {Append(I_XORI, rd, rs, R_NONE, imm, NO_LABEL);}
+  void Sll(int rd, int rs, int imm)     {Append(I_SLL, rd, rs, R_NONE, imm, NO_LABEL);}
+  void Arith(int op, int rd, int rs, int rt) {Append(op, rd, rs, rt, 0, NO_LABEL);}
+  void Mult(int rs, int rt)             {Append(I_MULT, R_NONE, rs, rt, 0, NO_LABEL);}
+  void Div(int rs, int rt)              {Append(I_DIV, R_NONE, rs, rt, 0, NO_LABEL);}
+  void Mflo(int rd)                     {Append(I_MFLO, rd, R_NONE, R_NONE, 0, NO_LABEL);}
+  void Mfhi(int rd)                     {Append(I_MFHI, rd, R_NONE, R_NONE, 0, NO_LABEL);}
+  void Move(int rd, int rs)             {Append(I_MOVE, rd, rs, R_NONE, 0, NO_LABEL);}
+  void Beq(int rs, int rt, int label)   {Append(I_BEQ, R_NONE, rs, rt, 0, label);}
+  void Bne(int rs, int rt, int label)   {Append(I_BNE, R_NONE, rs, rt, 0, label);}
+  void Blt(int rs, int rt, int label)   {Append(I_BLT, R_NONE, rs, rt, 0, label);}
+  void Bge(int rs, int rt, int label)   {Append(I_BGE, R_NONE, rs, rt, 0, label);}
+  void J(int label)                     {Append(I_J, R_NONE, R_NONE, R_NONE, 0, label);}
+  void Jal(int label)                   {Append(I_JAL, R_NONE, R_NONE, R_NONE, 0, label);}
+  void Jr(int rs)                       {Append(I_JR, R_NONE, rs, R_NONE, 0, NO_LABEL);}
+  void Syscall()                        {Append(I_SYSCALL, R_NONE, R_NONE, R_NONE, 0, NO_LABEL);}
+  void Label(int label)                 {Append(I_LABEL, R_NONE, R_NONE, R_NONE, 0, label);}
+  void Directive(int op, int label = NO_LABEL) {Append(op, R_NONE, R_NONE, R_NONE, 0, label);}
+  void Words(int label, int count)      {Append(D_WORD, R_NONE, R_NONE, R_NONE, count, label);}
+
+  // Formats the whole stream and hands it to the file in one write
+  void Write(FILE *out);
+
+  // Appends the instructions of a stream made with this one as parent.
+  // Its labels are numbered as if they had been made here, in the same
+  // order, so splicing pieces in program order gives the same text as
+  // emitting them here one after the other.
+  void Splice(InstrStream &piece);
+
+private:
+  InstrStream *parent;
+  int label_base;               // labels below it are parent's
+  vector<string> label_names;   // empty for labels from NewLabel()
+  vector<int> label_nums;
+  map<string, int> named_labels;
+  int num_generated;
+};
+
+extern const char *RegNames[];
+extern const char *OpNames[];
+
+// Data flow of a single instruction over registers, with $hi/$lo as the
+// pseudo registers R_HI/R_LO. Control transfers, labels, calls and
+// directives are barriers: nothing is known across them.
+bool IsBarrier(const Instr &);
+int InstrDef(const Instr &, int *second_def = NULL);
+bool InstrUses(const Instr &, int reg);
+bool InstrTouches(const Instr &, int reg);
+
+#endif
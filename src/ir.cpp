@@ -0,0 +1,162 @@
+#include "ir.h"
+#include "options.h"
+
+using namespace std;
+
+const char *IrOpNames[] = {
+  "const", "undef", "param", "copy",
+  "add", "sub", "mul", "div", "mod", "lt", "eq", "ne",
+  "neg", "not",
+  "load", "store", "call", "phi", "get", "set",
+  "jump", "branch", "ret",
+};
+
+IrInstr::IrInstr(int op, int dst){
+  this->op = op;
+  this->dst = dst;
+  this->imm = 0;
+  this->var = NULL;
+  this->callee = NULL;
+  this->target[0] = this->target[1] = NULL;
+}
+
+bool IrInstr::IsPure() const{
+  switch(op){
+  case IR_CONST: case IR_UNDEF: case IR_PARAM: case IR_COPY:
+  case IR_ADD: case IR_SUB: case IR_MUL:
+  case IR_LT: case IR_EQ: case IR_NE: case IR_NEG: case IR_NOT:
+  case IR_LOAD: case IR_PHI: case IR_GETVAR:
+    return true;
+  }
+  return false;
+}
+
+IrBlock::IrBlock(int id){
+  this->id = id;
+  this->rpo = -1;
+  this->idom = NULL;
+}
+
+int IrBlock::PredIndex(IrBlock *b) const{
+  for(int i = 0; i<preds.size(); i++){
+    if(preds[i] == b)
+      return i;
+  }
+  return -1;
+}
+
+IrFunction::IrFunction(FuncDecl *fd){
+  this->fd = fd;
+  this->num_values = 0;
+  this->num_block_ids = 0;
+}
+
+IrBlock *IrFunction::NewBlock(){
+  IrBlock *b = ast_arena->New<IrBlock>(num_block_ids++);
+  blocks.push_back(b);
+  return b;
+}
+
+IrInstr *IrFunction::NewInstr(int op, int dst){
+  return ast_arena->New<IrInstr>(op, dst);
+}
+
+IrFunction *BuildIr(FuncDecl *fd, bool remove_dead){
+  IrFunction *f = LowerFunction(fd);
+  BuildCfg(f);
+  ComputeDominators(f);
+  BuildSsa(f);
+  if(remove_dead)
+    RemoveDeadValues(f);
+  return f;
+}
+
+static void PrintAddress(IrInstr *in, int offset_arg, FILE *out){
+  fprintf(out, "%s", in->var->name.c_str());
+  if(offset_arg < in->args.size())
+    fprintf(out, "[v%d]", in->args[offset_arg]);
+  if(in->imm != 0)
+    fprintf(out, " %c %d", in->imm < 0 ? '-' : '+', in->imm < 0 ? -in->imm : in->imm);
+}
+
+static void PrintBlockList(const char *title, const vector<IrBlock *> &list, FILE *out){
+  if(list.empty())
+    return;
+  fprintf(out, " %s", title);
+  for(int i = 0; i<list.size(); i++)
+    fprintf(out, " b%d", list[i]->id);
+  fprintf(out, ";");
+}
+
+static void DumpInstr(IrBlock *b, IrInstr *in, FILE *out){
+  fprintf(out, "    ");
+  if(in->dst != NO_VALUE)
+    fprintf(out, "v%d = ", in->dst);
+  switch(in->op){
+  case IR_CONST:
+    fprintf(out, "%d", in->imm);
+    break;
+  case IR_PARAM:
+    fprintf(out, "param %d", in->imm);
+    break;
+  case IR_COPY:
+    fprintf(out, "v%d", in->args[0]);
+    break;
+  case IR_LOAD:
+    fprintf(out, "load ");
+    PrintAddress(in, 0, out);
+    break;
+  case IR_STORE:
+    fprintf(out, "store ");
+    PrintAddress(in, 1, out);
+    fprintf(out, ", v%d", in->args[0]);
+    break;
+  case IR_CALL:
+    fprintf(out, "%scall %s(", in->imm ? "tail " : "", in->callee->name.c_str());
+    for(int i = 0; i<in->args.size(); i++)
+      fprintf(out, "%sv%d", i ? ", " : "", in->args[i]);
+    fprintf(out, ")");
+    break;
+  case IR_GETVAR:
+    fprintf(out, "get %s", in->var->name.c_str());
+    break;
+  case IR_SETVAR:
+    fprintf(out, "set %s, v%d", in->var->name.c_str(), in->args[0]);
+    break;
+  case IR_PHI:
+    fprintf(out, "phi");
+    for(int i = 0; i<in->args.size(); i++)
+      fprintf(out, "%s [v%d, b%d]", i ? "," : "", in->args[i], b->preds[i]->id);
+    fprintf(out, "    ; %s", in->var->name.c_str());
+    break;
+  case IR_JUMP:
+    fprintf(out, "jump b%d", in->target[0]->id);
+    break;
+  case IR_BRANCH:
+    fprintf(out, "branch v%d, b%d, b%d", in->args[0], in->target[0]->id, in->target[1]->id);
+    break;
+  default:
+    fprintf(out, "%s", IrOpNames[in->op]);
+    for(int i = 0; i<in->args.size(); i++)
+      fprintf(out, "%s v%d", i ? "," : "", in->args[i]);
+    break;
+  }
+  fprintf(out, "\n");
+}
+
+void DumpIr(IrFunction *f, FILE *out){
+  fprintf(out, "function %s: %d blocks, %d values\n", f->fd->name.c_str(),
+          (int) f->blocks.size(), f->num_values);
+  for(int i = 0; i<f->blocks.size(); i++){
+    IrBlock *b = f->blocks[i];
+    fprintf(out, "  b%d:", b->id);
+    PrintBlockList("preds", b->preds, out);
+    if(b->idom)
+      fprintf(out, " idom b%d;", b->idom->id);
+    PrintBlockList("frontier", b->frontier, out);
+    fprintf(out, "\n");
+    for(int j = 0; j<b->instrs.size(); j++)
+      DumpInstr(b, b->instrs[j], out);
+  }
+  fprintf(out, "\n");
+}
@@ -0,0 +1,143 @@
+#ifndef IR_H
+#define IR_H
+
+#include "ast.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+// Three-address code over numbered values, grouped into basic blocks.
+// Lowering produces it with scalar locals still read and written through
+// GETVAR/SETVAR; BuildSsa() then turns every scalar local into SSA values
+// joined by phis, so each value has exactly one definition.
+
+#define NO_VALUE -1
+
+enum IrOp{
+  IR_CONST,     // dst = imm
+  IR_UNDEF,     // dst = whatever a local holds before it is assigned
+  IR_PARAM,     // dst = parameter number imm
+  IR_COPY,      // dst = args[0]
+  IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD, IR_LT, IR_EQ, IR_NE,
+  IR_NEG, IR_NOT,
+  IR_LOAD,      // dst = word at byte imm (+ args[0]) of var, a global or array
+  IR_STORE,     // word at byte imm (+ args[1]) of var = args[0]
+  IR_CALL,      // dst = callee(args...), imm 1 when the RET after it returns dst
+  IR_PHI,       // dst = args[i] when entered from block->preds[i]
+  IR_GETVAR,    // dst = var, before SSA construction only
+  IR_SETVAR,    // var = args[0], before SSA construction only
+  // Terminators, the last instruction of every block
+  IR_JUMP,      // to target[0]
+  IR_BRANCH,    // to target[0] if args[0] != 0, else to target[1]
+  IR_RET,       // return args[0], if any
+  NUM_IR_OPS
+};
+
+class IrBlock;
+
+class IrInstr{
+public:
+  int op;
+  int dst;
+  vector<int> args;
+  int imm;
+  Identifier *var;
+  FuncDecl *callee;
+  IrBlock *target[2];
+
+  IrInstr(int op, int dst = NO_VALUE);
+  bool IsTerminator() const {return op >= IR_JUMP;}
+  // Has no effect besides defining dst and cannot trap
+  bool IsPure() const;
+};
+
+class IrBlock{
+public:
+  int id;
+  vector<IrInstr *> instrs;     // phis first, the terminator last
+  vector<IrBlock *> preds;
+  vector<IrBlock *> succs;
+
+  // Filled in by ComputeDominators()
+  int rpo;                      // position in reverse postorder
+  IrBlock *idom;                // NULL for the entry block
+  vector<IrBlock *> dom_children;
+  vector<IrBlock *> frontier;
+
+  IrBlock(int id);
+  IrInstr *Terminator() {return instrs.empty() ? NULL : instrs.back();}
+  int PredIndex(IrBlock *) const;
+};
+
+class IrFunction{
+public:
+  FuncDecl *fd;
+  vector<IrBlock *> blocks;     // blocks[0] is the entry; reverse postorder after BuildCfg()
+  int num_values;
+  int num_block_ids;            // blocks ever made, ids are never reused
+
+  IrFunction(FuncDecl *fd);
+  IrBlock *NewBlock();
+  int NewValue() {return num_values++;}
+  IrInstr *NewInstr(int op, int dst = NO_VALUE);
+};
+
+// Lowers a checked function body to IR with scalar locals unrenamed
+IrFunction *LowerFunction(FuncDecl *);
+
+// Predecessor/successor edges from the terminators, blocks in reverse
+// postorder and unreachable ones dropped
+void BuildCfg(IrFunction *);
+// Dominator tree (Cooper, Harvey and Kennedy) and dominance frontiers
+void ComputeDominators(IrFunction *);
+// Semi-pruned SSA: phis for the locals live across blocks, then renaming
+// along the dominator tree
+void BuildSsa(IrFunction *);
+
+// Drops pure instructions whose value no side effect depends on,
+// among them the phis of variables that are dead where they join
+void RemoveDeadValues(IrFunction *);
+
+// Lowering, CFG and SSA construction (and dead value removal if asked)
+// in one step
+IrFunction *BuildIr(FuncDecl *, bool remove_dead);
+
+// Writes the function in a readable form, with CFG and dominator info
+void DumpIr(IrFunction *, FILE *);
+
+// Shared by the code generators
+
+// The instruction defining every value, NULL for none
+void FindDefinitions(IrFunction *, vector<IrInstr *> &def);
+// Leaves SSA: critical edges get blocks of their own and the phis
+// become parallel copies at the end of the predecessors. def grows with
+// the values the copies need.
+void EliminatePhis(IrFunction *, vector<IrInstr *> &def);
+
+// Is instrs[j] of the block a tail call, its value returned by the RET
+// right after it?
+bool IsTailCall(IrBlock *, int j);
+// Marks the comparisons right in front of the branch that is their only
+// use, which the branch can then make itself
+void FuseComparisons(IrFunction *, vector<bool> &fused);
+
+// Where a value is live over the block order, positions two apart per
+// instruction
+struct ValueInterval{
+  int value;
+  int start, end;
+  bool crosses_call;
+};
+
+// Intervals of the values that need a location, all but constants and
+// undefined ones
+void BuildIntervals(IrFunction *, const vector<IrInstr *> &def, vector<ValueInterval> &);
+
+// Generates MIPS for an SSA function: phis become copies on the incoming
+// edges, values get registers by linear scan over the block order
+void EmitIr(IrFunction *);
+
+extern const char *IrOpNames[];
+
+#endif
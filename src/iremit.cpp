@@ -0,0 +1,661 @@
+#include "ir.h"
+#include "mips.h"
+#include <algorithm>
+
+using namespace std;
+
+// Registers values may live in; $t1-$t3 stay free for operands that were
+// spilled or are constants
+static const int temp_regs[] = {R_T4, R_T5, R_T6, R_T7, R_T8, R_T9};
+static const int saved_regs[] = {R_S0, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7};
+
+static bool ByStart(const ValueInterval *a, const ValueInterval *b){
+  return a->start < b->start;
+}
+
+void FindDefinitions(IrFunction *f, vector<IrInstr *> &def){
+  def.assign(f->num_values, NULL);
+  for(int i = 0; i<f->blocks.size(); i++){
+    for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+      IrInstr *in = f->blocks[i]->instrs[j];
+      if(in->dst != NO_VALUE)
+        def[in->dst] = in;
+    }
+  }
+}
+
+// Constants and undefined values take no register; they are
+// materialised wherever they are used
+static bool Rematerialized(const vector<IrInstr *> &def, int v){
+  return def[v] && (def[v]->op == IR_CONST || def[v]->op == IR_UNDEF);
+}
+
+static IrInstr *Copy(IrFunction *f, int dst, int src){
+  IrInstr *in = f->NewInstr(IR_COPY, dst);
+  in->args.push_back(src);
+  return in;
+}
+
+// An edge from a block with several successors into a block with
+// several predecessors gets a block of its own to hold the phi copies
+static void SplitCriticalEdges(IrFunction *f){
+  int n = f->blocks.size();
+  for(int i = 0; i<n; i++){
+    IrBlock *b = f->blocks[i];
+    if(b->preds.size() < 2 || b->instrs[0]->op != IR_PHI)
+      continue;
+    for(int j = 0; j<b->preds.size(); j++){
+      IrBlock *p = b->preds[j];
+      if(p->succs.size() < 2)
+        continue;
+      IrBlock *mid = f->NewBlock();
+      IrInstr *jump = f->NewInstr(IR_JUMP);
+      jump->target[0] = b;
+      mid->instrs.push_back(jump);
+      mid->preds.push_back(p);
+      mid->succs.push_back(b);
+      IrInstr *t = p->Terminator();
+      for(int k = 0; k<2; k++){
+        if(t->target[k] == b)
+          t->target[k] = mid;
+      }
+      replace(p->succs.begin(), p->succs.end(), b, mid);
+      b->preds[j] = mid;
+    }
+  }
+}
+
+// The copies of one edge happen all at once: order them so no source
+// is overwritten before it is read, breaking cycles with a new value
+static void ParallelCopy(IrFunction *f, vector<IrInstr *> &def,
+                         vector<pair<int, int> > copies, vector<IrInstr *> &out){
+  for(int i = 0; i<copies.size(); ){
+    if(copies[i].first == copies[i].second || copies[i].second == NO_VALUE ||
+       (def[copies[i].second] && def[copies[i].second]->op == IR_UNDEF))
+      copies.erase(copies.begin() + i);
+    else
+      i++;
+  }
+  while(!copies.empty()){
+    bool progress = false;
+    for(int i = 0; i<copies.size(); i++){
+      bool read = false;
+      for(int k = 0; k<copies.size() && !read; k++)
+        read = k != i && copies[k].second == copies[i].first;
+      if(read)
+        continue;
+      out.push_back(Copy(f, copies[i].first, copies[i].second));
+      copies.erase(copies.begin() + i);
+      progress = true;
+      break;
+    }
+    if(progress)
+      continue;
+    int saved = copies[0].first;
+    int temp = f->NewValue();
+    def.push_back(NULL);
+    out.push_back(Copy(f, temp, saved));
+    for(int k = 0; k<copies.size(); k++){
+      if(copies[k].second == saved)
+        copies[k].second = temp;
+    }
+  }
+}
+
+void EliminatePhis(IrFunction *f, vector<IrInstr *> &def){
+  SplitCriticalEdges(f);
+  for(int i = 0; i<f->blocks.size(); i++){
+    IrBlock *b = f->blocks[i];
+    int num_phis = 0;
+    while(num_phis < b->instrs.size() && b->instrs[num_phis]->op == IR_PHI)
+      num_phis++;
+    if(num_phis == 0)
+      continue;
+    for(int j = 0; j<b->preds.size(); j++){
+      vector<pair<int, int> > copies;
+      for(int k = 0; k<num_phis; k++)
+        copies.push_back(make_pair(b->instrs[k]->dst, b->instrs[k]->args[j]));
+      vector<IrInstr *> seq;
+      ParallelCopy(f, def, copies, seq);
+      vector<IrInstr *> &pi = b->preds[j]->instrs;
+      pi.insert(pi.end() - 1, seq.begin(), seq.end());
+    }
+    b->instrs.erase(b->instrs.begin(), b->instrs.begin() + num_phis);
+  }
+  // Definitions now include the copies, which are never rematerialized
+  def.resize(f->num_values, NULL);
+}
+
+bool IsTailCall(IrBlock *b, int j){
+  vector<IrInstr *> &instrs = b->instrs;
+  IrInstr *in = instrs[j];
+  return in->op == IR_CALL && in->imm == 1 && j + 2 == instrs.size() &&
+    instrs[j + 1]->op == IR_RET && instrs[j + 1]->args.size() == 1 &&
+    instrs[j + 1]->args[0] == in->dst;
+}
+
+void FuseComparisons(IrFunction *f, vector<bool> &fused){
+  vector<int> uses(f->num_values, 0);
+  fused.assign(f->num_values, false);
+  for(int i = 0; i<f->blocks.size(); i++){
+    for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+      IrInstr *in = f->blocks[i]->instrs[j];
+      for(int k = 0; k<in->args.size(); k++)
+        uses[in->args[k]]++;
+    }
+  }
+  for(int i = 0; i<f->blocks.size(); i++){
+    vector<IrInstr *> &instrs = f->blocks[i]->instrs;
+    IrInstr *t = instrs.back();
+    if(t->op != IR_BRANCH || instrs.size() < 2)
+      continue;
+    IrInstr *c = instrs[instrs.size() - 2];
+    int v = t->args[0];
+    if(c->dst == v && uses[v] == 1 &&
+       (c->op == IR_LT || c->op == IR_EQ || c->op == IR_NE))
+      fused[v] = true;
+  }
+}
+
+static void Extend(vector<int> &start, vector<int> &end, int v, int pos){
+  if(start[v] < 0 || pos < start[v])
+    start[v] = pos;
+  if(pos > end[v])
+    end[v] = pos;
+}
+
+// Live ranges over the layout, one interval per value from its first
+// to its last live point. A use is at the instruction's position, a
+// definition right after it, so a result may take an operand's register.
+void BuildIntervals(IrFunction *f, const vector<IrInstr *> &def, vector<ValueInterval> &intervals){
+  int nb = f->blocks.size();
+  vector<int> index(f->num_block_ids);
+  vector<int> first(nb), last(nb);
+  vector<int> calls;
+  int pos = 0;
+  for(int i = 0; i<nb; i++){
+    index[f->blocks[i]->id] = i;
+    first[i] = pos;
+    for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+      if(f->blocks[i]->instrs[j]->op == IR_CALL)
+        calls.push_back(pos);
+      pos += 2;
+    }
+    last[i] = pos - 2;
+  }
+
+  int nv = f->num_values;
+  vector<vector<bool> > live_in(nb, vector<bool>(nv, false));
+  vector<vector<bool> > live_out(nb, vector<bool>(nv, false));
+  vector<vector<int> > uses(nb), defs(nb);
+  for(int i = 0; i<nb; i++){
+    vector<bool> defined(nv, false);
+    vector<IrInstr *> &instrs = f->blocks[i]->instrs;
+    for(int j = 0; j<instrs.size(); j++){
+      for(int k = 0; k<instrs[j]->args.size(); k++){
+        int v = instrs[j]->args[k];
+        if(!Rematerialized(def, v) && !defined[v]){
+          defined[v] = true;
+          uses[i].push_back(v);
+        }
+      }
+      int d = instrs[j]->dst;
+      if(d != NO_VALUE && !defined[d]){
+        defined[d] = true;
+        defs[i].push_back(d);
+      }
+    }
+  }
+
+  bool changed = true;
+  while(changed){
+    changed = false;
+    for(int i = nb - 1; i>=0; i--){
+      IrBlock *b = f->blocks[i];
+      vector<bool> out(nv, false);
+      for(int s = 0; s<b->succs.size(); s++){
+        vector<bool> &in = live_in[index[b->succs[s]->id]];
+        for(int v = 0; v<nv; v++)
+          if(in[v])
+            out[v] = true;
+      }
+      vector<bool> in = out;
+      for(int k = 0; k<defs[i].size(); k++)
+        in[defs[i][k]] = false;
+      for(int k = 0; k<uses[i].size(); k++)
+        in[uses[i][k]] = true;
+      if(in != live_in[i] || out != live_out[i]){
+        live_in[i] = in;
+        live_out[i] = out;
+        changed = true;
+      }
+    }
+  }
+
+  vector<int> start(nv, -1), end(nv, -1);
+  for(int i = 0; i<nb; i++){
+    for(int v = 0; v<nv; v++){
+      if(live_in[i][v])
+        Extend(start, end, v, first[i]);
+      if(live_out[i][v])
+        Extend(start, end, v, last[i] + 1);
+    }
+    int p = first[i];
+    vector<IrInstr *> &instrs = f->blocks[i]->instrs;
+    for(int j = 0; j<instrs.size(); j++, p += 2){
+      for(int k = 0; k<instrs[j]->args.size(); k++){
+        if(!Rematerialized(def, instrs[j]->args[k]))
+          Extend(start, end, instrs[j]->args[k], p);
+      }
+      if(instrs[j]->dst != NO_VALUE && !Rematerialized(def, instrs[j]->dst))
+        Extend(start, end, instrs[j]->dst, p + 1);
+    }
+  }
+
+  for(int v = 0; v<nv; v++){
+    if(start[v] < 0)
+      continue;
+    ValueInterval vi;
+    vi.value = v;
+    vi.start = start[v];
+    vi.end = end[v];
+    vi.crosses_call = false;
+    for(int c = 0; c<calls.size(); c++){
+      if(calls[c] > vi.start && calls[c] + 1 < vi.end)
+        vi.crosses_call = true;
+    }
+    intervals.push_back(vi);
+  }
+}
+
+class IrEmitter{
+public:
+  IrFunction *f;
+  vector<IrInstr *> def;        // defining instruction of constants and undefs
+  vector<int> reg;              // register of every value, -1 when spilled
+  vector<int> slot;             // frame offset of spilled values
+  vector<bool> fused;           // comparisons the branch after them makes
+  vector<int> label;            // label of each block id, -1 if never jumped to
+  int next_block;               // block id laid out after the current one
+
+  IrEmitter(IrFunction *f) {this->f = f;}
+
+  // Linear scan as in AllocateRegisters(); every value is worth a
+  // register, so only pressure sends one to the stack
+  void AllocateRegisters(){
+    vector<ValueInterval> intervals;
+    BuildIntervals(f, def, intervals);
+    vector<ValueInterval *> order;
+    for(int i = 0; i<intervals.size(); i++)
+      order.push_back(&intervals[i]);
+    sort(order.begin(), order.end(), ByStart);
+
+    reg.assign(f->num_values, -1);
+    bool in_use[NUM_REGS] = {false};
+    bool saved_used[NUM_REGS] = {false};
+    vector<ValueInterval *> active;
+    for(int n = 0; n<order.size(); n++){
+      ValueInterval *cur = order[n];
+      for(int i = 0; i<active.size(); ){
+        if(active[i]->end < cur->start){
+          in_use[reg[active[i]->value]] = false;
+          active.erase(active.begin() + i);
+        }
+        else
+          i++;
+      }
+      int r = -1;
+      if(!cur->crosses_call){
+        for(int i = 0; i<sizeof(temp_regs)/sizeof(int) && r < 0; i++)
+          if(!in_use[temp_regs[i]])
+            r = temp_regs[i];
+      }
+      for(int i = 0; i<sizeof(saved_regs)/sizeof(int) && r < 0; i++)
+        if(!in_use[saved_regs[i]])
+          r = saved_regs[i];
+      if(r < 0){
+        ValueInterval *victim = NULL;
+        for(int i = 0; i<active.size(); i++){
+          if(cur->crosses_call && reg[active[i]->value] < R_S0)
+            continue;
+          if(victim == NULL || active[i]->end > victim->end)
+            victim = active[i];
+        }
+        if(victim == NULL || victim->end <= cur->end)
+          continue;
+        r = reg[victim->value];
+        reg[victim->value] = -1;
+        active.erase(find(active.begin(), active.end(), victim));
+      }
+      reg[cur->value] = r;
+      in_use[r] = true;
+      if(r >= R_S0 && r <= R_S7)
+        saved_used[r] = true;
+      active.push_back(cur);
+    }
+
+    FuncDecl *fd = f->fd;
+    fd->saved_regs.clear();
+    if(fd->name != "main"){
+      for(int r = R_S0; r <= R_S7; r++)
+        if(saved_used[r])
+          fd->saved_regs.push_back(r);
+    }
+    // Arrays are laid out as for the AST emitter (scalars keep slots they
+    // no longer use); spilled values go below them
+    fd->CalcFrame();
+    // $ra as the IR has it, where only the calls that come back count
+    fd->saves_ra = false;
+    for(int i = 0; i<f->blocks.size(); i++){
+      for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+        if(f->blocks[i]->instrs[j]->op == IR_CALL && !IsTailCall(f->blocks[i], j))
+          fd->saves_ra = fd->name != "main";
+      }
+    }
+    slot.assign(f->num_values, 0);
+    for(int i = 0; i<intervals.size(); i++){
+      int v = intervals[i].value;
+      if(reg[v] >= 0)
+        continue;
+      slot[v] = OFFSET_FIRST_LOCAL - fd->frame_size;
+      fd->frame_size += VAR_SIZE;
+    }
+  }
+
+  // Register holding operand v, loading it into scratch if needed
+  int Use(int v, int scratch){
+    if(def[v] && def[v]->op == IR_UNDEF)
+      return R_ZERO;
+    if(def[v] && def[v]->op == IR_CONST){
+      if(def[v]->imm == 0)
+        return R_ZERO;
+      code->Li(scratch, def[v]->imm);
+      return scratch;
+    }
+    if(reg[v] >= 0)
+      return reg[v];
+    code->Lw(scratch, slot[v], R_FP);
+    return scratch;
+  }
+
+  // Register to compute v into; Def() stores it if v lives in memory
+  int Target(int v){
+    return reg[v] >= 0 ? reg[v] : R_T1;
+  }
+
+  void Def(int v, int r){
+    if(reg[v] < 0)
+      code->Sw(r, slot[v], R_FP);
+  }
+
+  bool ConstOperand(IrInstr *in, int k, int *val){
+    int v = in->args[k];
+    if(def[v] == NULL || def[v]->op != IR_CONST)
+      return false;
+    *val = def[v]->imm;
+    return true;
+  }
+
+  // Address of an element: returns the base register for the
+  // displacement *disp, computing base + offset into $t1 when needed
+  int Address(IrInstr *in, int offset_arg, int *disp){
+    Identifier *id = in->var;
+    *disp = in->imm + (id->is_global ? 0 : id->offset);
+    if(offset_arg >= in->args.size())
+      return id->is_global ? R_NONE : R_FP;
+    int o = Use(in->args[offset_arg], R_T1);
+    if(id->is_global){
+      code->La(R_T3, id->label);
+      code->Arith(I_ADD, R_T1, o, R_T3);
+    }
+    else
+      code->Arith(I_ADD, R_T1, o, R_FP);
+    return R_T1;
+  }
+
+  void Epilogue(){
+    FuncDecl *fd = f->fd;
+    if(fd->name == "main"){
+      code->Li(R_V0, 17);
+      code->Syscall();
+      return;
+    }
+    for(int i = 0; i<fd->saved_regs.size(); i++)
+      code->Lw(fd->saved_regs[i], OFFSET_FIRST_LOCAL - i * VAR_SIZE, R_FP);
+    if(fd->saves_ra)
+      code->Lw(R_RA, 0, R_FP);
+    code->Addiu(R_SP, R_FP, 4 + VAR_SIZE * fd->param_list->size());
+    code->Lw(R_FP, 0, R_SP);
+    code->Jr(R_RA);
+  }
+
+  // The arguments pushed as for a call, but the frame handed over
+  // instead of a new one pushed on top of it
+  void EmitTailCall(IrInstr *in){
+    for(int i = in->args.size() - 1; i>=0; i--){
+      int d = Use(in->args[i], R_T1);
+      code->Addiu(R_SP, R_SP, -4);
+      code->Sw(d, 4, R_SP);
+    }
+    EmitTailJump(f->fd, in->callee, R_FP, 0);
+  }
+
+  // Branches to target when v, a fused comparison or any other value
+  // tested against zero, comes out as when
+  void BranchOn(int v, bool when, int target){
+    if(!fused[v]){
+      int d = Use(v, R_T1);
+      when ? code->Bne(d, R_ZERO, target) : code->Beq(d, R_ZERO, target);
+      return;
+    }
+    int a = Use(def[v]->args[0], R_T1);
+    int b = Use(def[v]->args[1], R_T2);
+    switch(def[v]->op){
+    case IR_LT: when ? code->Blt(a, b, target) : code->Bge(a, b, target); break;
+    case IR_EQ: when ? code->Beq(a, b, target) : code->Bne(a, b, target); break;
+    default: when ? code->Bne(a, b, target) : code->Beq(a, b, target); break;
+    }
+  }
+
+  void EmitBinary(IrInstr *in){
+    if(fused[in->dst])
+      return;
+    int d = Target(in->dst);
+    int c;
+    if((in->op == IR_ADD || in->op == IR_SUB) && ConstOperand(in, 1, &c) &&
+       c > -32768 && c < 32768){
+      code->Addiu(d, Use(in->args[0], R_T1), in->op == IR_ADD ? c : -c);
+      Def(in->dst, d);
+      return;
+    }
+    if(in->op == IR_MUL && ConstOperand(in, 1, &c) && c > 0 && (c & (c - 1)) == 0){
+      int k = 0;
+      while((1 << k) != c)
+        k++;
+      code->Sll(d, Use(in->args[0], R_T1), k);
+      Def(in->dst, d);
+      return;
+    }
+    int a = Use(in->args[0], R_T1);
+    int b = Use(in->args[1], R_T2);
+    switch(in->op){
+    case IR_ADD: code->Arith(I_ADD, d, a, b); break;
+    case IR_SUB: code->Arith(I_SUB, d, a, b); break;
+    case IR_LT: code->Arith(I_SLT, d, a, b); break;
+    case IR_MUL:
+      code->Mult(a, b);
+      code->Mflo(d);
+      break;
+    case IR_DIV:
+      code->Div(a, b);
+      code->Mflo(d);
+      break;
+    case IR_MOD:
+      code->Div(a, b);
+      code->Mfhi(d);
+      break;
+    case IR_EQ:
+    case IR_NE:
+      code->Arith(I_SLT, R_T3, a, b);
+      code->Arith(I_SLT, R_T2, b, a);
+      code->Arith(I_OR, d, R_T2, R_T3);
+      if(in->op == IR_EQ)
+        code->Xori(d, d, 1);
+      break;
+    }
+    Def(in->dst, d);
+  }
+
+  void EmitInstr(IrInstr *in){
+    int d, disp, base;
+    switch(in->op){
+    case IR_CONST:
+    case IR_UNDEF:
+      break;
+    case IR_PARAM:
+      d = Target(in->dst);
+      code->Lw(d, (*f->fd->param_list)[in->imm]->offset, R_FP);
+      Def(in->dst, d);
+      break;
+    case IR_COPY:
+      if(reg[in->dst] >= 0 && def[in->args[0]] && def[in->args[0]]->op == IR_CONST){
+        code->Li(reg[in->dst], def[in->args[0]]->imm);
+        break;
+      }
+      d = Use(in->args[0], R_T1);
+      if(reg[in->dst] >= 0){
+        if(reg[in->dst] != d)
+          code->Move(reg[in->dst], d);
+      }
+      else
+        Def(in->dst, d);
+      break;
+    case IR_NEG:
+      d = Target(in->dst);
+      code->Arith(I_SUB, d, R_ZERO, Use(in->args[0], R_T1));
+      Def(in->dst, d);
+      break;
+    case IR_NOT:
+      d = Target(in->dst);
+      code->Xori(d, Use(in->args[0], R_T1), 1);
+      Def(in->dst, d);
+      break;
+    case IR_LOAD:
+      d = Target(in->dst);
+      base = Address(in, 0, &disp);
+      if(base == R_NONE)
+        code->LwLabel(d, in->var->label, disp);
+      else
+        code->Lw(d, disp, base);
+      Def(in->dst, d);
+      break;
+    case IR_STORE:
+      d = Use(in->args[0], R_T2);
+      base = Address(in, 1, &disp);
+      if(base == R_NONE)
+        code->SwLabel(d, in->var->label, disp);
+      else
+        code->Sw(d, disp, base);
+      break;
+    case IR_CALL:
+      code->Addiu(R_SP, R_SP, -4);
+      code->Sw(R_FP, 4, R_SP);
+      for(int i = in->args.size() - 1; i>=0; i--){
+        d = Use(in->args[i], R_T1);
+        code->Addiu(R_SP, R_SP, -4);
+        code->Sw(d, 4, R_SP);
+      }
+      code->Jal(in->callee->label);
+      if(reg[in->dst] >= 0)
+        code->Move(reg[in->dst], R_A0);
+      else
+        Def(in->dst, R_A0);
+      break;
+    case IR_JUMP:
+      if(in->target[0]->id != next_block)
+        code->J(label[in->target[0]->id]);
+      break;
+    case IR_BRANCH:
+      if(in->target[1]->id == next_block)
+        BranchOn(in->args[0], true, label[in->target[0]->id]);
+      else{
+        BranchOn(in->args[0], false, label[in->target[1]->id]);
+        if(in->target[0]->id != next_block)
+          code->J(label[in->target[0]->id]);
+      }
+      break;
+    case IR_RET:
+      if(!in->args.empty()){
+        d = Use(in->args[0], R_A0);
+        if(d != R_A0)
+          code->Move(R_A0, d);
+      }
+      Epilogue();
+      break;
+    default:
+      EmitBinary(in);
+      break;
+    }
+  }
+
+  // Labels only where control arrives other than by falling through, so
+  // the peephole pass sees long straight-line runs
+  void PlaceLabels(){
+    label.assign(f->num_block_ids, -1);
+    for(int i = 0; i<f->blocks.size(); i++){
+      IrInstr *t = f->blocks[i]->Terminator();
+      int next = i + 1 < f->blocks.size() ? f->blocks[i + 1]->id : -1;
+      vector<IrBlock *> targets;
+      if(t->op == IR_JUMP && t->target[0]->id != next)
+        targets.push_back(t->target[0]);
+      else if(t->op == IR_BRANCH){
+        if(t->target[1]->id != next || t->target[0]->id != next)
+          targets.push_back(t->target[t->target[1]->id == next ? 0 : 1]);
+        if(t->target[1]->id != next && t->target[0]->id != next)
+          targets.push_back(t->target[0]);
+      }
+      for(int k = 0; k<targets.size(); k++){
+        if(label[targets[k]->id] < 0)
+          label[targets[k]->id] = code->NewLabel();
+      }
+    }
+  }
+
+  void Emit(){
+    FindDefinitions(f, def);
+    EliminatePhis(f, def);
+    AllocateRegisters();
+    FuseComparisons(f, fused);
+    PlaceLabels();
+
+    FuncDecl *fd = f->fd;
+    code->Label(fd->label);
+    code->Move(R_FP, R_SP);
+    code->Addiu(R_SP, R_SP, -4);
+    if(fd->saves_ra)
+      code->Sw(R_RA, 4, R_SP);
+    if(fd->frame_size > 0)
+      code->Addiu(R_SP, R_SP, -fd->frame_size);
+    for(int i = 0; i<fd->saved_regs.size(); i++)
+      code->Sw(fd->saved_regs[i], OFFSET_FIRST_LOCAL - i * VAR_SIZE, R_FP);
+
+    for(int i = 0; i<f->blocks.size(); i++){
+      IrBlock *b = f->blocks[i];
+      next_block = i + 1 < f->blocks.size() ? f->blocks[i + 1]->id : -1;
+      if(label[b->id] >= 0)
+        code->Label(label[b->id]);
+      for(int j = 0; j<b->instrs.size(); j++){
+        if(IsTailCall(b, j)){
+          EmitTailCall(b->instrs[j]);
+          break;
+        }
+        EmitInstr(b->instrs[j]);
+      }
+    }
+  }
+};
+
+void EmitIr(IrFunction *f){
+  IrEmitter e(f);
+  e.Emit();
+}
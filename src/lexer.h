@@ -1,7 +1,27 @@
 #ifndef LEXER_H
 #define LEXER_H
 
-void InitScanner();
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+// Reentrant scanner of one input, handed to yyparse(). Scanners share
+// nothing, so files can be parsed at the same time on different threads.
+yyscan_t NewScanner(FILE *in);
+// Scanner of a copy of text[0..len)
+yyscan_t NewScanner(const char *text, size_t len);
+void DeleteScanner(yyscan_t scanner);
+
+// Lines of the input being compiled on this thread, as saved by its
+// scanner for the error messages; NewScanner() points it at its own
+extern thread_local vector<string> *source_lines;
 const char *GetLineNumbered(int num);
 
 #endif
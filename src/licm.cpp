@@ -0,0 +1,221 @@
+#include "opt.h"
+#include <set>
+#include <vector>
+
+using namespace std;
+
+class LoopHoister{
+public:
+  FuncDecl *fd;
+  set<Identifier *> temps;      // every temporary made so far, one def each
+
+  // State of the loop being processed
+  set<Identifier *> variant;
+  vector<Statement *> preheader;
+  vector<pair<Expression *, Identifier *> > available;
+
+  LoopHoister(FuncDecl *f) {fd = f;}
+
+  bool Invariant(Expression *e) {return InvariantIn(e, variant);}
+
+  // A read of a temporary assigned e in the preheader, shared between
+  // equal expressions of the loop
+  Access *TempFor(Expression *e){
+    YYLTYPE loc = LocOf(e);
+    for(int i = 0; i<available.size(); i++){
+      if(SameExpr(available[i].first, e))
+        return UseOf(available[i].second, loc);
+    }
+    Identifier *temp = NewTemp(fd, e->type, "licm");
+    temps.insert(temp);
+    preheader.push_back(AssignTo(temp, e));
+    available.push_back(make_pair(e, temp));
+    return UseOf(temp, loc);
+  }
+
+  // Invariant subscripts turn into one precomputed byte offset
+  void HoistSubscripts(Access *a){
+    Expression *offset = NULL;
+    for(int i = 0; i<a->access_list->size(); i++){
+      Expression *sub = (*a->access_list)[i];
+      if(Is<IntConst>(sub) || !Invariant(sub))
+        continue;
+      YYLTYPE loc = LocOf(sub);
+      Expression *term = new OpExpression(new Operator(loc, STAR), sub,
+                                          new IntConst(loc, a->id->strides[i]));
+      term->type = T_INT;
+      if(offset){
+        offset = new OpExpression(new Operator(loc, PLUS), offset, term);
+        offset->type = T_INT;
+      }
+      else
+        offset = term;
+      (*a->access_list)[i] = new IntConst(loc, 0);
+      (*a->access_list)[i]->parent = a;
+    }
+    if(offset == NULL)
+      return;
+    Expression *base = TempFor(offset);
+    if(a->base_offset){
+      YYLTYPE loc = LocOf(a);
+      base = new OpExpression(new Operator(loc, PLUS), a->base_offset, base);
+      base->type = T_INT;
+    }
+    a->base_offset = base;
+    base->parent = a;
+  }
+
+  void HoistExpr(Expression *&slot, Ast *parent){
+    Expression *e = slot;
+    if(e == NULL)
+      return;
+    if(Is<OpExpression>(e) && Invariant(e)){
+      slot = TempFor(e);
+      slot->parent = parent;
+      return;
+    }
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(!a->is_array)
+        return;
+      HoistSubscripts(a);
+      for(int i = 0; i<a->access_list->size(); i++)
+        HoistExpr((*a->access_list)[i], a);
+      HoistExpr(a->base_offset, a);
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        HoistExpr((*c->args)[i], c);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      // The destination of an assignment is an Access, so only its
+      // subscripts can change
+      HoistExpr(o->rhs, o);
+      HoistExpr(o->lhs, o);
+    }
+  }
+
+  void HoistStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      HoistExpr(es->expr, es);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      HoistExpr(sel->test, sel);
+      HoistStmt(sel->body_true);
+      HoistStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        HoistStmt(it->init);
+        HoistStmt(it->cond);
+      }
+      HoistExpr(it->expr, it);
+      HoistStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        HoistStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ReturnStatement *r = As<ReturnStatement>(s);
+      HoistExpr(r->expr, r);
+    }
+  }
+
+  // Definitions of temporaries left in the loop by its inner loops
+  void FindTempDefs(Statement *s, vector<ExprStatement *> &defs){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      if(es->expr && Is<OpExpression>(es->expr)){
+        OpExpression *o = As<OpExpression>(es->expr);
+        if(o->op->op == ASSIGN && temps.count(As<Access>(o->lhs)->id))
+          defs.push_back(es);
+      }
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      FindTempDefs(sel->body_true, defs);
+      FindTempDefs(sel->body_false, defs);
+    }
+    else if(Is<IterStatement>(s)){
+      FindTempDefs(As<IterStatement>(s)->body, defs);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        FindTempDefs((*sb->stmt_list)[i], defs);
+    }
+  }
+
+  void HoistLoop(IterStatement *it){
+    VariantInLoop(it, variant);
+    preheader.clear();
+    available.clear();
+
+    // Temporaries of inner loops that do not depend on this one move out
+    // as a whole, in order, since each may feed the next
+    vector<ExprStatement *> defs;
+    FindTempDefs(it->body, defs);
+    bool changed = true;
+    while(changed){
+      changed = false;
+      for(int i = 0; i<defs.size(); i++){
+        OpExpression *o = As<OpExpression>(defs[i]->expr);
+        if(defs[i]->parent == NULL || !Invariant(o->rhs))
+          continue;
+        RemoveStatement(defs[i]);
+        Identifier *temp = As<Access>(o->lhs)->id;
+        variant.erase(temp);
+        preheader.push_back(defs[i]);
+        available.push_back(make_pair(o->rhs, temp));
+        changed = true;
+      }
+    }
+
+    if(it->loop_type == FOR)
+      HoistStmt(it->cond);
+    HoistExpr(it->expr, it);
+    HoistStmt(it->body);
+
+    if(!preheader.empty())
+      InsertBefore(it, preheader);
+  }
+
+  // Inner loops first, so their preheaders can be hoisted further
+  void Walk(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      Walk(sel->body_true);
+      Walk(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      Walk(it->body);
+      HoistLoop(it);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      // Copy: preheaders get inserted into the list while walking it
+      vector<Statement *> list = *sb->stmt_list;
+      for(int i = 0; i<list.size(); i++)
+        Walk(list[i]);
+    }
+  }
+};
+
+void HoistLoopInvariants(FuncDecl *fd){
+  LoopHoister h(fd);
+  h.Walk(fd->stmt_block);
+}
@@ -11,7 +11,5 @@ typedef struct YYLTYPE
 } YYLTYPE;
 # define YYLTYPE_IS_DECLARED 1
 
-extern YYLTYPE yylloc;
-
 #endif
 #endif
\ No newline at end of file
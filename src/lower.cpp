@@ -0,0 +1,316 @@
+#include "ir.h"
+#include "opt.h"
+
+using namespace std;
+
+// Translates the statements of one function into blocks in the order
+// Emit() would produce their code: right operands before left ones but
+// for && and ||, call arguments last to first
+class Lowering{
+public:
+  IrFunction *f;
+  IrBlock *cur;
+  IrBlock *body;    // past the parameters, where self tail calls loop back
+
+  Lowering(FuncDecl *fd){
+    f = ast_arena->New<IrFunction>(fd);
+    cur = f->NewBlock();
+    body = NULL;
+  }
+
+  IrInstr *Append(int op, bool has_dst){
+    IrInstr *in = f->NewInstr(op, has_dst ? f->NewValue() : NO_VALUE);
+    cur->instrs.push_back(in);
+    return in;
+  }
+
+  int Const(int val){
+    IrInstr *in = Append(IR_CONST, true);
+    in->imm = val;
+    return in->dst;
+  }
+
+  int Unary(int op, int a){
+    IrInstr *in = Append(op, true);
+    in->args.push_back(a);
+    return in->dst;
+  }
+
+  int Binary(int op, int a, int b){
+    IrInstr *in = Append(op, true);
+    in->args.push_back(a);
+    in->args.push_back(b);
+    return in->dst;
+  }
+
+  void Jump(IrBlock *to){
+    Append(IR_JUMP, false)->target[0] = to;
+  }
+
+  void Branch(int cond, IrBlock *if_true, IrBlock *if_false){
+    IrInstr *in = Append(IR_BRANCH, false);
+    in->args.push_back(cond);
+    in->target[0] = if_true;
+    in->target[1] = if_false;
+  }
+
+  // Scalar locals and parameters become SSA values, everything else
+  // stays in memory
+  static bool IsVariable(Identifier *id){
+    return !id->is_array && !id->is_global;
+  }
+
+  // Byte offset of an array element as a value (NO_VALUE when it is
+  // constant) plus a constant displacement, as in Access::EmitIndex()
+  int Offset(Access *a, int *disp){
+    int offset = NO_VALUE;
+    *disp = 0;
+    for(int i = 0; i<a->access_list->size(); i++){
+      Expression *e = (*a->access_list)[i];
+      int stride = a->id->strides[i];
+      if(IntConst *c = As<IntConst>(e)){
+        *disp += c->val * stride;
+        continue;
+      }
+      int v = Value(e);
+      if(stride != 1)
+        v = Binary(IR_MUL, v, Const(stride));
+      offset = offset == NO_VALUE ? v : Binary(IR_ADD, offset, v);
+    }
+    if(a->base_offset){
+      int v = Value(a->base_offset);
+      offset = offset == NO_VALUE ? v : Binary(IR_ADD, offset, v);
+    }
+    return offset;
+  }
+
+  void SetVar(Identifier *var, int val){
+    IrInstr *in = Append(IR_SETVAR, false);
+    in->var = var;
+    in->args.push_back(val);
+  }
+
+  void Store(Access *a, int val){
+    if(IsVariable(a->id)){
+      SetVar(a->id, val);
+      return;
+    }
+    int disp = 0;
+    int offset = a->is_array ? Offset(a, &disp) : NO_VALUE;
+    IrInstr *in = Append(IR_STORE, false);
+    in->var = a->id;
+    in->imm = disp;
+    in->args.push_back(val);
+    if(offset != NO_VALUE)
+      in->args.push_back(offset);
+  }
+
+  vector<int> Args(Call *c){
+    vector<int> args(c->args->size());
+    for(int i = c->args->size() - 1; i>=0; i--)
+      args[i] = Value((*c->args)[i]);
+    return args;
+  }
+
+  IrInstr *LowerCall(Call *c){
+    vector<int> args = Args(c);
+    IrInstr *in = Append(IR_CALL, true);
+    in->callee = c->fd;
+    in->args = args;
+    return in;
+  }
+
+  int Value(Expression *e){
+    if(IntConst *c = As<IntConst>(e))
+      return Const(c->val);
+    if(BoolConst *c = As<BoolConst>(e))
+      return Const(c->val ? 1 : 0);
+
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(IsVariable(a->id)){
+        IrInstr *in = Append(IR_GETVAR, true);
+        in->var = a->id;
+        return in->dst;
+      }
+      int disp = 0;
+      int offset = a->is_array ? Offset(a, &disp) : NO_VALUE;
+      IrInstr *in = Append(IR_LOAD, true);
+      in->var = a->id;
+      in->imm = disp;
+      if(offset != NO_VALUE)
+        in->args.push_back(offset);
+      return in->dst;
+    }
+    if(Is<Call>(e))
+      return LowerCall(As<Call>(e))->dst;
+    if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      if(o->op->op == AND_OP || o->op->op == OR_OP){
+        // Both ways out of the condition set a local of its own
+        IrBlock *yes = f->NewBlock();
+        IrBlock *no = f->NewBlock();
+        IrBlock *join = f->NewBlock();
+        Identifier *var = new Identifier(LocOf(o), T_BOOL, "cond." + to_string(join->id));
+        Cond(o, yes, no);
+        cur = yes;
+        SetVar(var, Const(1));
+        Jump(join);
+        cur = no;
+        SetVar(var, Const(0));
+        Jump(join);
+        cur = join;
+        IrInstr *in = Append(IR_GETVAR, true);
+        in->var = var;
+        return in->dst;
+      }
+      int b = Value(o->rhs);
+      if(o->op->op == ASSIGN){
+        Store(As<Access>(o->lhs), b);
+        return b;
+      }
+      if(o->lhs == NULL){
+        switch(o->op->op){
+        case NOT: return Unary(IR_NOT, b);
+        case MINUS: return Unary(IR_NEG, b);
+        case INC_OP: return Binary(IR_ADD, b, Const(1));
+        case DEC_OP: return Binary(IR_SUB, b, Const(1));
+        }
+        return b;
+      }
+      int a = Value(o->lhs);
+      switch(o->op->op){
+      case PLUS: return Binary(IR_ADD, a, b);
+      case MINUS: return Binary(IR_SUB, a, b);
+      case STAR: return Binary(IR_MUL, a, b);
+      case DIVIDE: return Binary(IR_DIV, a, b);
+      case MODULUS: return Binary(IR_MOD, a, b);
+      case LT: return Binary(IR_LT, a, b);
+      case GT: return Binary(IR_LT, b, a);
+      case EQ_OP: return Binary(IR_EQ, a, b);
+      case NE_OP: return Binary(IR_NE, a, b);
+      }
+    }
+    // Strings and doubles never get past the checker
+    return Const(0);
+  }
+
+  // Ends the block with a branch on test. The right operand of && and ||
+  // gets a block of its own, entered only when the left one leaves the
+  // outcome open.
+  void Cond(Expression *test, IrBlock *if_true, IrBlock *if_false){
+    OpExpression *o = As<OpExpression>(test);
+    int op = o ? o->op->op : 0;
+    if(op == NOT){
+      Cond(o->rhs, if_false, if_true);
+      return;
+    }
+    if(op == AND_OP || op == OR_OP){
+      IrBlock *right = f->NewBlock();
+      if(op == AND_OP)
+        Cond(o->lhs, right, if_false);
+      else
+        Cond(o->lhs, if_true, right);
+      cur = right;
+      Cond(o->rhs, if_true, if_false);
+      return;
+    }
+    Branch(Value(test), if_true, if_false);
+  }
+
+  void Lower(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      if(es->expr)
+        Value(es->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      IrBlock *then = f->NewBlock();
+      IrBlock *join = f->NewBlock();
+      IrBlock *other = sel->body_false ? f->NewBlock() : join;
+      Cond(sel->test, then, other);
+      cur = then;
+      Lower(sel->body_true);
+      Jump(join);
+      if(sel->body_false){
+        cur = other;
+        Lower(sel->body_false);
+        Jump(join);
+      }
+      cur = join;
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR)
+        Lower(it->init);
+      IrBlock *head = f->NewBlock();
+      IrBlock *body = f->NewBlock();
+      IrBlock *exit = f->NewBlock();
+      Jump(head);
+      cur = head;
+      Expression *test = it->loop_type == FOR ? it->cond->expr : it->expr;
+      if(test)
+        Cond(test, body, exit);
+      else
+        Jump(body);
+      cur = body;
+      Lower(it->body);
+      if(it->loop_type == FOR && it->expr)
+        Value(it->expr);
+      Jump(head);
+      cur = exit;
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        Lower((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ReturnStatement *r = As<ReturnStatement>(s);
+      Call *call = r->tail_call ? As<Call>(r->expr) : NULL;
+      if(call && call->fd == f->fd){
+        // The parameters take the arguments and the body starts over
+        vector<int> args = Args(call);
+        for(int i = 0; i<args.size(); i++)
+          SetVar((*f->fd->param_list)[i], args[i]);
+        Jump(body);
+        cur = f->NewBlock();
+        return;
+      }
+      int v = NO_VALUE;
+      if(call){
+        IrInstr *c = LowerCall(call);
+        c->imm = 1;
+        v = c->dst;
+      }
+      else if(r->expr)
+        v = Value(r->expr);
+      IrInstr *in = Append(IR_RET, false);
+      if(v != NO_VALUE)
+        in->args.push_back(v);
+      // Whatever follows is unreachable and dropped with its block
+      cur = f->NewBlock();
+    }
+  }
+};
+
+IrFunction *LowerFunction(FuncDecl *fd){
+  Lowering l(fd);
+  for(int i = 0; i<fd->param_list->size(); i++){
+    IrInstr *p = l.Append(IR_PARAM, true);
+    p->imm = i;
+    l.SetVar((*fd->param_list)[i], p->dst);
+  }
+  if(fd->self_tail_calls){
+    l.body = l.f->NewBlock();
+    l.Jump(l.body);
+    l.cur = l.body;
+  }
+  l.Lower(fd->stmt_block);
+  // Falling off the end returns nothing
+  l.Append(IR_RET, false);
+  return l.f;
+}
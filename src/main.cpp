@@ -0,0 +1,14 @@
+#include "driver.h"
+#include "options.h"
+#include "parallel.h"
+#include <stdio.h>
+
+int main(int argc, char **argv){
+  if(!ParseOptions(argc, argv))
+    return 2;
+
+  if(!options.files.empty())
+    return CompileBatch(argv);
+  function_jobs = options.jobs;
+  return CompileFile(stdin, stdout);
+}
@@ -1,48 +1,195 @@
 #include "mips.h"
+#include "options.h"
+#include "regalloc.h"
+#include "ir.h"
+#include "errors.h"
+#include "report.h"
 #include <stdio.h>
 #include <map>
 #include <iostream>
-#include <sstream>
 
 using namespace std;
 
-static void PushRegToStack(char *reg){
-  printf("addiu $sp $sp -4\n");
-  printf("sw $%s 4($sp)\n", reg);
+thread_local InstrStream *code;
+thread_local FILE *asm_out = stdout;
+
+// Bytes from $sp up to where it pointed on entry to the function being
+// emitted, which is where $fp points when there is one. Pushes, pops and
+// calls keep it current, so the frame can be addressed off $sp.
+static thread_local int sp_offset;
+
+static void PushRegToStack(int reg){
+  code->Addiu(R_SP, R_SP, -4);
+  code->Sw(reg, 4, R_SP);
+  sp_offset += 4;
 }
 
 static void PopFromStack(){
-  printf("addiu $sp $sp 4\n");
+  code->Addiu(R_SP, R_SP, 4);
+  sp_offset -= 4;
 }
 
-static string GetLabel(){
-  static int num_label = 0;
-  ostringstream s;
-  s << "_label" << num_label++;
-  return s.str();
+// Base register and displacement of byte off of the frame, off being
+// relative to the entry $sp as the offsets of CalcFrame() are
+static int FrameReg(){
+  return options.omit_frame_pointer ? R_SP : R_FP;
 }
 
-map<int, string> opcodes;
-void InitCodeGenerator(){
-  opcodes[PLUS] = "add";
-  opcodes[MINUS] = "sub";
-  opcodes[AND_OP] = "and";
-  opcodes[OR_OP] = "or";
-  opcodes[LT] = "slt";
+static int FrameOffset(int off){
+  return options.omit_frame_pointer ? off + sp_offset : off;
 }
 
+// $ra, saved registers and locals: the word at the entry $sp is $ra's
+// slot, and below the locals $sp needs one free word. A function with
+// neither needs no frame at all.
+static int FrameBytes(FuncDecl *fd){
+  return fd->saves_ra || fd->frame_size > 0 ? fd->frame_size + 4 : 0;
+}
+
+static int GetLabel(){
+  return code->NewLabel();
+}
+
+const map<int, int> opcodes = {
+  {PLUS, I_ADD},
+  {MINUS, I_SUB},
+  {LT, I_SLT},
+};
+
 void EmitPreamble()
 {
-  printf(".align 2\n");
-  printf(".text\n");
-  printf(".globl main\n");
+  code->Directive(D_ALIGN);
+  code->Directive(D_TEXT);
+  code->Directive(D_GLOBL, code->NamedLabel("main"));
+}
+
+static void EmitWithBackend(FuncDecl *fd, bool dce){
+  if(options.ssa){
+    PhaseTimer timer(PH_EMIT);
+    EmitIr(BuildIr(fd, dce));
+    return;
+  }
+  if(options.regalloc){
+    PhaseTimer timer(PH_REGALLOC);
+    AllocateRegisters(fd);
+  }
+  {
+    PhaseTimer timer(PH_OFFSETS);
+    fd->CalcFrame();
+  }
+  PhaseTimer timer(PH_EMIT);
+  fd->Emit();
+}
+
+void GenerateFunction(FuncDecl *fd){
+  if(options.dump_ir)
+    DumpIr(BuildIr(fd, options.dce), diag_out);
+  EmitWithBackend(fd, options.dce);
+}
+
+int CountInstructions(FuncDecl *fd, bool dce){
+  InstrStream *real = code;
+  InstrStream scratch;
+  // Only the code that is kept counts towards the report
+  CompileStats *real_stats = stats;
+  code = &scratch;
+  stats = NULL;
+  EmitWithBackend(fd, dce);
+  code = real;
+  stats = real_stats;
+  int n = 0;
+  for(int i = 0; i<scratch.instrs.size(); i++){
+    if(scratch.instrs[i].op < I_LABEL)
+      n++;
+  }
+  return n;
+}
+
+// Ast::Emit() and Statement::CalcOffsets() reach the method of the
+// concrete class through its kind; constants with no code of their own
+// (strings, doubles) emit nothing
+class EmitDispatch : public AstVisitor<EmitDispatch>{
+public:
+  void VisitFuncDecl(FuncDecl *n) {n->Emit();}
+  void VisitExprStatement(ExprStatement *n) {n->Emit();}
+  void VisitSelStatement(SelStatement *n) {n->Emit();}
+  void VisitIterStatement(IterStatement *n) {n->Emit();}
+  void VisitStatementBlock(StatementBlock *n) {n->Emit();}
+  void VisitReturnStatement(ReturnStatement *n) {n->Emit();}
+  void VisitAccess(Access *n) {n->Emit();}
+  void VisitCall(Call *n) {n->Emit();}
+  void VisitOpExpression(OpExpression *n) {n->Emit();}
+  void VisitIntConst(IntConst *n) {n->Emit();}
+  void VisitBoolConst(BoolConst *n) {n->Emit();}
+};
+
+class OffsetDispatch : public AstVisitor<OffsetDispatch, int>{
+public:
+  int first_offset;
+
+  OffsetDispatch(int first) {first_offset = first;}
+  int VisitSelStatement(SelStatement *n) {return n->CalcOffsets(first_offset);}
+  int VisitIterStatement(IterStatement *n) {return n->CalcOffsets(first_offset);}
+  int VisitStatementBlock(StatementBlock *n) {return n->CalcOffsets(first_offset);}
+};
+
+void Ast::Emit(){
+  EmitDispatch().Visit(this);
+}
+
+int Statement::CalcOffsets(int first_offset){
+  return OffsetDispatch(first_offset).Visit(this);
 }
 
 void FuncDecl::Emit(){
-  printf("%s:\n", this->name.c_str());
-  printf("move $fp $sp\n");
-  PushRegToStack("ra");
+  code->Label(this->label);
+  if(!options.omit_frame_pointer)
+    code->Move(R_FP, R_SP);
+  sp_offset = FrameBytes(this);
+  if(sp_offset > 0)
+    code->Addiu(R_SP, R_SP, -sp_offset);
+  if(this->saves_ra)
+    code->Sw(R_RA, FrameOffset(0), FrameReg());
+  for(int i = 0; i<this->saved_regs.size(); i++){
+    code->Sw(saved_regs[i], FrameOffset(OFFSET_FIRST_LOCAL - i * VAR_SIZE), FrameReg());
+  }
+  // Parameters kept in registers are loaded once from the caller's pushes
+  for(int i = 0; i<this->param_list->size(); i++){
+    Identifier *param = (*param_list)[i];
+    if(param->reg >= 0)
+      code->Lw(param->reg, FrameOffset(param->offset), FrameReg());
+  }
+  if(this->self_tail_calls){
+    this->body_label = GetLabel();
+    code->Label(this->body_label);
+  }
+  this->exit_label = GetLabel();
   this->stmt_block->Emit();
+  // main() ends in an exit, its caller adds one for falling off the end
+  if(this->name != "main")
+    this->EmitEpilogue();
+}
+
+// The one way out of the function, which every return jumps to and the
+// end of the body falls into
+void FuncDecl::EmitEpilogue(){
+  code->Label(this->exit_label);
+  for(int i = 0; i<this->saved_regs.size(); i++){
+    code->Lw(saved_regs[i], FrameOffset(OFFSET_FIRST_LOCAL - i * VAR_SIZE), FrameReg());
+  }
+  if(this->saves_ra)
+    code->Lw(R_RA, FrameOffset(0), FrameReg());
+  // Off go the frame and the arguments, and with $fp the caller's $fp
+  int params = VAR_SIZE * this->param_list->size();
+  if(options.omit_frame_pointer){
+    if(sp_offset + params != 0)
+      code->Addiu(R_SP, R_SP, sp_offset + params);
+  }
+  else{
+    code->Addiu(R_SP, R_FP, 4 + params);
+    code->Lw(R_FP, 0, R_SP);
+  }
+  code->Jr(R_RA);
 }
 
 void FuncDecl::CalcOffsets(){
@@ -53,28 +200,115 @@ void FuncDecl::CalcOffsets(){
   }
 }
 
-void StatementBlock::CalcOffsets(){
-  int currentOffset = OFFSET_FIRST_LOCAL;
+// Is there a call that comes back to the function? All do but the one a
+// tail call jumps to.
+static bool CallsReturnHere(Expression *e){
+  if(e == NULL)
+    return false;
+  if(Is<Call>(e))
+    return true;
+  if(Access *a = As<Access>(e)){
+    if(a->is_array){
+      for(int i = 0; i<a->access_list->size(); i++){
+        if(CallsReturnHere((*a->access_list)[i]))
+          return true;
+      }
+    }
+    return CallsReturnHere(a->base_offset);
+  }
+  if(OpExpression *o = As<OpExpression>(e))
+    return CallsReturnHere(o->lhs) || CallsReturnHere(o->rhs);
+  return false;
+}
+
+static bool CallsReturnHere(Statement *s){
+  if(s == NULL)
+    return false;
+  if(ExprStatement *es = As<ExprStatement>(s))
+    return CallsReturnHere(es->expr);
+  if(SelStatement *sel = As<SelStatement>(s)){
+    return CallsReturnHere(sel->test) || CallsReturnHere(sel->body_true) ||
+      CallsReturnHere(sel->body_false);
+  }
+  if(IterStatement *it = As<IterStatement>(s)){
+    if(it->loop_type == FOR && (CallsReturnHere(it->init) || CallsReturnHere(it->cond)))
+      return true;
+    return CallsReturnHere(it->expr) || CallsReturnHere(it->body);
+  }
+  if(StatementBlock *sb = As<StatementBlock>(s)){
+    for(int i = 0; i<sb->stmt_list->size(); i++){
+      if(CallsReturnHere((*sb->stmt_list)[i]))
+        return true;
+    }
+    return false;
+  }
+  ReturnStatement *r = As<ReturnStatement>(s);
+  if(r->tail_call && Is<Call>(r->expr)){
+    Call *c = As<Call>(r->expr);
+    for(int i = 0; i<c->args->size(); i++){
+      if(CallsReturnHere((*c->args)[i]))
+        return true;
+    }
+    return false;
+  }
+  return CallsReturnHere(r->expr);
+}
+
+// Frame below the saved $ra: callee-saved registers first, then the
+// locals of every block. Nested blocks continue below their parent and
+// siblings share space, so the whole frame is allocated once on entry.
+// $ra only needs saving if a call comes back; main() never returns.
+void FuncDecl::CalcFrame(){
+  int saved = VAR_SIZE * this->saved_regs.size();
+  this->frame_size = saved + this->stmt_block->CalcOffsets(OFFSET_FIRST_LOCAL - saved);
+  this->saves_ra = this->name != "main" && CallsReturnHere(this->stmt_block);
+}
+
+int SelStatement::CalcOffsets(int first_offset){
+  int fs = this->body_true->CalcOffsets(first_offset);
+  if(this->body_false){
+    int fs_false = this->body_false->CalcOffsets(first_offset);
+    if(fs_false > fs)
+      fs = fs_false;
+  }
+  return fs;
+}
+
+int IterStatement::CalcOffsets(int first_offset){
+  return this->body->CalcOffsets(first_offset);
+}
+
+int StatementBlock::CalcOffsets(int first_offset){
+  int currentOffset = first_offset;
   int fs = 0;
   for (map<string, Identifier *>::iterator i = this->symbol_table->begin();
        i != symbol_table->end(); ++i)
   {
-    (i->second)->offset = currentOffset;
+    if(i->second->reg >= 0)
+      continue;
     int pdt = 1;
     if(i->second->is_array){
       for(int j = 0; j<i->second->dim_list->size(); j++){
         pdt *= (*(i->second->dim_list))[j]->val;
       }
     }
+    // Elements are addressed upwards from the lowest word of the array
+    (i->second)->offset = currentOffset - (pdt - 1)*VAR_SIZE;
     currentOffset -= pdt*VAR_SIZE;
     fs += pdt*VAR_SIZE;
   }
-  this->frame_size = fs;
+
+  int nested = 0;
+  for(int i = 0; i<this->stmt_list->size(); i++){
+    int n = (*stmt_list)[i]->CalcOffsets(currentOffset);
+    if(n > nested)
+      nested = n;
+  }
+  this->frame_size = fs + nested;
+  return this->frame_size;
 }
 
 void StatementBlock::Emit(){
-  if(frame_size > 0)
-    printf("addiu $sp $sp -%d\n", this->frame_size); // Acutally Subtraction
   for(int i = 0; i<this->stmt_list->size(); i++){
     (*stmt_list)[i]->Emit();
   }
@@ -85,105 +319,165 @@ void ExprStatement::Emit(){
     this->expr->Emit();
 }
 
+// Jumps to label when test comes out as when, without making a boolean
+// of it: && and || leave their right operand alone once the left one
+// decides, and comparisons branch on the two operands themselves
+static void JumpOn(Expression *test, bool when, int label){
+  if(BoolConst *b = As<BoolConst>(test)){
+    if(b->val == when)
+      code->J(label);
+    return;
+  }
+  OpExpression *o = As<OpExpression>(test);
+  int op = o ? o->op->op : 0;
+  if(op == NOT){
+    JumpOn(o->rhs, !when, label);
+    return;
+  }
+  if(op == AND_OP || op == OR_OP){
+    // Both operands must agree for a && b to be true or a || b false
+    if(when == (op == AND_OP)){
+      int decided = GetLabel();
+      JumpOn(o->lhs, !when, decided);
+      JumpOn(o->rhs, when, label);
+      code->Label(decided);
+    }
+    else{
+      JumpOn(o->lhs, when, label);
+      JumpOn(o->rhs, when, label);
+    }
+    return;
+  }
+  if(op == LT || op == GT || op == EQ_OP || op == NE_OP){
+    o->rhs->Emit();
+    PushRegToStack(R_A0);
+    o->lhs->Emit();
+    code->Lw(R_T1, 4, R_SP);
+    PopFromStack();
+    switch(op){
+    case LT:
+      when ? code->Blt(R_A0, R_T1, label) : code->Bge(R_A0, R_T1, label);
+      break;
+    case GT:
+      when ? code->Blt(R_T1, R_A0, label) : code->Bge(R_T1, R_A0, label);
+      break;
+    case EQ_OP:
+      when ? code->Beq(R_A0, R_T1, label) : code->Bne(R_A0, R_T1, label);
+      break;
+    case NE_OP:
+      when ? code->Bne(R_A0, R_T1, label) : code->Beq(R_A0, R_T1, label);
+      break;
+    }
+    return;
+  }
+  test->Emit();
+  when ? code->Bne(R_A0, R_ZERO, label) : code->Beq(R_A0, R_ZERO, label);
+}
+
 void SelStatement::Emit(){
-  string cond_false = GetLabel();
-  this->test->Emit();
-  printf("beq $a0 $zero %s\n", cond_false.c_str());
+  int cond_false = GetLabel();
+  JumpOn(this->test, false, cond_false);
   this->body_true->Emit();
 
   if(this->body_false){
-    string outside = GetLabel();
-    printf("j %s\n", outside.c_str());
-    printf("%s:\n", cond_false.c_str());
+    int outside = GetLabel();
+    code->J(outside);
+    code->Label(cond_false);
     this->body_false->Emit();
-    printf("%s:\n", outside.c_str());
+    code->Label(outside);
   }
   else{
-    printf("%s:\n", cond_false.c_str());
+    code->Label(cond_false);
   }
 }
 
+// Tested once on the way in and again at the bottom, where the branch
+// taken goes round: an iteration runs a single conditional branch
 void IterStatement::Emit(){
-  string loop_start = GetLabel();
-  string cond_false = GetLabel();
+  int loop_start = GetLabel();
+  int cond_false = GetLabel();
+  Expression *test = loop_type == FOR ? this->cond->expr : this->expr;
 
-  if(loop_type == WHILE){
-    printf("%s:\n", loop_start.c_str());
-    this->expr->Emit();
-    printf("beq $a0 $zero %s\n", cond_false.c_str());
-    this->body->Emit();
-    printf("j %s\n", loop_start.c_str());
-    printf("%s:\n", cond_false.c_str());
-  }
-  else{ // (loop_type == FOR)
+  if(loop_type == FOR)
     this->init->Emit();
-    printf("%s:\n", loop_start.c_str());
-    this->cond->Emit();
-    printf("beq $a0 $zero %s\n", cond_false.c_str());
-    this->body->Emit();
+  if(test)
+    JumpOn(test, false, cond_false);
+  code->Label(loop_start);
+  this->body->Emit();
+  if(loop_type == FOR)
     this->expr->Emit();
-    printf("j %s\n", loop_start.c_str());
-    printf("%s:\n", cond_false.c_str());
-  }
+  if(test)
+    JumpOn(test, true, loop_start);
+  else
+    code->J(loop_start);
+  code->Label(cond_false);
 }
 
-void LogicalNot(char *s){
-  printf("xori $%s $%s 1\n", s, s);
+void LogicalNot(int reg){
+  code->Xori(reg, reg, 1);
 }
 
 void OpExpression::Emit(){
+  if(op->op == AND_OP || op->op == OR_OP){
+    int is_false = GetLabel();
+    int done = GetLabel();
+    JumpOn(this, false, is_false);
+    code->Li(R_A0, 1);
+    code->J(done);
+    code->Label(is_false);
+    code->Li(R_A0, 0);
+    code->Label(done);
+    return;
+  }
   Access *a;
   rhs->Emit();
   if(op->op == ASSIGN){
-    a = dynamic_cast<Access *>(lhs);
+    a = As<Access>(lhs);
     a->EmitLval();
     return;
   }
   if(lhs != NULL){
-    PushRegToStack("a0");
+    PushRegToStack(R_A0);
     lhs->Emit();
     switch(op->op){
     case GT:
-      printf("lw $t1 4($sp)\n");
-      printf("slt $a0 $a0 $t1\n");
-      LogicalNot("a0");
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(I_SLT, R_A0, R_T1, R_A0);
       break;
     case EQ_OP:
-      printf("lw $t1 4($sp)\n");
-      printf("slt $t2 $a0 $t1\n");
-      printf("slt $t3 $t1 $a0\n");
-      printf("or $a0 $t2 $t3\n");
-      LogicalNot("a0");
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(I_SLT, R_T2, R_A0, R_T1);
+      code->Arith(I_SLT, R_T3, R_T1, R_A0);
+      code->Arith(I_OR, R_A0, R_T2, R_T3);
+      LogicalNot(R_A0);
       break;
     case NE_OP:
-      printf("lw $t1 4($sp)\n");
-      printf("slt $t1 $a0 $t1\n");
-      printf("slt $t2 $t1 $a0\n");
-      printf("or $a0 $t1 $t2\n");
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(I_SLT, R_T2, R_A0, R_T1);
+      code->Arith(I_SLT, R_T3, R_T1, R_A0);
+      code->Arith(I_OR, R_A0, R_T2, R_T3);
       break;
     case STAR:
-      printf("lw $t1 4($sp)\n");
-      printf("mult $a0 $t1\n");
-      printf("mflo $a0\n");
+      code->Lw(R_T1, 4, R_SP);
+      code->Mult(R_A0, R_T1);
+      code->Mflo(R_A0);
       break;
     case DIVIDE:
-      printf("lw $t1 4($sp)\n");
-      printf("div $a0 $t1\n");
-      printf("mflo $a0\n");
+      code->Lw(R_T1, 4, R_SP);
+      code->Div(R_A0, R_T1);
+      code->Mflo(R_A0);
       break;
     case MODULUS:
-      printf("lw $t1 4($sp)\n");
-      printf("div $a0 $t1\n");
-      printf("mfhi $a0\n");
+      code->Lw(R_T1, 4, R_SP);
+      code->Div(R_A0, R_T1);
+      code->Mfhi(R_A0);
       break;
-    //PLUS MINUS AND_OP OR_OP LT
+    //PLUS MINUS LT
     case PLUS:
     case MINUS:
-    case AND_OP:
-    case OR_OP:
     case LT:
-      printf("lw $t1 4($sp)\n");
-      printf("%s $a0 $a0 $t1\n", opcodes[op->op].c_str());
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(opcodes.at(op->op), R_A0, R_A0, R_T1);
       break;
     default:
       Formatted(NULL, "CodeGen: Op %d not found", op->op);
@@ -195,17 +489,17 @@ void OpExpression::Emit(){
 
     switch(op->op){
     case NOT:
-      LogicalNot("a0");
+      LogicalNot(R_A0);
       return;
     case PLUS:
       return;
     case MINUS:
-      printf("sub $a0 $zero $a0\n"); return;
+      code->Arith(I_SUB, R_A0, R_ZERO, R_A0); return;
     case INC_OP:
-      printf("addiu $a0 $a0 1\n");
+      code->Addiu(R_A0, R_A0, 1);
       return;
     case DEC_OP:
-      printf("addiu $a0 $a0 -1\n"); return;
+      code->Addiu(R_A0, R_A0, -1); return;
     default:
       Formatted(NULL, "CodeGen: Op %d not found", op->op); return;
     }
@@ -213,135 +507,221 @@ void OpExpression::Emit(){
 }
 
 void IntConst::Emit(){
-  printf("li $a0 %d\n", this->val);
+  code->Li(R_A0, this->val);
 }
 
-void Access::Emit(){
-  if(this->is_array){
-    for(int i = 0; i<this->access_list->size(); i++){
-      (*access_list)[i]->Emit();
-      if(i != this->access_list->size() - 1){
-        printf("li $t1 %d\n", (*this->id->dim_list)[i]->val);
-        printf("mult $a0 $t1\n");
-        printf("mflo $a0\n");
-      }
-      if(i != 0){
-        printf("lw $t1 4($sp)\n");
-        printf("add $a0 $a0 $t1\n");
-      }
-      if(i != this->access_list->size() - 1)
-        PushRegToStack("a0");
+void BoolConst::Emit(){
+  code->Li(R_A0, this->val ? 1 : 0);
+}
+
+// Multiplies $a0 by a compile-time constant, as a shift when it is a
+// power of two
+static void ScaleA0(int factor){
+  int k = 0;
+  while(k < 31 && (1 << k) < factor)
+    k++;
+  if((1 << k) == factor){
+    if(k != 0)
+      code->Sll(R_A0, R_A0, k);
+    return;
+  }
+  code->Li(R_T1, factor);
+  code->Mult(R_A0, R_T1);
+  code->Mflo(R_A0);
+}
+
+// Byte offset of the element from the start of the array. Constant
+// subscripts are summed into *disp; the remaining ones are scaled by
+// their stride and added up in $a0 together with base_offset. Returns
+// false when everything was constant and $a0 was left alone.
+bool Access::EmitIndex(int *disp){
+  bool in_reg = false;
+  *disp = 0;
+  for(int i = 0; i<this->access_list->size(); i++){
+    Expression *e = (*access_list)[i];
+    int stride = this->id->strides[i];
+    if(IntConst *c = As<IntConst>(e)){
+      *disp += c->val * stride;
+      continue;
     }
-    printf("addiu $sp $sp %lu\n", (this->access_list->size() - 1) * VAR_SIZE);
-    printf("move $t1 $a0\n");
-    printf("li $a0 4\n");
-    printf("mult $t1 $a0\n");
-    printf("mflo $t1\n");
-    // $t1 has the array offset and stack is unchanged
-  }
-  
-  if(this->id->is_global){
-    if(this->is_array){
-      printf("la $a0 %s\n", this->id->label.c_str());
-      printf("add $a0 $a0 $t1\n");
-      printf("lw $a0 0($a0)\n");
+    if(in_reg)
+      PushRegToStack(R_A0);
+    e->Emit();
+    ScaleA0(stride);
+    if(in_reg){
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(I_ADD, R_A0, R_A0, R_T1);
+      PopFromStack();
     }
-    else
-      printf("lw $a0 %s\n", this->id->label.c_str());
+    in_reg = true;
   }
-  else{
-    if(this->is_array){
-      printf("li $a0 %d\n", this->id->offset);
-      printf("add $a0 $a0 $t1\n");
-      printf("add $a0 $a0 $fp\n");
-      printf("lw $a0 0($a0)\n");
+  if(this->base_offset){
+    if(in_reg)
+      PushRegToStack(R_A0);
+    this->base_offset->Emit();
+    if(in_reg){
+      code->Lw(R_T1, 4, R_SP);
+      code->Arith(I_ADD, R_A0, R_A0, R_T1);
+      PopFromStack();
     }
+    in_reg = true;
+  }
+  return in_reg;
+}
+
+void Access::Emit(){
+  if(!this->is_array){
+    if(this->id->is_global)
+      code->Lw(R_A0, this->id->label);
+    else if(this->id->reg >= 0)
+      code->Move(R_A0, this->id->reg);
     else
-      printf("lw $a0 %d($fp)\n", this->id->offset);
+      code->Lw(R_A0, FrameOffset(this->id->offset), FrameReg());
+    return;
+  }
+
+  int disp;
+  if(!this->EmitIndex(&disp)){
+    if(this->id->is_global)
+      code->LwLabel(R_A0, this->id->label, disp);
+    else
+      code->Lw(R_A0, FrameOffset(this->id->offset + disp), FrameReg());
+    return;
+  }
+  if(this->id->is_global){
+    code->La(R_T1, this->id->label);
+    code->Arith(I_ADD, R_A0, R_A0, R_T1);
+    code->Lw(R_A0, disp, R_A0);
+  }
+  else{
+    code->Arith(I_ADD, R_A0, R_A0, FrameReg());
+    code->Lw(R_A0, FrameOffset(this->id->offset + disp), R_A0);
   }
 }
 
+// Stores $a0, which also stays the value of the assignment
 void Access::EmitLval(){
-  if(this->is_array){
-    PushRegToStack("a0");
-    for(int i = 0; i<this->access_list->size(); i++){
-      (*access_list)[i]->Emit();
-      if(i != this->access_list->size() - 1){
-        printf("li $t1 %d\n", (*this->id->dim_list)[i]->val);
-        printf("mult $a0 $t1\n");
-        printf("mflo $a0\n");
-      }
-      if(i != 0){
-        printf("lw $t1 4($sp)\n");
-        printf("add $a0 $a0 $t1\n");
-      }
-      if(i != this->access_list->size() - 1)
-        PushRegToStack("a0");
-    }
-    printf("addiu $sp $sp %lu\n", (this->access_list->size() - 1) * VAR_SIZE);
-    printf("move $t1 $a0\n");
-    printf("li $a0 4\n");
-    printf("mult $t1 $a0\n");
-    printf("mflo $t1\n");
-    // $t1 has the array offset and stack is unchanged
-  }
-  
-  if(this->id->is_global){
-    if(this->is_array){
-      printf("la $a0 %s\n", this->id->label.c_str());
-      printf("add $a0 $a0 $t1\n");
-      printf("lw $t2 4($sp)\n");
-      printf("sw $t2 0($a0)\n");
-      printf("lw $a0 4($sp)\n"); //Return value of assignment is $a0
-      PopFromStack();
-    }
+  if(!this->is_array){
+    if(this->id->is_global)
+      code->Sw(R_A0, this->id->label);
+    else if(this->id->reg >= 0)
+      code->Move(this->id->reg, R_A0);
     else
-      printf("sw $a0 %s\n", this->id->label.c_str());
+      code->Sw(R_A0, FrameOffset(this->id->offset), FrameReg());
+    return;
   }
-  else{
-    if(this->is_array){
-      printf("li $a0 %d\n", this->id->offset);
-      printf("add $a0 $a0 $t1\n");
-      printf("add $a0 $a0 $fp\n");
-      printf("lw $t2 4($sp)\n");
-      printf("sw $t2 0($a0)\n");
-      printf("lw $a0 4($sp)\n"); //Return value of assignment is $a0
-      PopFromStack();
-    }
+
+  bool constant = this->base_offset == NULL;
+  for(int i = 0; i<this->access_list->size(); i++){
+    if(As<IntConst>((*access_list)[i]) == NULL)
+      constant = false;
+  }
+  int disp;
+  if(constant){
+    this->EmitIndex(&disp);
+    if(this->id->is_global)
+      code->SwLabel(R_A0, this->id->label, disp);
     else
-      printf("sw $a0 %d($fp)\n", this->id->offset);
+      code->Sw(R_A0, FrameOffset(this->id->offset + disp), FrameReg());
+    return;
   }
-/*      
-        if(a->id->is_global){
-        printf("sw $a0 %s\n", a->id->label.c_str());
-        }
-        else
-        printf("sw $a0 %d($fp)\n", a->id->offset);
-*/
+  PushRegToStack(R_A0);
+  this->EmitIndex(&disp);
+  code->Lw(R_T2, 4, R_SP);
+  if(this->id->is_global){
+    code->La(R_T1, this->id->label);
+    code->Arith(I_ADD, R_A0, R_A0, R_T1);
+  }
+  else
+    code->Arith(I_ADD, R_A0, R_A0, FrameReg());
+  code->Sw(R_T2, (this->id->is_global ? disp : FrameOffset(this->id->offset + disp)), R_A0);
+  code->Move(R_A0, R_T2);
+  PopFromStack();
 }
 
+// The callee pops the arguments, and the $fp pushed for it to restore
+// when there is one
 void Call::Emit(){
-  PushRegToStack("fp");
+  int pushed = sp_offset;
+  if(!options.omit_frame_pointer)
+    PushRegToStack(R_FP);
   for(int i=this->args->size()-1; i>=0; i--){
     (*args)[i]->Emit();
-    PushRegToStack("a0");
+    PushRegToStack(R_A0);
   }
-  printf("jal %s\n", this->fd->name.c_str());
+  code->Jal(this->fd->label);
+  sp_offset = pushed;
+}
+
+// With the arguments of a call to `to` pushed, as Call::Emit() pushes
+// them, hands the frame of `from` over to it: the saved registers and $ra
+// are restored, the arguments copied up over the parameters so that they
+// end where the caller of `from` expects its arguments to end, and `to` is
+// jumped to. Its return then goes straight back to that caller. The
+// entry $sp of `from` is at entry off base.
+void EmitTailJump(FuncDecl *from, FuncDecl *to, int base, int entry){
+  for(int i = 0; i<from->saved_regs.size(); i++)
+    code->Lw(from->saved_regs[i], entry + OFFSET_FIRST_LOCAL - i * VAR_SIZE, base);
+  if(from->saves_ra)
+    code->Lw(R_RA, entry, base);
+  // The new parameters may reach down over $ra and the locals, but never
+  // down to the pushes, so copying the last argument first is safe
+  int shift = entry + VAR_SIZE * (from->param_list->size() - to->param_list->size());
+  for(int i = to->param_list->size() - 1; i>=0; i--){
+    code->Lw(R_T1, 4 + VAR_SIZE * i, R_SP);
+    code->Sw(R_T1, shift + 4 + VAR_SIZE * i, base);
+  }
+  code->Addiu(R_SP, base, shift);
+  code->J(to->label);
+}
+
+// A function calling itself last overwrites its parameters and starts
+// the body over, its frame as it is
+static void EmitSelfTailCall(Call *call){
+  FuncDecl *fd = call->fd;
+  for(int i = call->args->size() - 1; i>=0; i--){
+    (*call->args)[i]->Emit();
+    PushRegToStack(R_A0);
+  }
+  for(int i = 0; i<fd->param_list->size(); i++){
+    Identifier *param = (*fd->param_list)[i];
+    int reg = param->reg >= 0 ? param->reg : R_T1;
+    code->Lw(reg, 4 + VAR_SIZE * i, R_SP);
+    if(param->reg < 0)
+      code->Sw(reg, FrameOffset(param->offset), FrameReg());
+  }
+  if(!fd->param_list->empty())
+    code->Addiu(R_SP, R_SP, VAR_SIZE * fd->param_list->size());
+  sp_offset -= VAR_SIZE * fd->param_list->size();
+  code->J(fd->body_label);
 }
 
 void ReturnStatement::Emit(){
+  Call *call = this->tail_call ? As<Call>(this->expr) : NULL;
+  if(call && call->fd == this->fd){
+    EmitSelfTailCall(call);
+    return;
+  }
+  if(call){
+    // No $fp to push: the one the caller of this function pushed, if
+    // any, stays where the callee's return looks for it
+    int pushed = sp_offset;
+    for(int i = call->args->size() - 1; i>=0; i--){
+      (*call->args)[i]->Emit();
+      PushRegToStack(R_A0);
+    }
+    EmitTailJump(this->fd, call->fd, FrameReg(), FrameOffset(0));
+    sp_offset = pushed;
+    return;
+  }
   if(this->expr != NULL){
     this->expr->Emit();
   }
 
-  if(this->fd->name != "main"){
-    printf("lw $ra 0($fp)\n");
-    printf("addiu $sp $fp %lu\n", 4 + VAR_SIZE * this->fd->param_list->size());
-    printf("lw $fp 0($sp)\n");
-    printf("jr $ra\n");
-  }
+  if(this->fd->name != "main")
+    code->J(this->fd->exit_label);
   else{
-    printf("li $v0 17\n");
-    printf("syscall\n");
+    code->Li(R_V0, 17);
+    code->Syscall();
   }
 }
@@ -2,11 +2,25 @@
 #define MIPS_H
 
 #include "ast.h"
+#include "instr.h"
 #include <map>
 
 void EmitPreamble();
-void InitCodeGenerator();
 
-extern map<int, string> opcodes;
+// Code for one optimized function through the backend chosen in options
+void GenerateFunction(FuncDecl *);
+// Instructions GenerateFunction() would emit, with or without the SSA
+// backend's dead value removal, leaving the stream alone
+int CountInstructions(FuncDecl *, bool dce);
+// Replaces the frame of `from`, whose entry $sp is at entry off base, by
+// one of `to` and jumps to it, the arguments having been pushed as for a
+// call
+void EmitTailJump(FuncDecl *from, FuncDecl *to, int base, int entry);
+
+extern const map<int, int> opcodes;
+// Stream the current thread emits into, and where the program's
+// assembly is written once it is complete
+extern thread_local InstrStream *code;
+extern thread_local FILE *asm_out;
 
 #endif
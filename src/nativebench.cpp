@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern char **environ;
+
+// One way of building a kernel and the best time of its runs
+struct Build{
+  const char *name;
+  string binary;
+  int status;
+  double ms;
+};
+
+static const char *parser = "./parser";
+static const char *cc = "gcc";
+static int runs = 5;
+
+// Runs args with stdout to out (if any) and returns the exit code, -1
+// if it could not run or was killed. Wall time of the run goes to ms.
+static int Spawn(vector<const char *> args, const char *in, const char *out, double *ms){
+  args.push_back(NULL);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if(in)
+    posix_spawn_file_actions_addopen(&actions, 0, in, O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, 1, out ? out : "/dev/null",
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid;
+  int status = -1;
+  bool ok = posix_spawnp(&pid, args[0], &actions, NULL, (char **) &args[0], environ) == 0 &&
+            waitpid(pid, &status, 0) == pid;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  posix_spawn_file_actions_destroy(&actions);
+  if(ms)
+    *ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  return ok && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The kernel through the parser and gcc's assembler, or straight
+// through gcc at -O0 and -O2
+static bool Compile(const char *kernel, const string &dir, Build *builds){
+  string s = dir + "/kernel.s";
+  builds[0].binary = dir + "/x86";
+  if(Spawn({parser, "-target=x86-64"}, kernel, s.c_str(), NULL) != 0 ||
+     Spawn({cc, s.c_str(), "-o", builds[0].binary.c_str()}, NULL, NULL, NULL) != 0){
+    fprintf(stderr, "native-bench: %s -target=x86-64 failed on %s\n", parser, kernel);
+    return false;
+  }
+  const char *levels[] = {"-O0", "-O2"};
+  for(int i = 0; i<2; i++){
+    builds[i + 1].binary = dir + "/gcc" + levels[i];
+    if(Spawn({cc, levels[i], "-w", "-x", "c", kernel, "-o", builds[i + 1].binary.c_str()},
+             NULL, NULL, NULL) != 0){
+      fprintf(stderr, "native-bench: %s %s failed on %s\n", cc, levels[i], kernel);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void Usage(const char *prog){
+  fprintf(stderr, "usage: %s [-parser=PATH] [-cc=PATH] [-runs=N] kernel.c...\n", prog);
+  fprintf(stderr, "  -parser=PATH  compiler to measure (default ./parser)\n");
+  fprintf(stderr, "  -cc=PATH      gcc to assemble with and compare against (default gcc)\n");
+  fprintf(stderr, "  -runs=N       runs of each binary, the fastest counts (default 5)\n");
+}
+
+int main(int argc, char **argv){
+  vector<const char *> kernels;
+  for(int i = 1; i<argc; i++){
+    if(strncmp(argv[i], "-parser=", 8) == 0)
+      parser = argv[i] + 8;
+    else if(strncmp(argv[i], "-cc=", 4) == 0)
+      cc = argv[i] + 4;
+    else if(strncmp(argv[i], "-runs=", 6) == 0 && atoi(argv[i] + 6) >= 1)
+      runs = atoi(argv[i] + 6);
+    else if(argv[i][0] != '-')
+      kernels.push_back(argv[i]);
+    else{
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if(kernels.empty()){
+    Usage(argv[0]);
+    return 2;
+  }
+
+  char dir[] = "/tmp/nativebenchXXXXXX";
+  if(mkdtemp(dir) == NULL){
+    perror("native-bench");
+    return 1;
+  }
+  // The binaries of the parser also print the globals; they go to
+  // /dev/null with the rest, only the exit codes are compared
+  printf("%-24s %10s %10s %10s %8s %8s\n", "kernel", "x86 ms", "-O0 ms", "-O2 ms",
+         "/-O0", "/-O2");
+  int failed = 0;
+  for(int k = 0; k<kernels.size(); k++){
+    Build builds[3] = {{"x86-64"}, {"gcc -O0"}, {"gcc -O2"}};
+    if(!Compile(kernels[k], dir, builds)){
+      failed++;
+      continue;
+    }
+    for(int b = 0; b<3; b++){
+      builds[b].ms = -1;
+      for(int r = 0; r<runs; r++){
+        double ms;
+        builds[b].status = Spawn({builds[b].binary.c_str()}, NULL, NULL, &ms);
+        if(builds[b].ms < 0 || ms < builds[b].ms)
+          builds[b].ms = ms;
+      }
+    }
+    const char *name = strrchr(kernels[k], '/') ? strrchr(kernels[k], '/') + 1 : kernels[k];
+    printf("%-24s %10.1f %10.1f %10.1f %7.2fx %7.2fx\n", name, builds[0].ms, builds[1].ms,
+           builds[2].ms, builds[0].ms / builds[1].ms, builds[0].ms / builds[2].ms);
+    for(int b = 1; b<3; b++){
+      if(builds[b].status != builds[0].status){
+        printf("  MISMATCH: exit code %d, %s gives %d\n", builds[0].status, builds[b].name,
+               builds[b].status);
+        failed++;
+      }
+    }
+    fflush(stdout);
+  }
+  for(const char *f : {"kernel.s", "x86", "gcc-O0", "gcc-O2"})
+    unlink((string(dir) + "/" + f).c_str());
+  rmdir(dir);
+  return failed > 0;
+}
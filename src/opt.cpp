@@ -0,0 +1,264 @@
+#include "opt.h"
+#include "options.h"
+#include "mips.h"
+#include "errors.h"
+#include <stdio.h>
+
+using namespace std;
+
+YYLTYPE LocOf(Ast *a){
+  YYLTYPE l;
+  if(a && a->loc)
+    l = *a->loc;
+  else
+    l.first_line = l.first_column = l.last_line = l.last_column = 0;
+  return l;
+}
+
+// Scalar variables assigned in a piece of code and the functions it calls
+class AssignedScan{
+public:
+  set<Identifier *> assigned;
+  set<FuncDecl *> callees;
+
+  void ScanExpr(Expression *e){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->is_array){
+        for(int i = 0; i<a->access_list->size(); i++)
+          ScanExpr((*a->access_list)[i]);
+        ScanExpr(a->base_offset);
+      }
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        ScanExpr((*c->args)[i]);
+      callees.insert(c->fd);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      ScanExpr(o->rhs);
+      ScanExpr(o->lhs);
+      if(o->op->op == ASSIGN){
+        Access *a = As<Access>(o->lhs);
+        if(!a->is_array)
+          assigned.insert(a->id);
+      }
+    }
+  }
+
+  void ScanStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      ScanExpr(As<ExprStatement>(s)->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      ScanExpr(sel->test);
+      ScanStmt(sel->body_true);
+      ScanStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        ScanStmt(it->init);
+        ScanStmt(it->cond);
+      }
+      ScanExpr(it->expr);
+      ScanStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        ScanStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ScanExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+};
+
+void ComputeModSets(){
+  map<FuncDecl *, set<FuncDecl *> > callees;
+  for(map<string, Declaration *>::iterator i = global_sym_table->begin();
+      i != global_sym_table->end(); ++i)
+  {
+    if(!Is<FuncDecl>(i->second))
+      continue;
+    FuncDecl *fd = As<FuncDecl>(i->second);
+    AssignedScan scan;
+    scan.ScanStmt(fd->stmt_block);
+    set<Identifier *> &mods = fd->mods;
+    mods.clear();
+    for(set<Identifier *>::iterator j = scan.assigned.begin(); j != scan.assigned.end(); ++j){
+      if((*j)->is_global)
+        mods.insert(*j);
+    }
+    callees[fd] = scan.callees;
+  }
+
+  bool changed = true;
+  while(changed){
+    changed = false;
+    for(map<FuncDecl *, set<FuncDecl *> >::iterator i = callees.begin(); i != callees.end(); ++i){
+      set<Identifier *> &mods = i->first->mods;
+      for(set<FuncDecl *>::iterator j = i->second.begin(); j != i->second.end(); ++j){
+        set<Identifier *> &callee_mods = (*j)->mods;
+        for(set<Identifier *>::iterator k = callee_mods.begin(); k != callee_mods.end(); ++k){
+          if(mods.insert(*k).second)
+            changed = true;
+        }
+      }
+    }
+  }
+}
+
+bool SameExpr(Expression *a, Expression *b){
+  if(a == NULL || b == NULL)
+    return a == b;
+  if(a->kind != b->kind)
+    return false;
+  if(Is<IntConst>(a))
+    return As<IntConst>(a)->val == As<IntConst>(b)->val;
+  if(Is<BoolConst>(a))
+    return As<BoolConst>(a)->val == As<BoolConst>(b)->val;
+  if(Is<Access>(a)){
+    Access *x = As<Access>(a), *y = As<Access>(b);
+    return !x->is_array && !y->is_array && x->id == y->id;
+  }
+  if(Is<OpExpression>(a)){
+    OpExpression *x = As<OpExpression>(a), *y = As<OpExpression>(b);
+    return x->op->op == y->op->op && x->op->op != ASSIGN &&
+      SameExpr(x->lhs, y->lhs) && SameExpr(x->rhs, y->rhs);
+  }
+  return false;
+}
+
+Identifier *NewTemp(FuncDecl *fd, enum Type t, const char *prefix){
+  // The dot keeps the name apart from any identifier of the program
+  char name[64];
+  sprintf(name, "%s.%d", prefix, (int) fd->stmt_block->symbol_table->size());
+  YYLTYPE loc = LocOf(NULL);
+  Identifier *temp = new Identifier(loc, t, string(name));
+  (*fd->stmt_block->symbol_table)[temp->name] = temp;
+  temp->parent = fd->stmt_block;
+  return temp;
+}
+
+Access *UseOf(Identifier *id, YYLTYPE loc){
+  Access *a = new Access(loc, id->sym);
+  a->id = id;
+  a->type = id->elem_type;
+  return a;
+}
+
+ExprStatement *AssignTo(Identifier *id, Expression *e){
+  YYLTYPE loc = LocOf(e);
+  OpExpression *o = new OpExpression(new Operator(loc, ASSIGN), UseOf(id, loc), e);
+  o->type = id->elem_type;
+  return new ExprStatement(o);
+}
+
+void InsertBefore(Statement *s, const vector<Statement *> &stmts){
+  Ast *parent = s->parent;
+  if(Is<StatementBlock>(parent)){
+    vector<Statement *> *list = As<StatementBlock>(parent)->stmt_list;
+    int pos = 0;
+    while((*list)[pos] != s)
+      pos++;
+    list->insert(list->begin() + pos, stmts.begin(), stmts.end());
+    for(int i = 0; i<stmts.size(); i++)
+      stmts[i]->parent = parent;
+    return;
+  }
+
+  vector<Statement *> *list = ast_arena->New<vector<Statement *> >(stmts);
+  list->push_back(s);
+  StatementBlock *sb = new StatementBlock(ast_arena->New<map<string, Identifier *> >(), list);
+  sb->parent = parent;
+  if(Is<IterStatement>(parent))
+    As<IterStatement>(parent)->body = sb;
+  else{
+    SelStatement *sel = As<SelStatement>(parent);
+    if(sel->body_true == s)
+      sel->body_true = sb;
+    else
+      sel->body_false = sb;
+  }
+}
+
+void RemoveStatement(Statement *s){
+  vector<Statement *> *list = As<StatementBlock>(s->parent)->stmt_list;
+  for(int i = 0; i<list->size(); i++){
+    if((*list)[i] == s){
+      list->erase(list->begin() + i);
+      break;
+    }
+  }
+  s->parent = NULL;
+}
+
+void VariantInLoop(IterStatement *it, set<Identifier *> &variant){
+  AssignedScan scan;
+  scan.ScanStmt(it);
+  variant = scan.assigned;
+  for(set<FuncDecl *>::iterator i = scan.callees.begin(); i != scan.callees.end(); ++i){
+    set<Identifier *> &mods = (*i)->mods;
+    variant.insert(mods.begin(), mods.end());
+  }
+}
+
+// Array elements and divisions by a variable are left out: done ahead of
+// a loop that does not run, a load could touch memory the program never
+// addresses and a division could divide by zero.
+bool InvariantIn(Expression *e, const set<Identifier *> &variant){
+  if(e == NULL)
+    return true;
+  if(Is<IntConst>(e) || Is<BoolConst>(e))
+    return true;
+  if(Is<Access>(e)){
+    Access *a = As<Access>(e);
+    return !a->is_array && variant.count(a->id) == 0;
+  }
+  if(Is<OpExpression>(e)){
+    OpExpression *o = As<OpExpression>(e);
+    if(o->op->op == DIVIDE || o->op->op == MODULUS){
+      IntConst *c = As<IntConst>(o->rhs);
+      if(c == NULL || c->val == 0)
+        return false;
+    }
+    return o->op->op != ASSIGN && InvariantIn(o->lhs, variant) && InvariantIn(o->rhs, variant);
+  }
+  return false;
+}
+
+void OptimizeFunction(FuncDecl *fd){
+  if(options.fold)
+    FoldConstants(fd);
+  if(options.licm)
+    HoistLoopInvariants(fd);
+  // Pointers start from copies of the subscripts; fold them again
+  if(options.strength_reduce && ReduceInductionVariables(fd) && options.fold)
+    FoldConstants(fd);
+  if(!options.dce)
+    return;
+  if(!options.dce_report){
+    EliminateDeadCode(fd, NULL);
+    return;
+  }
+
+  // What the cleanup saves is measured by generating the function with
+  // the chosen backend both ways
+  int before = CountInstructions(fd, false);
+  DeadCodeStats stats;
+  EliminateDeadCode(fd, &stats);
+  int after = CountInstructions(fd, true);
+  fprintf(diag_out, "dce: %s: %d unreachable, %d constant branches, %d dead stores, "
+          "%d dead expressions; %d -> %d instructions (-%d)\n",
+          fd->name.c_str(), stats.unreachable, stats.branches, stats.dead_stores,
+          stats.dead_exprs, before, after, before - after);
+}
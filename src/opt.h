@@ -0,0 +1,78 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include "ast.h"
+#include <set>
+#include <vector>
+
+// AST-level optimization passes. They run on a checked, error free
+// function before registers are allocated and code is emitted.
+
+// Collapses constant subtrees into IntConst/BoolConst nodes and
+// propagates locals that are assigned a constant exactly once
+void FoldConstants(FuncDecl *);
+
+// Moves computations that do not change inside a loop, and the
+// invariant subscripts of array accesses, into a preheader in front of it
+void HoistLoopInvariants(FuncDecl *);
+
+// Replaces array subscripts and locals that move linearly with a loop
+// counter by pointers bumped a constant stride per iteration, dropping
+// the counter when nothing else needs it. Returns whether anything
+// changed.
+bool ReduceInductionVariables(FuncDecl *);
+
+// What EliminateDeadCode() removed from one function
+struct DeadCodeStats{
+  int unreachable;      // statements after a return or an endless loop
+  int branches;         // ifs and loops whose test is a constant
+  int dead_stores;      // assignments to locals nobody reads afterwards
+  int dead_exprs;       // expression statements without any effect
+  DeadCodeStats() {unreachable = branches = dead_stores = dead_exprs = 0;}
+};
+
+// Removes unreachable statements, folds branches on constant tests and
+// drops stores to locals and parameters that are dead by liveness.
+// stats may be NULL.
+void EliminateDeadCode(FuncDecl *, DeadCodeStats *stats);
+
+// Fills in FuncDecl::mods of every function for VariantInLoop(). Runs once
+// over the whole checked program before any function is optimized, so
+// that functions can then be optimized independently.
+void ComputeModSets();
+
+// Substitutes the bodies of small functions that are not recursive for
+// the calls to them that make up a whole statement, or all of what one
+// assigns, returns or tests. Parameters become fresh locals bound to
+// the arguments and returns fall through to the end of the inlined
+// code. With -inline-report says on diag_out what became of every call.
+// Runs over the whole checked program before ComputeModSets().
+void InlineCalls(const vector<FuncDecl *> &functions);
+
+// Runs the passes enabled in options over one function
+void OptimizeFunction(FuncDecl *);
+
+// Helpers shared by the passes
+
+YYLTYPE LocOf(Ast *);       // location of the node, zeros for made-up nodes
+bool SameExpr(Expression *, Expression *);    // structurally equal and pure
+
+// A new scalar local of the function, named prefix.N
+Identifier *NewTemp(FuncDecl *, enum Type, const char *prefix);
+Access *UseOf(Identifier *, YYLTYPE);
+ExprStatement *AssignTo(Identifier *, Expression *);
+
+// Places stmts right in front of s, wrapping s in a block when it is not
+// a statement of one already
+void InsertBefore(Statement *s, const vector<Statement *> &stmts);
+// Takes s out of the block holding it
+void RemoveStatement(Statement *s);
+
+// Scalars the loop may change: those it assigns and the globals that
+// the functions it calls may assign
+void VariantInLoop(IterStatement *, set<Identifier *> &);
+// Pure, cannot trap and reads nothing in variant: safe to compute once
+// ahead of the loop
+bool InvariantIn(Expression *, const set<Identifier *> &variant);
+
+#endif
@@ -0,0 +1,164 @@
+#include "options.h"
+#include "peephole.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <thread>
+
+thread_local Options options;
+
+// Optimizations that can be switched with -f<name> / -fno-<name>
+struct Flag{
+  const char *name;
+  bool Options::*field;
+  bool default_value;
+  const char *help;
+};
+
+static const Flag flags[] = {
+  {"regalloc", &Options::regalloc, true, "keep scalars in registers"},
+  {"fold", &Options::fold, true, "constant folding and propagation"},
+  {"licm", &Options::licm, true, "hoist loop-invariant code into preheaders"},
+  {"strength-reduce", &Options::strength_reduce, true, "step array pointers instead of multiplying"},
+  {"inline", &Options::inline_calls, true, "substitute small non-recursive functions at their calls"},
+  {"tail-calls", &Options::tail_calls, true, "reuse the frame for a call in return position"},
+  {"dce", &Options::dce, true, "remove unreachable code, constant branches and dead stores"},
+  {"omit-frame-pointer", &Options::omit_frame_pointer, true, "address locals off $sp, with no $fp to set up"},
+  {"peephole", &Options::peephole, true, "rewrite redundant instruction sequences"},
+  {"ssa", &Options::ssa, false, "generate code from the SSA IR instead of the AST"},
+};
+
+#define NUM_FLAGS (sizeof(flags) / sizeof(flags[0]))
+
+void Usage(const char *prog){
+  fprintf(stderr, "usage: %s [options] < file.c\n", prog);
+  fprintf(stderr, "       %s [options] file.c...    (each to file.s, -jobs=N files at a time)\n", prog);
+  fprintf(stderr, "  -arena-stats     report AST arena usage on stderr\n");
+  fprintf(stderr, "  -peephole-stats  report peephole rule hits on stderr\n");
+  fprintf(stderr, "  -dce-report      report what dead code elimination saved per function\n");
+  fprintf(stderr, "  -inline-report   say for every call whether it was inlined, or why not\n");
+  fprintf(stderr, "  -dump-ir         print the SSA IR of every function on stderr\n");
+  fprintf(stderr, "  -peephole-window=N  instructions a peephole rule may inspect (default %d)\n",
+          DEFAULT_PEEPHOLE_WINDOW);
+  fprintf(stderr, "  -jobs=N          check and generate functions on N threads (default: one per core)\n");
+  fprintf(stderr, "  -batch-stats     report files/sec of a batch against one process per file\n");
+  fprintf(stderr, "  -time-report     report time and memory per phase, node and instruction counts\n");
+  fprintf(stderr, "  -time-report=json  the same as one line of JSON\n");
+  fprintf(stderr, "  -run             run the program on the bytecode VM, print its exit code and globals\n");
+  fprintf(stderr, "  -target=T        mips (default) or x86-64, GNU assembly to link with gcc\n");
+  for(int i = 0; i<NUM_FLAGS; i++){
+    fprintf(stderr, "  -f[no-]%-9s %s\n", flags[i].name, flags[i].help);
+  }
+}
+
+Options DefaultOptions(){
+  Options o;
+  o.arena_stats = false;
+  o.peephole_stats = false;
+  o.dump_ir = false;
+  o.dce_report = false;
+  o.inline_report = false;
+  o.batch_stats = false;
+  o.time_report = false;
+  o.time_report_json = false;
+  o.run = false;
+  o.x86_64 = false;
+  o.peephole_window = DEFAULT_PEEPHOLE_WINDOW;
+  o.jobs = thread::hardware_concurrency();
+  if(o.jobs < 1)
+    o.jobs = 1;
+  for(int i = 0; i<NUM_FLAGS; i++){
+    o.*flags[i].field = flags[i].default_value;
+  }
+  return o;
+}
+
+vector<string> CompilationFlags(){
+  vector<string> args;
+  for(int i = 0; i<NUM_FLAGS; i++)
+    args.push_back(string(options.*flags[i].field ? "-f" : "-fno-") + flags[i].name);
+  args.push_back("-peephole-window=" + to_string(options.peephole_window));
+  args.push_back(options.x86_64 ? "-target=x86-64" : "-target=mips");
+  if(options.run)
+    args.push_back("-run");
+  return args;
+}
+
+bool ParseOptions(int argc, char **argv){
+  options = DefaultOptions();
+
+  for(int i = 1; i<argc; i++){
+    const char *arg = argv[i];
+    if(strcmp(arg, "-arena-stats") == 0){
+      options.arena_stats = true;
+      continue;
+    }
+    if(strcmp(arg, "-peephole-stats") == 0){
+      options.peephole_stats = true;
+      continue;
+    }
+    if(strcmp(arg, "-dce-report") == 0){
+      options.dce_report = true;
+      continue;
+    }
+    if(strcmp(arg, "-inline-report") == 0){
+      options.inline_report = true;
+      continue;
+    }
+    if(strcmp(arg, "-batch-stats") == 0){
+      options.batch_stats = true;
+      continue;
+    }
+    if(strcmp(arg, "-time-report") == 0 || strcmp(arg, "-time-report=json") == 0){
+      options.time_report = true;
+      options.time_report_json = arg[12] == '=';
+      continue;
+    }
+    if(strcmp(arg, "-run") == 0){
+      options.run = true;
+      continue;
+    }
+    if(strcmp(arg, "-target=mips") == 0 || strcmp(arg, "-target=x86-64") == 0){
+      options.x86_64 = arg[8] == 'x';
+      continue;
+    }
+    if(arg[0] != '-'){
+      options.files.push_back(arg);
+      continue;
+    }
+    if(strcmp(arg, "-dump-ir") == 0){
+      options.dump_ir = true;
+      continue;
+    }
+    if(strncmp(arg, "-peephole-window=", 17) == 0){
+      options.peephole_window = atoi(arg + 17);
+      if(options.peephole_window >= 2)
+        continue;
+    }
+    if(strncmp(arg, "-jobs=", 6) == 0){
+      options.jobs = atoi(arg + 6);
+      if(options.jobs >= 1)
+        continue;
+    }
+    if(strncmp(arg, "-f", 2) == 0){
+      bool value = true;
+      const char *name = arg + 2;
+      if(strncmp(name, "no-", 3) == 0){
+        value = false;
+        name += 3;
+      }
+      int j;
+      for(j = 0; j<NUM_FLAGS; j++){
+        if(strcmp(name, flags[j].name) == 0){
+          options.*flags[j].field = value;
+          break;
+        }
+      }
+      if(j < NUM_FLAGS)
+        continue;
+    }
+    Usage(argv[0]);
+    return false;
+  }
+  return true;
+}
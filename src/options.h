@@ -0,0 +1,47 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Command line switches shared by the compiler phases
+struct Options{
+  bool arena_stats;
+  bool regalloc;
+  bool fold;
+  bool licm;
+  bool strength_reduce;
+  bool dce;
+  bool dce_report;
+  bool inline_calls;
+  bool inline_report;
+  bool tail_calls;
+  bool omit_frame_pointer;
+  bool peephole;
+  bool peephole_stats;
+  int peephole_window;
+  bool ssa;
+  bool dump_ir;
+  int jobs;             // threads checking and generating functions
+  bool batch_stats;
+  bool time_report;     // phase times, memory and counts
+  bool time_report_json;
+  bool run;             // run on the bytecode VM instead of writing MIPS
+  bool x86_64;          // -target=x86-64: native assembly instead of MIPS
+  vector<const char *> files;   // batch mode when not empty
+};
+
+// Options of the compilation running on this thread
+extern thread_local Options options;
+
+// Every optimization at its default, no reports, a thread per core
+Options DefaultOptions();
+// Sets options from the command line, on top of the defaults
+bool ParseOptions(int argc, char **argv);
+// The switches that decide the code written, as command line arguments
+vector<string> CompilationFlags();
+void Usage(const char *prog);
+
+#endif
@@ -0,0 +1,193 @@
+#include "parallel.h"
+#include "errors.h"
+#include "mips.h"
+#include "opt.h"
+#include "lexer.h"
+#include "report.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+thread_local int function_jobs = 1;
+
+struct TaskQueue{
+  mutex lock;
+  deque<int> tasks;
+};
+
+WorkStealingPool::WorkStealingPool(int num_threads){
+  this->num_threads = num_threads < 1 ? 1 : num_threads;
+}
+
+void WorkStealingPool::Run(int n, const function<void(int, int)> &task){
+  int threads = n < num_threads ? n : num_threads;
+  if(threads <= 1){
+    for(int i = 0; i<n; i++)
+      task(i, 0);
+    return;
+  }
+
+  vector<TaskQueue> queues(threads);
+  for(int t = 0; t<threads; t++){
+    for(int i = (long) n * t / threads; i < (long) n * (t + 1) / threads; i++)
+      queues[t].tasks.push_back(i);
+  }
+
+  // No task makes new ones, so a thread that finds every queue empty is done
+  auto work = [&](int t){
+    while(true){
+      int i = -1;
+      for(int k = 0; k<threads && i < 0; k++){
+        TaskQueue &q = queues[(t + k) % threads];
+        lock_guard<mutex> guard(q.lock);
+        if(q.tasks.empty())
+          continue;
+        if(k == 0){
+          i = q.tasks.back();
+          q.tasks.pop_back();
+        }
+        else{
+          i = q.tasks.front();
+          q.tasks.pop_front();
+        }
+      }
+      if(i < 0)
+        return;
+      task(i, t);
+    }
+  };
+
+  vector<thread> workers;
+  for(int t = 1; t<threads; t++)
+    workers.push_back(thread(work, t));
+  work(0);
+  for(int t = 0; t<workers.size(); t++)
+    workers[t].join();
+}
+
+// What one function's task produced
+struct FunctionResult{
+  InstrStream *code;
+  char *diag;
+  size_t diag_size;
+  int errors;
+  vector<Diagnostic> diagnostics;
+  CompileStats stats;
+};
+
+// Runs body(i) for every function with the thread-local compilation state
+// pointed at the task's own, then writes out the diagnostics in order
+static void RunPerFunction(int n, WorkStealingPool &pool, bool emit,
+                           const function<void(int)> &body, vector<FunctionResult> &results)
+{
+  InstrStream *program = code;
+  Arena *program_arena = ast_arena;
+  SymbolTable *program_symbols = symbols;
+  map<string, Declaration *> *program_globals = global_sym_table;
+  vector<string> *program_lines = source_lines;
+  const Options &program_options = options;
+  bool collect = diagnostics != NULL;
+  CompileStats *program_stats = stats;
+  vector<Arena *> arenas(pool.NumThreads(), NULL);
+  results.resize(n);
+
+  pool.Run(n, [&](int i, int t){
+      // Nodes made by the passes outlive the task; the calling thread
+      // keeps allocating from the program's arena
+      if(t > 0 && arenas[t] == NULL)
+        arenas[t] = new Arena();
+      Arena *saved_arena = ast_arena;
+      InstrStream *saved_code = code;
+      FILE *saved_diag = diag_out;
+      int saved_errors = numErrors;
+      // On a worker thread the program's tables have to be made current
+      SymbolTable *saved_symbols = symbols;
+      map<string, Declaration *> *saved_globals = global_sym_table;
+      vector<string> *saved_lines = source_lines;
+      vector<Diagnostic> *saved_diagnostics = diagnostics;
+      CompileStats *saved_stats = stats;
+      if(t > 0)
+        options = program_options;
+      symbols = program_symbols;
+      global_sym_table = program_globals;
+      source_lines = program_lines;
+
+      FunctionResult &r = results[i];
+      r.code = emit ? new InstrStream(program) : NULL;
+      ast_arena = t > 0 ? arenas[t] : program_arena;
+      code = r.code;
+      diag_out = open_memstream(&r.diag, &r.diag_size);
+      numErrors = 0;
+      diagnostics = collect ? &r.diagnostics : NULL;
+      stats = program_stats ? &r.stats : NULL;
+
+      body(i);
+
+      fclose(diag_out);
+      r.errors = numErrors;
+      ast_arena = saved_arena;
+      code = saved_code;
+      diag_out = saved_diag;
+      numErrors = saved_errors;
+      symbols = saved_symbols;
+      global_sym_table = saved_globals;
+      source_lines = saved_lines;
+      diagnostics = saved_diagnostics;
+      stats = saved_stats;
+    });
+
+  for(int t = 0; t<arenas.size(); t++){
+    if(arenas[t] == NULL)
+      continue;
+    ast_arena->Absorb(*arenas[t]);
+    delete arenas[t];
+  }
+  for(int i = 0; i<n; i++){
+    FunctionResult &r = results[i];
+    fwrite(r.diag, 1, r.diag_size, diag_out);
+    free(r.diag);
+    numErrors += r.errors;
+    if(collect)
+      diagnostics->insert(diagnostics->end(), r.diagnostics.begin(), r.diagnostics.end());
+    if(program_stats)
+      program_stats->AddTimes(r.stats);
+  }
+}
+
+void CheckFunctions(const vector<FuncDecl *> &functions, WorkStealingPool &pool){
+  vector<FunctionResult> results;
+  RunPerFunction(functions.size(), pool, false, [&](int i){
+      functions[i]->stmt_block->CheckStatement();
+    }, results);
+}
+
+void GenerateFunctions(const vector<FuncDecl *> &functions, WorkStealingPool &pool){
+  if(options.inline_calls){
+    PhaseTimer timer(PH_OPTIMIZE);
+    InlineCalls(functions);
+  }
+  // The one whole-program fact the passes need, gathered before they run
+  ComputeModSets();
+  vector<FunctionResult> results;
+  RunPerFunction(functions.size(), pool, true, [&](int i){
+      FuncDecl *fd = functions[i];
+      {
+        PhaseTimer timer(PH_OPTIMIZE);
+        OptimizeFunction(fd);
+      }
+      GenerateFunction(fd);
+      if(fd->name == "main"){
+        code->Li(R_A0, 0);
+        code->Li(R_V0, 17);
+        code->Syscall();
+      }
+    }, results);
+  for(int i = 0; i<results.size(); i++){
+    code->Splice(*results[i].code);
+    delete results[i].code;
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "ast.h"
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+// Runs a batch of independent tasks on a fixed number of threads, the
+// calling one included. Every thread starts with an even, contiguous
+// share of the task numbers in a deque of its own, works from its back
+// and, once that is empty, steals from the front of the others'.
+class WorkStealingPool{
+public:
+  WorkStealingPool(int num_threads);
+
+  int NumThreads() const {return num_threads;}
+  // Calls task(i, thread) for every i in [0, n) and returns when all of
+  // them are done; thread is the number (0 for the caller) running it
+  void Run(int n, const function<void(int, int)> &task);
+
+private:
+  int num_threads;
+};
+
+// Per-function phases over the whole program, a task per function.
+// Functions only read the global table and the callee signatures, so
+// each task gets its own instruction stream, arena, error count and
+// diagnostics buffer (the thread-local code, ast_arena, numErrors and
+// diag_out). Buffers are written out in the order of functions, so the
+// output does not depend on the number of threads.
+
+// Threads the per-function phases of the compilation running on this
+// thread may use
+extern thread_local int function_jobs;
+
+// Checks every function, reporting the errors and adding them to numErrors
+void CheckFunctions(const vector<FuncDecl *> &, WorkStealingPool &);
+// Optimizes every function and generates its code into code
+void GenerateFunctions(const vector<FuncDecl *> &, WorkStealingPool &);
+
+#endif
@@ -0,0 +1,388 @@
+#include "peephole.h"
+#include <vector>
+
+using namespace std;
+
+#define MAX_PEEPHOLE_PASSES 10
+
+// The instructions a rule may inspect: in[0] is where it would match
+struct Window{
+  const Instr *in;
+  int avail;
+};
+
+// A rule returns how many instructions of the window it consumed (0 when
+// it does not match) after appending their replacement to out
+struct PeepholeRule{
+  const char *name;
+  int (*apply)(const Window &, vector<Instr> &);
+};
+
+// Registers the code generator and the allocator never use; free to hold
+// a value that used to wait on the stack
+static const int scratch_regs[] = {R_T0, R_V1, R_A1, R_A2, R_A3};
+
+static Instr MakeInstr(int op, int rd, int rs, int rt, int imm){
+  Instr i;
+  i.op = op;
+  i.rd = rd;
+  i.rs = rs;
+  i.rt = rt;
+  i.imm = imm;
+  i.label = NO_LABEL;
+  return i;
+}
+
+static bool Pinned(int reg){
+  return reg == R_SP || reg == R_FP || reg == R_RA || reg == R_ZERO || reg == R_NONE;
+}
+
+// Registers that only ever hold a value within one expression's code: the
+// code generator branches on $a0 alone and nothing is kept in these across
+// a label, jump or call
+static bool Transient(int reg){
+  if(reg >= R_T0 && reg <= R_T3)
+    return true;
+  for(int n = 0; n<sizeof(scratch_regs)/sizeof(int); n++){
+    if(scratch_regs[n] == reg)
+      return true;
+  }
+  return false;
+}
+
+// Is reg overwritten before it is read again, looking from in[from]?
+// Reaching a barrier means "dead" only for transient registers; the end of
+// the window means "maybe live".
+static bool DeadAfter(const Window &w, int from, int reg){
+  if(Pinned(reg))
+    return false;
+  for(int k = from; k<w.avail; k++){
+    if(InstrUses(w.in[k], reg))
+      return false;
+    if(IsBarrier(w.in[k]))
+      return Transient(reg);
+    int second;
+    if(InstrDef(w.in[k], &second) == reg || second == reg)
+      return true;
+  }
+  return false;
+}
+
+// Side-effect free instructions whose only effect is their destination
+static bool PureDef(const Instr &i){
+  switch(i.op){
+  case I_LI: case I_LA: case I_LW: case I_ADDIU: case I_ADD: case I_SUB:
+  case I_AND: case I_OR: case I_SLT: case I_XORI: case I_SLL: case I_MFLO:
+  case I_MFHI: case I_MOVE:
+    return true;
+  }
+  return false;
+}
+
+static bool SameAddress(const Instr &a, const Instr &b){
+  if(a.label != NO_LABEL || b.label != NO_LABEL)
+    return a.label == b.label && a.imm == b.imm;
+  return a.rs == b.rs && a.imm == b.imm;
+}
+
+static bool IsSpAdjust(const Instr &i, int amount){
+  return i.op == I_ADDIU && i.rd == R_SP && i.rs == R_SP && i.imm == amount;
+}
+
+// A load or store of a word above the stack temporary at 4($sp), such
+// as a local of a function that has no $fp
+static bool AboveTemporary(const Instr &i){
+  return (i.op == I_LW || i.op == I_SW) && i.label == NO_LABEL && i.rs == R_SP &&
+    i.imm > 4 && !(i.op == I_SW && i.rd == R_SP) && !(i.op == I_LW && i.rd == R_SP);
+}
+
+// add D X $sp; lw/sw ... O(D), D dead after: an element of a local array
+// of a function that has no $fp
+static bool SpElement(const Window &w, int k){
+  const Instr &a = w.in[k];
+  if(a.op != I_ADD || a.rd == R_SP || (a.rs == R_SP) == (a.rt == R_SP) || k + 1 >= w.avail)
+    return false;
+  const Instr &m = w.in[k + 1];
+  if((m.op != I_LW && m.op != I_SW) || m.label != NO_LABEL || m.rs != a.rd ||
+     (m.op == I_SW && m.rd == a.rd))
+    return false;
+  return InstrDef(m) == a.rd || DeadAfter(w, k + 2, a.rd);
+}
+
+// addiu $sp $sp -4; sw R 4($sp); I...; lw T 4($sp); J...; addiu $sp $sp 4
+//   => move S R; I...; move T S; J...
+// The stack temporary becomes a register S that I does not disturb.
+// Words above it that I and J address off $sp move down with $sp.
+static int PushReload(const Window &w, vector<Instr> &out){
+  if(w.avail < 4 || !IsSpAdjust(w.in[0], -4))
+    return 0;
+  const Instr &push = w.in[1];
+  if(push.op != I_SW || push.label != NO_LABEL || push.rs != R_SP ||
+     push.imm != 4 || Pinned(push.rd))
+    return 0;
+
+  int reload = -1, pop = -1;
+  vector<bool> moves(w.avail, false);
+  for(int k = 2; k<w.avail; k++){
+    const Instr &i = w.in[k];
+    if(IsBarrier(i))
+      return 0;
+    if(reload < 0 && i.op == I_LW && i.label == NO_LABEL && i.rs == R_SP && i.imm == 4){
+      reload = k;
+      continue;
+    }
+    if(reload >= 0 && IsSpAdjust(i, 4)){
+      pop = k;
+      break;
+    }
+    if(AboveTemporary(i))
+      moves[k] = true;
+    else if(SpElement(w, k))
+      moves[k + 1] = true;
+    else if(InstrTouches(i, R_SP))
+      return 0;
+  }
+  if(pop < 0)
+    return 0;
+
+  int r = push.rd, t = w.in[reload].rd;
+  bool r_kept = true, t_free = true;
+  for(int k = 2; k<reload; k++){
+    int second;
+    if(InstrDef(w.in[k], &second) == r || second == r)
+      r_kept = false;
+    if(InstrTouches(w.in[k], t))
+      t_free = false;
+  }
+  int s = -1;
+  if(r_kept)
+    s = r;
+  else if(t_free)
+    s = t;
+  else{
+    for(int n = 0; n<sizeof(scratch_regs)/sizeof(int) && s < 0; n++){
+      bool used = false;
+      for(int k = 2; k<pop && !used; k++)
+        used = InstrTouches(w.in[k], scratch_regs[n]);
+      if(!used)
+        s = scratch_regs[n];
+    }
+    if(s < 0)
+      return 0;
+  }
+
+  if(s != r)
+    out.push_back(MakeInstr(I_MOVE, s, r, R_NONE, 0));
+  for(int k = 2; k<pop; k++){
+    if(k == reload){
+      if(s != t)
+        out.push_back(MakeInstr(I_MOVE, t, s, R_NONE, 0));
+      continue;
+    }
+    out.push_back(w.in[k]);
+    if(moves[k])
+      out.back().imm -= 4;
+  }
+  return pop + 1;
+}
+
+// li X 2^k; mult Y X; mflo Z  =>  li X 2^k; sll Z Y k
+static int MultPow2(const Window &w, vector<Instr> &out){
+  if(w.avail < 3 || w.in[0].op != I_LI || w.in[1].op != I_MULT || w.in[2].op != I_MFLO)
+    return 0;
+  int x = w.in[0].rd, c = w.in[0].imm;
+  const Instr &m = w.in[1];
+  if(c <= 0 || (c & (c - 1)) != 0 || (m.rs == x) == (m.rt == x))
+    return 0;
+  // mult sets both halves, and sll neither
+  if(!DeadAfter(w, 3, R_HI) || !DeadAfter(w, 3, R_LO))
+    return 0;
+  int y = m.rs == x ? m.rt : m.rs;
+  int k = 0;
+  while((1 << k) != c)
+    k++;
+  out.push_back(w.in[0]);
+  if(k == 0)
+    out.push_back(MakeInstr(I_MOVE, w.in[2].rd, y, R_NONE, 0));
+  else
+    out.push_back(MakeInstr(I_SLL, w.in[2].rd, y, R_NONE, k));
+  return 3;
+}
+
+// li X c; add D A X  =>  addiu D A c, and likewise for sub with -c
+static int AddImmediate(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || w.in[0].op != I_LI)
+    return 0;
+  const Instr &ar = w.in[1];
+  int x = w.in[0].rd, c = w.in[0].imm, a;
+  if(ar.op == I_ADD && ar.rt == x && ar.rs != x)
+    a = ar.rs;
+  else if(ar.op == I_ADD && ar.rs == x && ar.rt != x)
+    a = ar.rt;
+  else if(ar.op == I_SUB && ar.rt == x && ar.rs != x && c != -32768){
+    a = ar.rs;
+    c = -c;
+  }
+  else
+    return 0;
+  if(c < -32768 || c > 32767 || (ar.rd != x && !DeadAfter(w, 2, x)))
+    return 0;
+  out.push_back(MakeInstr(I_ADDIU, ar.rd, a, R_NONE, c));
+  return 2;
+}
+
+// sw R A; lw T A  =>  sw R A; move T R
+static int StoreReload(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || w.in[0].op != I_SW || w.in[1].op != I_LW)
+    return 0;
+  const Instr &st = w.in[0], &ld = w.in[1];
+  if(!SameAddress(st, ld) || (st.label == NO_LABEL && st.rs == st.rd))
+    return 0;
+  out.push_back(st);
+  if(ld.rd != st.rd)
+    out.push_back(MakeInstr(I_MOVE, ld.rd, st.rd, R_NONE, 0));
+  return 2;
+}
+
+// addiu R R 0, move R R  =>  nothing
+static int NoOp(const Window &w, vector<Instr> &out){
+  const Instr &i = w.in[0];
+  if((i.op == I_ADDIU && i.rd == i.rs && i.imm == 0) ||
+     (i.op == I_MOVE && i.rd == i.rs))
+    return 1;
+  return 0;
+}
+
+// addiu $sp $sp a; addiu $sp $sp b  =>  addiu $sp $sp a+b
+static int MergeSp(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || w.in[0].op != I_ADDIU || w.in[0].rd != R_SP || w.in[0].rs != R_SP ||
+     w.in[1].op != I_ADDIU || w.in[1].rd != R_SP || w.in[1].rs != R_SP)
+    return 0;
+  int amount = w.in[0].imm + w.in[1].imm;
+  if(amount != 0)
+    out.push_back(MakeInstr(I_ADDIU, R_SP, R_SP, R_NONE, amount));
+  return 2;
+}
+
+// A pure instruction whose result is overwritten before being read
+static int DeadWrite(const Window &w, vector<Instr> &out){
+  const Instr &i = w.in[0];
+  if(!PureDef(i) || Pinned(i.rd) || !DeadAfter(w, 1, i.rd))
+    return 0;
+  return 1;
+}
+
+// I (writes R); move T R  =>  I (writes T), when R is dead afterwards
+static int ForwardMove(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || w.in[1].op != I_MOVE || !PureDef(w.in[0]))
+    return 0;
+  int r = w.in[0].rd, t = w.in[1].rd;
+  if(w.in[1].rs != r || Pinned(r) || Pinned(t) || !DeadAfter(w, 2, r))
+    return 0;
+  Instr i = w.in[0];
+  i.rd = t;
+  out.push_back(i);
+  return 2;
+}
+
+// move T S; I (reads T)  =>  I (reads S), when T is dead after I
+static int MoveUse(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || w.in[0].op != I_MOVE || IsBarrier(w.in[1]))
+    return 0;
+  int t = w.in[0].rd, s = w.in[0].rs;
+  Instr i = w.in[1];
+  if(Pinned(t) || !InstrUses(i, t))
+    return 0;
+  int second;
+  if(InstrDef(i, &second) != t && !DeadAfter(w, 2, t))
+    return 0;
+  if(i.op == I_SW && i.rd == t)
+    i.rd = s;
+  if(i.rs == t)
+    i.rs = s;
+  if(i.rt == t)
+    i.rt = s;
+  out.push_back(i);
+  return 2;
+}
+
+// j L; M: ... L:  =>  M: ... L:
+static int JumpToNext(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || (w.in[0].op != I_J && w.in[0].op != I_BEQ && w.in[0].op != I_BNE &&
+                     w.in[0].op != I_BLT && w.in[0].op != I_BGE))
+    return 0;
+  for(int k = 1; k<w.avail && w.in[k].op == I_LABEL; k++){
+    if(w.in[k].label == w.in[0].label){
+      out.insert(out.end(), w.in + 1, w.in + k + 1);
+      return k + 1;
+    }
+  }
+  return 0;
+}
+
+// j L; I  =>  j L, nothing but a label being reachable after a jump
+static int Unreachable(const Window &w, vector<Instr> &out){
+  if(w.avail < 2 || (w.in[0].op != I_J && w.in[0].op != I_JR) || w.in[1].op >= I_LABEL)
+    return 0;
+  out.push_back(w.in[0]);
+  return 2;
+}
+
+static PeepholeRule rules[] = {
+  {"push-reload", PushReload},
+  {"mult-pow2", MultPow2},
+  {"add-immediate", AddImmediate},
+  {"store-reload", StoreReload},
+  {"no-op", NoOp},
+  {"merge-sp", MergeSp},
+  {"dead-write", DeadWrite},
+  {"forward-move", ForwardMove},
+  {"move-use", MoveUse},
+  {"jump-to-next", JumpToNext},
+  {"unreachable", Unreachable},
+};
+
+#define NUM_RULES (sizeof(rules) / sizeof(rules[0]))
+
+static thread_local long rule_hits[NUM_RULES];
+
+void Peephole(InstrStream *s, int window){
+  vector<Instr> &code = s->instrs;
+  vector<Instr> out;
+
+  for(int pass = 0; pass < MAX_PEEPHOLE_PASSES; pass++){
+    bool changed = false;
+    out.clear();
+    out.reserve(code.size());
+    for(int i = 0; i<code.size(); ){
+      Window w;
+      w.in = &code[i];
+      w.avail = code.size() - i;
+      if(w.avail > window)
+        w.avail = window;
+      int used = 0;
+      for(int r = 0; r<NUM_RULES && used == 0; r++){
+        used = rules[r].apply(w, out);
+        if(used){
+          rule_hits[r]++;
+          changed = true;
+        }
+      }
+      if(used == 0){
+        out.push_back(code[i]);
+        used = 1;
+      }
+      i += used;
+    }
+    code.swap(out);
+    if(!changed)
+      break;
+  }
+}
+
+void PrintPeepholeStats(FILE *f){
+  for(int r = 0; r<NUM_RULES; r++){
+    fprintf(f, "peephole: %-14s %ld\n", rules[r].name, rule_hits[r]);
+    rule_hits[r] = 0;
+  }
+}
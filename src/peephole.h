@@ -0,0 +1,17 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "instr.h"
+#include <stdio.h>
+
+#define DEFAULT_PEEPHOLE_WINDOW 32
+
+// Rewrites redundant sequences in the stream until no rule fires. A rule
+// may look at most `window` instructions ahead, including the lookahead
+// it needs to prove a register dead.
+void Peephole(InstrStream *, int window);
+
+// Hit count of every rule since the last report on this thread
+void PrintPeepholeStats(FILE *);
+
+#endif
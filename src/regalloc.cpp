@@ -0,0 +1,257 @@
+#include "regalloc.h"
+#include "instr.h"
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+// Caller-saved registers the code generator never touches itself
+static const int temp_regs[] = {R_T4, R_T5, R_T6, R_T7, R_T8, R_T9};
+static const int saved_regs[] = {R_S0, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7};
+
+#define LOOP_WEIGHT 10
+#define MAX_LOOP_WEIGHT 10000
+
+// Numbers every use and definition in the order Emit() produces them and
+// records loop extents and call sites on the way
+class LivenessWalker{
+public:
+  map<Identifier *, LiveInterval> intervals;
+  vector<pair<int, int> > loops;
+  vector<int> calls;
+  int pos;
+  int loop_weight;
+
+  LivenessWalker() {pos = 0; loop_weight = 1;}
+
+  void Occurrence(Identifier *id){
+    if(id == NULL || id->is_array || id->is_global)
+      return;
+    pos++;
+    map<Identifier *, LiveInterval>::iterator i = intervals.find(id);
+    if(i == intervals.end()){
+      LiveInterval li;
+      li.id = id;
+      li.start = li.end = li.first = pos;
+      li.weight = loop_weight;
+      li.crosses_call = false;
+      li.is_param = false;
+      li.reg = -1;
+      intervals[id] = li;
+    }
+    else{
+      i->second.end = pos;
+      i->second.weight += loop_weight;
+    }
+  }
+
+  void WalkExpr(Expression *e){
+    if(e == NULL)
+      return;
+    if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->is_array){
+        for(int i = 0; i<a->access_list->size(); i++)
+          WalkExpr((*a->access_list)[i]);
+        WalkExpr(a->base_offset);
+      }
+      else
+        Occurrence(a->id);
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = c->args->size() - 1; i>=0; i--)
+        WalkExpr((*c->args)[i]);
+      calls.push_back(++pos);
+    }
+    else if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      if(o->op->op == AND_OP || o->op->op == OR_OP){
+        // && and || evaluate their left operand first
+        WalkExpr(o->lhs);
+        WalkExpr(o->rhs);
+        return;
+      }
+      WalkExpr(o->rhs);
+      if(o->op->op == ASSIGN){
+        // The store happens after the subscripts are evaluated
+        Access *a = As<Access>(o->lhs);
+        WalkExpr(a);
+      }
+      else
+        WalkExpr(o->lhs);
+    }
+  }
+
+  void WalkStmt(Statement *s){
+    if(s == NULL)
+      return;
+    if(Is<ExprStatement>(s)){
+      WalkExpr(As<ExprStatement>(s)->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      WalkExpr(sel->test);
+      WalkStmt(sel->body_true);
+      WalkStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR)
+        WalkStmt(it->init);
+      int start = ++pos;
+      int outer_weight = loop_weight;
+      if(loop_weight < MAX_LOOP_WEIGHT)
+        loop_weight *= LOOP_WEIGHT;
+      if(it->loop_type == FOR)
+        WalkStmt(it->cond);
+      else
+        WalkExpr(it->expr);
+      WalkStmt(it->body);
+      if(it->loop_type == FOR)
+        WalkExpr(it->expr);
+      loop_weight = outer_weight;
+      loops.push_back(make_pair(start, ++pos));
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        WalkStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      WalkExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+};
+
+// Ranges stretched over the same loop start together; the first
+// occurrence breaks the tie so the order never depends on where the
+// identifiers happen to be allocated
+static bool ByStart(const LiveInterval *a, const LiveInterval *b){
+  if(a->start != b->start)
+    return a->start < b->start;
+  return a->first < b->first;
+}
+
+// Every access in a register turns a load or store into a move. A saved
+// register costs a store and a load around the body and a parameter has
+// to be loaded from the caller's push once; those are extra instructions
+// on every call, so the accesses must outweigh them by a wide margin
+// (branches mean not every static use runs).
+static bool WorthRegister(LiveInterval *li, int reg, FuncDecl *fd){
+  int cost = 0;
+  if(li->is_param)
+    cost += 1;
+  if(reg >= R_S0 && reg <= R_S7 && fd->name != "main")
+    cost += 2;
+  return li->weight > 2 * cost;
+}
+
+void AllocateRegisters(FuncDecl *fd){
+  LivenessWalker w;
+
+  // Parameters are defined on entry
+  for(int i = 0; i<fd->param_list->size(); i++){
+    w.Occurrence((*fd->param_list)[i]);
+    w.intervals[(*fd->param_list)[i]].start = 0;
+    w.intervals[(*fd->param_list)[i]].is_param = true;
+    w.intervals[(*fd->param_list)[i]].weight = 0;
+  }
+  w.WalkStmt(fd->stmt_block);
+
+  vector<LiveInterval *> order;
+  for(map<Identifier *, LiveInterval>::iterator i = w.intervals.begin();
+      i != w.intervals.end(); ++i)
+  {
+    LiveInterval &li = i->second;
+    // A value that is live anywhere in a loop may be needed again on the
+    // next trip round the back edge: keep it for the whole loop
+    bool changed = true;
+    while(changed){
+      changed = false;
+      for(int j = 0; j<w.loops.size(); j++){
+        int ls = w.loops[j].first, le = w.loops[j].second;
+        if(li.start <= le && li.end >= ls &&
+           (li.start > ls || li.end < le)){
+          li.start = min(li.start, ls);
+          li.end = max(li.end, le);
+          changed = true;
+        }
+      }
+    }
+    for(int j = 0; j<w.calls.size(); j++){
+      if(w.calls[j] > li.start && w.calls[j] < li.end)
+        li.crosses_call = true;
+    }
+    order.push_back(&li);
+  }
+  sort(order.begin(), order.end(), ByStart);
+
+  bool in_use[NUM_REGS] = {false};
+  bool saved_used[NUM_REGS] = {false};
+  vector<LiveInterval *> active;
+
+  for(int n = 0; n<order.size(); n++){
+    LiveInterval *cur = order[n];
+
+    // Expire ranges that ended before this one starts
+    for(int i = 0; i<active.size(); ){
+      if(active[i]->end < cur->start){
+        in_use[active[i]->reg] = false;
+        active.erase(active.begin() + i);
+      }
+      else
+        i++;
+    }
+
+    // Ranges without calls prefer the scratch registers, which cost no
+    // save/restore; anything live across a jal needs a saved register
+    int reg = -1;
+    if(!cur->crosses_call){
+      for(int i = 0; i<sizeof(temp_regs)/sizeof(int) && reg < 0; i++)
+        if(!in_use[temp_regs[i]])
+          reg = temp_regs[i];
+    }
+    for(int i = 0; i<sizeof(saved_regs)/sizeof(int) && reg < 0; i++)
+      if(!in_use[saved_regs[i]])
+        reg = saved_regs[i];
+
+    if(reg >= 0 && !WorthRegister(cur, reg, fd))
+      continue;
+    if(reg < 0){
+      // Under pressure spill whichever usable range ends last
+      LiveInterval *victim = NULL;
+      for(int i = 0; i<active.size(); i++){
+        if(cur->crosses_call && active[i]->reg < R_S0)
+          continue;
+        if(victim == NULL || active[i]->end > victim->end)
+          victim = active[i];
+      }
+      if(victim == NULL || victim->end <= cur->end)
+        continue;
+      reg = victim->reg;
+      victim->reg = -1;
+      active.erase(find(active.begin(), active.end(), victim));
+    }
+
+    cur->reg = reg;
+    in_use[reg] = true;
+    if(reg >= R_S0 && reg <= R_S7)
+      saved_used[reg] = true;
+    active.push_back(cur);
+  }
+
+  for(map<Identifier *, LiveInterval>::iterator i = w.intervals.begin();
+      i != w.intervals.end(); ++i)
+  {
+    i->second.id->reg = i->second.reg;
+  }
+
+  // main never returns to a caller, so there is nothing to preserve
+  fd->saved_regs.clear();
+  if(fd->name != "main"){
+    for(int r = R_S0; r <= R_S7; r++)
+      if(saved_used[r])
+        fd->saved_regs.push_back(r);
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ast.h"
+#include <vector>
+
+using namespace std;
+
+// Live range of one scalar local or parameter over the linear order in
+// which the function body is emitted
+struct LiveInterval{
+  Identifier *id;
+  int start, end;
+  int first;            // position of the first occurrence, unique
+  int weight;           // uses and definitions, scaled by loop nesting
+  bool crosses_call;
+  bool is_param;
+  int reg;
+};
+
+// Linear-scan allocation of scalar locals and parameters to $t4-$t9
+// (ranges without calls) and $s0-$s7 (saved in the prologue). Sets
+// Identifier::reg and FuncDecl::saved_regs; spilled scalars keep their
+// stack slot.
+void AllocateRegisters(FuncDecl *);
+
+#endif
@@ -0,0 +1,208 @@
+#include "compiler.h"
+#include "options.h"
+#include "simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define SIM_LIMIT 100000000L
+
+// What compiling and running one test gave, as a line of the baseline:
+//   name exit E globals H instructions N cycles C
+//   name errors N
+//   name sim-error
+struct Outcome{
+  string name;
+  int errors;           // diagnostics of a program that did not compile
+  bool ran;
+  int exit_code;
+  unsigned globals;
+  long instructions;
+  long cycles;
+};
+
+static string Format(const Outcome &o){
+  char buf[256];
+  if(o.errors)
+    snprintf(buf, sizeof(buf), "%s errors %d", o.name.c_str(), o.errors);
+  else if(!o.ran)
+    snprintf(buf, sizeof(buf), "%s sim-error", o.name.c_str());
+  else
+    snprintf(buf, sizeof(buf), "%s exit %d globals %08x instructions %ld cycles %ld",
+             o.name.c_str(), o.exit_code, o.globals, o.instructions, o.cycles);
+  return buf;
+}
+
+static bool Parse(const char *line, Outcome &o){
+  char name[200];
+  o.errors = 0;
+  o.ran = true;
+  if(sscanf(line, "%199s exit %d globals %x instructions %ld cycles %ld", name,
+            &o.exit_code, &o.globals, &o.instructions, &o.cycles) == 5);
+  else if(sscanf(line, "%199s errors %d", name, &o.errors) == 2)
+    o.ran = false;
+  else if(sscanf(line, "%199s", name) == 1 && strstr(line, " sim-error"))
+    o.ran = false;
+  else
+    return false;
+  o.name = name;
+  return true;
+}
+
+static bool ReadFile(const char *file, string &s){
+  FILE *f = fopen(file, "r");
+  if(f == NULL)
+    return false;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    s.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static Outcome Measure(const char *file, const string &source, const Options &opts){
+  Outcome o;
+  const char *slash = strrchr(file, '/');
+  o.name = slash ? slash + 1 : file;
+  o.ran = false;
+  o.exit_code = 0;
+  o.globals = 0;
+  o.instructions = o.cycles = 0;
+
+  CompileResult c = CompileSource(source.data(), source.size(), opts);
+  o.errors = c.ok ? 0 : c.diagnostics.size() > 0 ? c.diagnostics.size() : 1;
+  if(!c.ok)
+    return o;
+  SimResult r = Simulate(c.assembly, SIM_LIMIT);
+  if(!r.ok){
+    fprintf(stderr, "%s: %s\n", o.name.c_str(), r.error.c_str());
+    return o;
+  }
+  o.ran = true;
+  o.exit_code = r.exit_code;
+  o.globals = GlobalsHash(r);
+  o.instructions = r.instructions;
+  o.cycles = r.cycles;
+  return o;
+}
+
+static double Change(long before, long after){
+  return before ? 100.0 * (after - before) / before : 0;
+}
+
+// Prints how the test compares with the baseline; false for a wrong
+// result or for more instructions or cycles than tolerance percent allows
+static bool Compare(const Outcome &now, const Outcome &base, double tolerance){
+  const char *name = now.name.c_str();
+  if(now.errors != base.errors || now.ran != base.ran ||
+     (now.ran && (now.exit_code != base.exit_code || now.globals != base.globals))){
+    printf("FAILED    %-22s was: %s\n", name, Format(base).c_str());
+    printf("          %-22s now: %s\n", "", Format(now).c_str());
+    return false;
+  }
+  if(!now.ran){
+    printf("ok        %s\n", name);
+    return true;
+  }
+  double instrs = Change(base.instructions, now.instructions);
+  double cycles = Change(base.cycles, now.cycles);
+  const char *verdict = "ok";
+  if(instrs > tolerance || cycles > tolerance)
+    verdict = "REGRESSED";
+  else if(instrs < 0 || cycles < 0)
+    verdict = "improved";
+  printf("%-9s %-22s %9ld instructions (%+.1f%%) %9ld cycles (%+.1f%%)\n", verdict, name,
+         now.instructions, instrs, now.cycles, cycles);
+  return verdict[0] != 'R';
+}
+
+static void RegressUsage(const char *prog){
+  fprintf(stderr, "usage: %s -baseline=FILE [-update] [-tolerance=PCT] [compiler options] file.c...\n", prog);
+  fprintf(stderr, "  -baseline=FILE  expected results, instruction and cycle counts\n");
+  fprintf(stderr, "  -update         write the results to the baseline instead\n");
+  fprintf(stderr, "  -tolerance=PCT  growth of a count that is not a regression (default 0)\n");
+}
+
+int main(int argc, char **argv){
+  const char *baseline = NULL;
+  bool update = false;
+  double tolerance = 0;
+  // The rest are the compiler's own options, and the tests
+  vector<char *> args;
+  args.push_back(argv[0]);
+  for(int i = 1; i<argc; i++){
+    if(strncmp(argv[i], "-baseline=", 10) == 0)
+      baseline = argv[i] + 10;
+    else if(strcmp(argv[i], "-update") == 0)
+      update = true;
+    else if(strncmp(argv[i], "-tolerance=", 11) == 0)
+      tolerance = atof(argv[i] + 11);
+    else
+      args.push_back(argv[i]);
+  }
+  if(baseline == NULL || !ParseOptions(args.size(), &args[0]) || options.files.empty()){
+    RegressUsage(argv[0]);
+    return 2;
+  }
+  Options opts = options;
+  vector<const char *> files = opts.files;
+  opts.files.clear();
+
+  map<string, Outcome> expected;
+  string text;
+  if(ReadFile(baseline, text)){
+    for(size_t pos = 0; pos < text.size(); ){
+      size_t end = text.find('\n', pos);
+      if(end == string::npos)
+        end = text.size();
+      Outcome o;
+      if(Parse(text.substr(pos, end - pos).c_str(), o))
+        expected[o.name] = o;
+      pos = end + 1;
+    }
+  }
+  else if(!update){
+    fprintf(stderr, "%s: can't read %s (make it with -update)\n", argv[0], baseline);
+    return 2;
+  }
+
+  string results;
+  int failed = 0;
+  for(int i = 0; i<files.size(); i++){
+    string source;
+    if(!ReadFile(files[i], source)){
+      fprintf(stderr, "%s: can't open %s\n", argv[0], files[i]);
+      failed++;
+      continue;
+    }
+    Outcome now = Measure(files[i], source, opts);
+    results += Format(now) + "\n";
+    if(update)
+      continue;
+    map<string, Outcome>::iterator base = expected.find(now.name);
+    if(base == expected.end())
+      printf("new       %s\n", Format(now).c_str());
+    else if(!Compare(now, base->second, tolerance))
+      failed++;
+  }
+
+  if(update){
+    FILE *f = fopen(baseline, "w");
+    if(f == NULL){
+      fprintf(stderr, "%s: can't write %s\n", argv[0], baseline);
+      return 2;
+    }
+    fputs(results.c_str(), f);
+    fclose(f);
+    printf("wrote %d results to %s\n", (int) files.size(), baseline);
+    return 0;
+  }
+  printf("%d of %d tests failed or regressed\n", failed, (int) files.size());
+  return failed > 0;
+}
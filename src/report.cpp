@@ -0,0 +1,264 @@
+#include "report.h"
+#include "symbols.h"
+#include <malloc.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace std::chrono;
+
+thread_local CompileStats *stats;
+
+static const char *PhaseNames[] = {
+  "lex", "parse", "check", "generate",
+  "optimize", "regalloc", "offsets", "emit",
+  "peephole", "output"};
+
+// Order of the report, nested phases after the one they run in
+static const Phase report_order[] = {
+  PH_PARSE, PH_LEX, PH_CHECK, PH_GENERATE,
+  PH_OPTIMIZE, PH_REGALLOC, PH_OFFSETS, PH_EMIT,
+  PH_PEEPHOLE, PH_OUTPUT};
+
+static const char *KindNames[] = {
+  "none", "identifier", "func_decl",
+  "expr_stmt", "sel_stmt", "iter_stmt", "stmt_block", "return_stmt",
+  "operator", "access", "call", "op_expr",
+  "int_const", "string_const", "bool_const", "double_const"};
+
+static bool Nested(Phase p){
+  return p == PH_LEX || (p >= PH_OPTIMIZE && p <= PH_EMIT);
+}
+
+static long HeapInUse(){
+  struct mallinfo2 m = mallinfo2();
+  return m.uordblks + m.hblkhd;
+}
+
+static long PeakRss(){
+  struct rusage u;
+  getrusage(RUSAGE_SELF, &u);
+  return u.ru_maxrss;
+}
+
+CompileStats::CompileStats(){
+  for(int p = 0; p<NUM_PHASES; p++){
+    secs[p] = 0;
+    heap[p] = peak_rss[p] = 0;
+  }
+  for(int k = 0; k<NUM_NODE_KINDS; k++)
+    nodes[k] = 0;
+  for(int op = 0; op<I_LABEL; op++)
+    instrs[op] = 0;
+  total_secs = 0;
+  tokens = symbols = labels = 0;
+  parse_heap = 0;
+  parsing = false;
+}
+
+void CompileStats::AddTimes(const CompileStats &other){
+  for(int p = 0; p<NUM_PHASES; p++)
+    secs[p] += other.secs[p];
+}
+
+void CompileStats::StartParse(){
+  parsing = true;
+  parse_heap = HeapInUse();
+  parse_start = steady_clock::now();
+}
+
+void CompileStats::EndParse(){
+  if(!parsing)
+    return;
+  parsing = false;
+  // Tokens were timed on their own
+  secs[PH_PARSE] = duration<double>(steady_clock::now() - parse_start).count() - secs[PH_LEX];
+  heap[PH_PARSE] = HeapInUse() - parse_heap;
+  peak_rss[PH_PARSE] = PeakRss();
+}
+
+PhaseTimer::PhaseTimer(Phase phase){
+  this->phase = phase;
+  if(stats == NULL)
+    return;
+  start_heap = Nested(phase) ? 0 : HeapInUse();
+  start = steady_clock::now();
+}
+
+PhaseTimer::~PhaseTimer(){
+  if(stats == NULL)
+    return;
+  stats->secs[phase] += duration<double>(steady_clock::now() - start).count();
+  if(!Nested(phase)){
+    stats->heap[phase] += HeapInUse() - start_heap;
+    stats->peak_rss[phase] = PeakRss();
+  }
+}
+
+// Walks the tree under every declaration, counting nodes by kind
+class NodeCounter{
+public:
+  int *nodes;
+
+  NodeCounter(int *nodes) {this->nodes = nodes;}
+
+  void Count(Ast *n){
+    if(n)
+      nodes[n->kind]++;
+  }
+
+  void CountExpr(Expression *e){
+    if(e == NULL)
+      return;
+    Count(e);
+    if(Is<OpExpression>(e)){
+      OpExpression *o = As<OpExpression>(e);
+      Count(o->op);
+      CountExpr(o->lhs);
+      CountExpr(o->rhs);
+    }
+    else if(Is<Access>(e)){
+      Access *a = As<Access>(e);
+      if(a->access_list){
+        for(int i = 0; i<a->access_list->size(); i++)
+          CountExpr((*a->access_list)[i]);
+      }
+      CountExpr(a->base_offset);
+    }
+    else if(Is<Call>(e)){
+      Call *c = As<Call>(e);
+      for(int i = 0; i<c->args->size(); i++)
+        CountExpr((*c->args)[i]);
+    }
+  }
+
+  void CountStmt(Statement *s){
+    if(s == NULL)
+      return;
+    Count(s);
+    if(Is<ExprStatement>(s)){
+      CountExpr(As<ExprStatement>(s)->expr);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      CountExpr(sel->test);
+      CountStmt(sel->body_true);
+      CountStmt(sel->body_false);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR){
+        CountStmt(it->init);
+        CountStmt(it->cond);
+      }
+      CountExpr(it->expr);
+      CountStmt(it->body);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(map<string, Identifier *>::iterator i = sb->symbol_table->begin();
+          i != sb->symbol_table->end(); ++i)
+        CountDecl(i->second);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        CountStmt((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      CountExpr(As<ReturnStatement>(s)->expr);
+    }
+  }
+
+  void CountDecl(Declaration *d){
+    Count(d);
+    if(Is<Identifier>(d)){
+      Identifier *id = As<Identifier>(d);
+      if(id->is_array){
+        for(int i = 0; i<id->dim_list->size(); i++)
+          Count((*id->dim_list)[i]);
+      }
+    }
+    else if(Is<FuncDecl>(d)){
+      FuncDecl *fd = As<FuncDecl>(d);
+      for(int i = 0; i<fd->param_list->size(); i++)
+        CountDecl((*fd->param_list)[i]);
+      CountStmt(fd->stmt_block);
+    }
+  }
+};
+
+void CountNodes(){
+  if(stats == NULL)
+    return;
+  NodeCounter counter(stats->nodes);
+  for(map<string, Declaration *>::iterator i = global_sym_table->begin();
+      i != global_sym_table->end(); ++i)
+    counter.CountDecl(i->second);
+  stats->symbols = symbols->NumSymbols();
+}
+
+void CountCode(InstrStream *s){
+  if(stats == NULL)
+    return;
+  stats->labels = s->NumNewLabels();
+  for(int i = 0; i<s->instrs.size(); i++){
+    if(s->instrs[i].op < I_LABEL)
+      stats->instrs[s->instrs[i].op]++;
+  }
+}
+
+static void PrintText(const CompileStats &s, FILE *out){
+  fprintf(out, "time report:\n");
+  fprintf(out, "  %-12s %10s %10s %12s\n", "phase", "wall ms", "heap KB", "peak RSS KB");
+  for(int i = 0; i<NUM_PHASES; i++){
+    Phase p = report_order[i];
+    if(Nested(p))
+      fprintf(out, "    %-10s %10.3f\n", PhaseNames[p], s.secs[p] * 1000);
+    else
+      fprintf(out, "  %-12s %10.3f %10ld %12ld\n", PhaseNames[p], s.secs[p] * 1000,
+              s.heap[p] / 1024, s.peak_rss[p]);
+  }
+  fprintf(out, "  %-12s %10.3f\n", "total", s.total_secs * 1000);
+
+  int num_nodes = 0, num_instrs = 0;
+  for(int k = 1; k<NUM_NODE_KINDS; k++)
+    num_nodes += s.nodes[k];
+  for(int op = 0; op<I_LABEL; op++)
+    num_instrs += s.instrs[op];
+  fprintf(out, "counts: %d tokens, %d symbols, %d labels\n", s.tokens, s.symbols, s.labels);
+  fprintf(out, "  nodes %d:", num_nodes);
+  for(int k = 1; k<NUM_NODE_KINDS; k++){
+    if(s.nodes[k])
+      fprintf(out, " %s %d", KindNames[k], s.nodes[k]);
+  }
+  fprintf(out, "\n  instructions %d:", num_instrs);
+  for(int op = 0; op<I_LABEL; op++){
+    if(s.instrs[op])
+      fprintf(out, " %s %d", OpNames[op], s.instrs[op]);
+  }
+  fprintf(out, "\n");
+}
+
+// Every key is always there, so that reports can be compared over time
+static void PrintJson(const CompileStats &s, FILE *out){
+  fprintf(out, "{\"phases\": {");
+  for(int i = 0; i<NUM_PHASES; i++){
+    Phase p = report_order[i];
+    fprintf(out, "%s\"%s\": {\"ms\": %.3f", i ? ", " : "", PhaseNames[p], s.secs[p] * 1000);
+    if(!Nested(p))
+      fprintf(out, ", \"heap_bytes\": %ld, \"peak_rss_kb\": %ld", s.heap[p], s.peak_rss[p]);
+    fprintf(out, "}");
+  }
+  fprintf(out, "}, \"total_ms\": %.3f, \"tokens\": %d, \"symbols\": %d, \"labels\": %d, \"nodes\": {",
+          s.total_secs * 1000, s.tokens, s.symbols, s.labels);
+  for(int k = 1; k<NUM_NODE_KINDS; k++)
+    fprintf(out, "%s\"%s\": %d", k > 1 ? ", " : "", KindNames[k], s.nodes[k]);
+  fprintf(out, "}, \"instructions\": {");
+  for(int op = 0; op<I_LABEL; op++)
+    fprintf(out, "%s\"%s\": %d", op ? ", " : "", OpNames[op], s.instrs[op]);
+  fprintf(out, "}}\n");
+}
+
+void PrintReport(const CompileStats &s, FILE *out, bool json){
+  if(json)
+    PrintJson(s, out);
+  else
+    PrintText(s, out);
+}
@@ -0,0 +1,73 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "ast.h"
+#include "instr.h"
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+// Phases -time-report accounts for. lex runs inside parse, and the
+// per-function phases inside generate; those add up the time of every
+// thread and have no memory figures of their own.
+enum Phase {
+  PH_LEX, PH_PARSE, PH_CHECK, PH_GENERATE,
+  PH_OPTIMIZE, PH_REGALLOC, PH_OFFSETS, PH_EMIT,
+  PH_PEEPHOLE, PH_OUTPUT,
+  NUM_PHASES
+};
+
+// What -time-report collects about one compilation
+struct CompileStats{
+  double secs[NUM_PHASES];
+  long heap[NUM_PHASES];        // bytes of heap the phase left allocated
+  long peak_rss[NUM_PHASES];    // KB, process high-water mark when it ended
+  double total_secs;
+  int nodes[NUM_NODE_KINDS];    // as parsed, before any optimization
+  int tokens;
+  int symbols;
+  int labels;                   // made by NewLabel(), generated code only
+  int instrs[I_LABEL];          // by opcode, after the peephole pass
+
+  CompileStats();
+  // Adds the per-function phase times of a task
+  void AddTimes(const CompileStats &other);
+
+  // Parsing ends inside yyparse(), when the action for the whole program
+  // starts, or when yyparse() gives up. EndParse() after the first call
+  // does nothing.
+  void StartParse();
+  void EndParse();
+
+private:
+  chrono::steady_clock::time_point parse_start;
+  long parse_heap;
+  bool parsing;
+};
+
+// Statistics of the compilation on this thread, NULL unless asked for
+extern thread_local CompileStats *stats;
+
+// Charges the time until it goes out of scope to a phase, and for the
+// top-level phases the memory too. Does nothing without stats.
+class PhaseTimer{
+public:
+  PhaseTimer(Phase phase);
+  ~PhaseTimer();
+
+private:
+  Phase phase;
+  chrono::steady_clock::time_point start;
+  long start_heap;
+};
+
+// Node counts of the parsed program, and the symbols it interned
+void CountNodes();
+// Labels and instructions by opcode of the finished stream
+void CountCode(InstrStream *s);
+// The report as text or as one line of JSON
+void PrintReport(const CompileStats &s, FILE *out, bool json);
+
+#endif
@@ -0,0 +1,45 @@
+#include "simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+#define DEFAULT_LIMIT 100000000L
+
+static void Usage(const char *prog){
+  fprintf(stderr, "usage: %s [-limit=N] [file.s]    (standard input without a file)\n", prog);
+  fprintf(stderr, "  -limit=N   stop after N instructions (default %ld, 0: no limit)\n", DEFAULT_LIMIT);
+}
+
+int main(int argc, char **argv){
+  long limit = DEFAULT_LIMIT;
+  const char *file = NULL;
+  for(int i = 1; i<argc; i++){
+    if(strncmp(argv[i], "-limit=", 7) == 0 && atol(argv[i] + 7) >= 0)
+      limit = atol(argv[i] + 7);
+    else if(argv[i][0] != '-' && file == NULL)
+      file = argv[i];
+    else{
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+
+  FILE *in = file ? fopen(file, "r") : stdin;
+  if(in == NULL){
+    fprintf(stderr, "%s: can't open %s\n", argv[0], file);
+    return 2;
+  }
+  string assembly;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    assembly.append(buf, n);
+  if(file)
+    fclose(in);
+
+  SimResult r = Simulate(assembly, limit);
+  PrintSimResult(r, stdout);
+  return r.ok ? 0 : 1;
+}
@@ -0,0 +1,451 @@
+#include "simulator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+using namespace std;
+
+#define DATA_BASE 0x10010000u
+#define STACK_TOP 0x7ffff000u
+#define STACK_WORDS (1 << 21)
+
+// The cycle estimate is that of a simple in-order pipeline without delay
+// slots: one cycle per instruction, one more when an instruction uses
+// what the lw just before it loads, one more for a taken branch or a
+// jump, and mflo/mfhi wait until the product or quotient is there.
+#define LOAD_USE_STALL 1
+#define TAKEN_PENALTY 1
+#define MULT_LATENCY 4
+#define DIV_LATENCY 35
+
+class Machine{
+public:
+  SimResult r;
+
+  Machine() {r.ok = true; line = 0;}
+
+  bool Assemble(const string &assembly);
+  void Run(long limit);
+
+private:
+  vector<Instr> text;
+  vector<string> refs;          // label each instruction names, if any
+  map<string, int> code_labels;
+  map<string, unsigned> data_labels;
+  vector<unsigned> global_starts;
+  vector<int> data;
+  vector<int> stack;
+  int line;
+
+  bool Error(const string &what){
+    if(r.ok){
+      r.ok = false;
+      r.error = line ? "line " + to_string(line) + ": " + what : what;
+    }
+    return false;
+  }
+
+  static int Register(const string &tok){
+    if(tok.size() < 2 || tok[0] != '$')
+      return R_NONE;
+    const char *name = tok.c_str() + 1;
+    if(name[0] >= '0' && name[0] <= '9'){
+      int n = atoi(name);
+      return n < NUM_REGS ? n : R_NONE;
+    }
+    for(int i = 0; i<NUM_REGS; i++){
+      if(strcmp(name, RegNames[i]) == 0)
+        return i;
+    }
+    return R_NONE;
+  }
+
+  bool Reg(const string &tok, signed char &reg){
+    reg = Register(tok);
+    return reg != R_NONE || Error("bad register " + tok);
+  }
+
+  bool Imm(const string &tok, int &imm){
+    char *end;
+    imm = strtol(tok.c_str(), &end, 0);
+    return (!tok.empty() && *end == 0) || Error("bad number " + tok);
+  }
+
+  // imm($reg), label, label+imm or label-imm
+  bool Address(const string &tok, Instr &i, string &ref){
+    size_t paren = tok.find('(');
+    if(paren != string::npos && tok[tok.size() - 1] == ')'){
+      i.label = NO_LABEL;
+      return (paren == 0 ? (i.imm = 0, true) : Imm(tok.substr(0, paren), i.imm)) &&
+             Reg(tok.substr(paren + 1, tok.size() - paren - 2), i.rs);
+    }
+    size_t sign = tok.find_first_of("+-");
+    ref = tok.substr(0, sign);
+    i.imm = 0;
+    return sign == string::npos || Imm(tok.substr(sign), i.imm);
+  }
+
+  bool Instruction(const vector<string> &toks);
+  bool Resolve();
+
+  int *Word(unsigned addr){
+    if(addr % 4 == 0){
+      if(addr >= DATA_BASE && addr - DATA_BASE < 4 * data.size())
+        return &data[(addr - DATA_BASE) / 4];
+      if(addr < STACK_TOP && STACK_TOP - addr <= 4u * STACK_WORDS)
+        return &stack[STACK_WORDS - (STACK_TOP - addr) / 4];
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "bad address 0x%x", addr);
+    Error(buf);
+    return NULL;
+  }
+};
+
+bool Machine::Instruction(const vector<string> &toks){
+  int op;
+  for(op = 0; op<I_LABEL; op++){
+    if(toks[0] == OpNames[op])
+      break;
+  }
+  if(op == I_LABEL)
+    return Error("unknown instruction " + toks[0]);
+
+  Instr i = {(unsigned char) op, R_NONE, R_NONE, R_NONE, 0, NO_LABEL};
+  string ref;
+  int n = toks.size() - 1;
+  bool ok;
+  switch(op){
+  case I_LI:
+    ok = n == 2 && Reg(toks[1], i.rd) && Imm(toks[2], i.imm);
+    break;
+  case I_LA:
+    ok = n == 2 && Reg(toks[1], i.rd) && Address(toks[2], i, ref) && !ref.empty();
+    break;
+  case I_LW:
+  case I_SW:
+    ok = n == 2 && Reg(toks[1], i.rd) && Address(toks[2], i, ref);
+    break;
+  case I_ADDIU:
+  case I_XORI:
+  case I_SLL:
+    ok = n == 3 && Reg(toks[1], i.rd) && Reg(toks[2], i.rs) && Imm(toks[3], i.imm);
+    break;
+  case I_MULT:
+  case I_DIV:
+    ok = n == 2 && Reg(toks[1], i.rs) && Reg(toks[2], i.rt);
+    break;
+  case I_MFLO:
+  case I_MFHI:
+    ok = n == 1 && Reg(toks[1], i.rd);
+    break;
+  case I_MOVE:
+    ok = n == 2 && Reg(toks[1], i.rd) && Reg(toks[2], i.rs);
+    break;
+  case I_BEQ:
+  case I_BNE:
+  case I_BLT:
+  case I_BGE:
+    ok = n == 3 && Reg(toks[1], i.rs) && Reg(toks[2], i.rt);
+    ref = n == 3 ? toks[3] : "";
+    break;
+  case I_J:
+  case I_JAL:
+    ok = n == 1;
+    ref = n == 1 ? toks[1] : "";
+    break;
+  case I_JR:
+    ok = n == 1 && Reg(toks[1], i.rs);
+    break;
+  case I_SYSCALL:
+    ok = n == 0;
+    break;
+  default:
+    ok = n == 3 && Reg(toks[1], i.rd) && Reg(toks[2], i.rs) && Reg(toks[3], i.rt);
+  }
+  if(!ok)
+    return Error("bad operands for " + toks[0]);
+  text.push_back(i);
+  refs.push_back(ref);
+  return true;
+}
+
+bool Machine::Assemble(const string &assembly){
+  bool in_data = false;
+  size_t pos = 0;
+  while(pos < assembly.size()){
+    size_t end = assembly.find('\n', pos);
+    if(end == string::npos)
+      end = assembly.size();
+    string s = assembly.substr(pos, end - pos);
+    pos = end + 1;
+    line++;
+
+    s = s.substr(0, s.find('#'));
+    for(int k = 0; k<s.size(); k++){
+      if(s[k] == ',' || s[k] == '\t')
+        s[k] = ' ';
+    }
+    vector<string> toks;
+    for(size_t k = 0; k<s.size(); ){
+      size_t next = s.find(' ', k);
+      if(next == string::npos)
+        next = s.size();
+      if(next > k)
+        toks.push_back(s.substr(k, next - k));
+      k = next + 1;
+    }
+
+    while(!toks.empty() && toks[0][toks[0].size() - 1] == ':'){
+      string name = toks[0].substr(0, toks[0].size() - 1);
+      if(in_data){
+        data_labels[name] = DATA_BASE + 4 * data.size();
+        global_starts.push_back(data.size());
+        SimGlobal g;
+        g.name = name;
+        r.globals.push_back(g);
+      }
+      else
+        code_labels[name] = text.size();
+      toks.erase(toks.begin());
+    }
+    if(toks.empty())
+      continue;
+
+    if(toks[0] == ".data")
+      in_data = true;
+    else if(toks[0] == ".text")
+      in_data = false;
+    else if(toks[0] == ".align" || toks[0] == ".globl")
+      continue;
+    else if(toks[0] == ".word"){
+      // v:n is v repeated n times
+      for(int k = 1; k<toks.size(); k++){
+        size_t colon = toks[k].find(':');
+        int v, times = 1;
+        if(!Imm(toks[k].substr(0, colon), v) ||
+           (colon != string::npos && !Imm(toks[k].substr(colon + 1), times)))
+          return false;
+        data.insert(data.end(), times, v);
+      }
+    }
+    else if(toks[0] == ".space"){
+      int bytes;
+      if(toks.size() != 2 || !Imm(toks[1], bytes))
+        return Error("bad .space");
+      data.insert(data.end(), (bytes + 3) / 4, 0);
+    }
+    else if(toks[0][0] == '.')
+      return Error("unknown directive " + toks[0]);
+    else if(in_data)
+      return Error("instruction in .data");
+    else if(!Instruction(toks))
+      return false;
+  }
+  line = 0;
+  return Resolve();
+}
+
+// Branches get the index of their target, la/lw/sw the address of theirs
+bool Machine::Resolve(){
+  for(int k = 0; k<text.size(); k++){
+    if(refs[k].empty())
+      continue;
+    Instr &i = text[k];
+    if(i.op == I_BEQ || i.op == I_BNE || i.op == I_BLT || i.op == I_BGE || i.op == I_J ||
+       i.op == I_JAL){
+      map<string, int>::iterator l = code_labels.find(refs[k]);
+      if(l == code_labels.end())
+        return Error("undefined label " + refs[k]);
+      i.label = l->second;
+    }
+    else{
+      map<string, unsigned>::iterator l = data_labels.find(refs[k]);
+      if(l == data_labels.end())
+        return Error("undefined label " + refs[k]);
+      i.label = l->second;
+    }
+  }
+  if(code_labels.find("main") == code_labels.end())
+    return Error("no main");
+  return true;
+}
+
+void Machine::Run(long limit){
+  int R[NUM_REGS] = {0};
+  int hi = 0, lo = 0;
+  long hilo_ready = 0;
+  int loaded = R_NONE;          // register the previous lw wrote
+  long cycles = 0, executed = 0;
+  long counts[I_LABEL] = {0};
+  stack.assign(STACK_WORDS, 0);
+  R[R_SP] = R[R_FP] = STACK_TOP - 4;
+  R[R_RA] = -1;
+  int pc = code_labels["main"];
+
+  while(r.ok){
+    if(pc < 0 || pc >= text.size()){
+      Error(pc < 0 ? "returned from main" : "ran off the end of the text");
+      break;
+    }
+    if(limit > 0 && executed == limit){
+      Error("gave up after " + to_string(limit) + " instructions");
+      break;
+    }
+    const Instr &i = text[pc++];
+    executed++;
+    counts[i.op]++;
+    cycles++;
+    if(loaded != R_NONE && loaded != R_ZERO && InstrUses(i, loaded))
+      cycles += LOAD_USE_STALL;
+    loaded = R_NONE;
+
+    int value = 0;
+    bool writes = true;
+    unsigned a = (unsigned) R[i.rs == R_NONE ? 0 : i.rs];
+    unsigned b = (unsigned) R[i.rt == R_NONE ? 0 : i.rt];
+    switch(i.op){
+    case I_LI: value = i.imm; break;
+    case I_LA: value = i.label; break;
+    case I_LW:
+    case I_SW:{
+      unsigned addr = (i.label != NO_LABEL ? (unsigned) i.label : a) + i.imm;
+      int *w = Word(addr);
+      if(w == NULL)
+        continue;
+      if(i.op == I_SW){
+        *w = R[i.rd];
+        writes = false;
+      }
+      else{
+        value = *w;
+        loaded = i.rd;
+      }
+      break;
+    }
+    case I_ADDIU: value = a + i.imm; break;
+    case I_ADD: value = a + b; break;
+    case I_SUB: value = a - b; break;
+    case I_AND: value = a & b; break;
+    case I_OR: value = a | b; break;
+    case I_SLT: value = (int) a < (int) b; break;
+    case I_XORI: value = a ^ (unsigned) i.imm; break;
+    case I_SLL: value = a << (i.imm & 31); break;
+    case I_MOVE: value = a; break;
+    case I_MULT:{
+      long long p = (long long) (int) a * (int) b;
+      lo = (int) p;
+      hi = (int) (p >> 32);
+      hilo_ready = cycles + MULT_LATENCY;
+      writes = false;
+      break;
+    }
+    case I_DIV:
+      if(b == 0){
+        Error("division by zero");
+        continue;
+      }
+      // The one quotient that does not fit wraps, as on the hardware
+      if((int) b == -1){
+        lo = 0u - a;
+        hi = 0;
+      }
+      else{
+        lo = (int) a / (int) b;
+        hi = (int) a % (int) b;
+      }
+      hilo_ready = cycles + DIV_LATENCY;
+      writes = false;
+      break;
+    case I_MFLO:
+    case I_MFHI:
+      if(cycles < hilo_ready)
+        cycles = hilo_ready;
+      value = i.op == I_MFLO ? lo : hi;
+      break;
+    case I_BEQ:
+    case I_BNE:
+    case I_BLT:
+    case I_BGE:
+      writes = false;
+      if(i.op == I_BEQ || i.op == I_BNE ? (a == b) == (i.op == I_BEQ) :
+         ((int) a < (int) b) == (i.op == I_BLT)){
+        pc = i.label;
+        cycles += TAKEN_PENALTY;
+      }
+      break;
+    case I_JAL:
+      R[R_RA] = pc;
+    case I_J:
+      pc = i.label;
+      cycles += TAKEN_PENALTY;
+      writes = false;
+      break;
+    case I_JR:
+      pc = (int) a;
+      cycles += TAKEN_PENALTY;
+      writes = false;
+      break;
+    case I_SYSCALL:
+      if(R[R_V0] != 17){
+        Error("unsupported syscall " + to_string(R[R_V0]));
+        continue;
+      }
+      r.exit_code = R[R_A0];
+      r.instructions = executed;
+      r.cycles = cycles;
+      memcpy(r.counts, counts, sizeof(counts));
+      for(int g = 0; g<r.globals.size(); g++){
+        int end = g + 1 < global_starts.size() ? global_starts[g + 1] : data.size();
+        r.globals[g].words.assign(data.begin() + global_starts[g], data.begin() + end);
+      }
+      return;
+    }
+    if(writes && i.rd != R_ZERO)
+      R[i.rd] = value;
+  }
+}
+
+SimResult Simulate(const string &assembly, long limit){
+  Machine m;
+  m.r.exit_code = 0;
+  m.r.instructions = m.r.cycles = 0;
+  memset(m.r.counts, 0, sizeof(m.r.counts));
+  if(m.Assemble(assembly))
+    m.Run(limit);
+  return m.r;
+}
+
+void PrintSimResult(const SimResult &r, FILE *out){
+  if(!r.ok){
+    fprintf(out, "error: %s\n", r.error.c_str());
+    return;
+  }
+  fprintf(out, "exit %d\n", r.exit_code);
+  for(int g = 0; g<r.globals.size(); g++){
+    fprintf(out, "%s:", r.globals[g].name.c_str());
+    for(int k = 0; k<r.globals[g].words.size(); k++)
+      fprintf(out, " %d", r.globals[g].words[k]);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "instructions %ld\ncycles %ld\n", r.instructions, r.cycles);
+  for(int op = 0; op<I_LABEL; op++){
+    if(r.counts[op])
+      fprintf(out, "  %-8s %ld\n", OpNames[op], r.counts[op]);
+  }
+}
+
+unsigned GlobalsHash(const SimResult &r){
+  unsigned h = 2166136261u;
+  for(int g = 0; g<r.globals.size(); g++){
+    const string &name = r.globals[g].name;
+    for(int k = 0; k<=name.size(); k++)
+      h = (h ^ (unsigned char) name.c_str()[k]) * 16777619u;
+    for(int k = 0; k<r.globals[g].words.size(); k++){
+      unsigned w = r.globals[g].words[k];
+      for(int byte = 0; byte<4; byte++, w >>= 8)
+        h = (h ^ (w & 0xff)) * 16777619u;
+    }
+  }
+  return h;
+}
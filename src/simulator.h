@@ -0,0 +1,37 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "instr.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A global of the data segment and its words when the program ended
+struct SimGlobal{
+  string name;
+  vector<int> words;
+};
+
+struct SimResult{
+  bool ok;              // false: error says why the program did not finish
+  string error;
+  int exit_code;        // $a0 at syscall 17
+  vector<SimGlobal> globals;
+  long instructions;
+  long counts[I_LABEL]; // executed instructions by opcode
+  long cycles;          // estimate, see simulator.cpp
+};
+
+// Assembles the text the compiler writes and runs it from main until
+// syscall 17, giving up after limit instructions (0: never)
+SimResult Simulate(const string &assembly, long limit);
+
+// Exit code, globals, counts by opcode and cycles, as text
+void PrintSimResult(const SimResult &r, FILE *out);
+
+// FNV-1a of every global's name and words: equal hashes, equal memory
+unsigned GlobalsHash(const SimResult &r);
+
+#endif
@@ -0,0 +1,319 @@
+#include "ir.h"
+#include <map>
+
+using namespace std;
+
+// Successors are visited last to first so that in reverse postorder the
+// taken side of a branch (a loop body, a then part) follows it directly
+static void PostOrder(IrBlock *b, vector<bool> &seen, vector<IrBlock *> &order){
+  seen[b->id] = true;
+  for(int i = b->succs.size() - 1; i>=0; i--){
+    if(!seen[b->succs[i]->id])
+      PostOrder(b->succs[i], seen, order);
+  }
+  order.push_back(b);
+}
+
+void BuildCfg(IrFunction *f){
+  // Phi inputs are matched up with the predecessors again afterwards
+  map<IrBlock *, vector<IrBlock *> > old_preds;
+  for(int i = 0; i<f->blocks.size(); i++){
+    IrBlock *b = f->blocks[i];
+    if(!b->instrs.empty() && b->instrs[0]->op == IR_PHI)
+      old_preds[b] = b->preds;
+    b->preds.clear();
+    b->succs.clear();
+    IrInstr *t = b->Terminator();
+    if(t->op == IR_BRANCH && t->target[0] == t->target[1]){
+      t->op = IR_JUMP;
+      t->args.clear();
+    }
+    if(t->op == IR_JUMP)
+      b->succs.push_back(t->target[0]);
+    else if(t->op == IR_BRANCH){
+      b->succs.push_back(t->target[0]);
+      b->succs.push_back(t->target[1]);
+    }
+  }
+
+  vector<bool> seen(f->num_block_ids, false);
+  vector<IrBlock *> order;
+  PostOrder(f->blocks[0], seen, order);
+  f->blocks.assign(order.rbegin(), order.rend());
+
+  for(int i = 0; i<f->blocks.size(); i++){
+    IrBlock *b = f->blocks[i];
+    b->rpo = i;
+    for(int j = 0; j<b->succs.size(); j++)
+      b->succs[j]->preds.push_back(b);
+  }
+
+  for(map<IrBlock *, vector<IrBlock *> >::iterator i = old_preds.begin();
+      i != old_preds.end(); ++i)
+  {
+    IrBlock *b = i->first;
+    if(!seen[b->id])
+      continue;
+    for(int j = 0; j<b->instrs.size() && b->instrs[j]->op == IR_PHI; j++){
+      IrInstr *phi = b->instrs[j];
+      vector<int> args;
+      for(int k = 0; k<b->preds.size(); k++){
+        int n = 0;
+        while(n < i->second.size() && i->second[n] != b->preds[k])
+          n++;
+        args.push_back(n < phi->args.size() ? phi->args[n] : NO_VALUE);
+      }
+      phi->args = args;
+    }
+  }
+}
+
+// Walks up from both blocks to their nearest common dominator
+static IrBlock *Intersect(IrBlock *a, IrBlock *b){
+  while(a != b){
+    while(a->rpo > b->rpo)
+      a = a->idom;
+    while(b->rpo > a->rpo)
+      b = b->idom;
+  }
+  return a;
+}
+
+void ComputeDominators(IrFunction *f){
+  IrBlock *entry = f->blocks[0];
+  for(int i = 0; i<f->blocks.size(); i++){
+    f->blocks[i]->idom = NULL;
+    f->blocks[i]->dom_children.clear();
+    f->blocks[i]->frontier.clear();
+  }
+  entry->idom = entry;
+  bool changed = true;
+  while(changed){
+    changed = false;
+    for(int i = 1; i<f->blocks.size(); i++){
+      IrBlock *b = f->blocks[i];
+      IrBlock *idom = NULL;
+      for(int j = 0; j<b->preds.size(); j++){
+        IrBlock *p = b->preds[j];
+        if(p->idom == NULL)
+          continue;
+        idom = idom ? Intersect(p, idom) : p;
+      }
+      if(idom != b->idom){
+        b->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  entry->idom = NULL;
+
+  for(int i = 1; i<f->blocks.size(); i++)
+    f->blocks[i]->idom->dom_children.push_back(f->blocks[i]);
+
+  // b is in the frontier of every block on the way up from a predecessor
+  // to b's immediate dominator
+  for(int i = 0; i<f->blocks.size(); i++){
+    IrBlock *b = f->blocks[i];
+    if(b->preds.size() < 2)
+      continue;
+    for(int j = 0; j<b->preds.size(); j++){
+      for(IrBlock *r = b->preds[j]; r != b->idom; r = r->idom){
+        vector<IrBlock *> &df = r->frontier;
+        if(df.empty() || df.back() != b)
+          df.push_back(b);
+      }
+    }
+  }
+}
+
+class SsaBuilder{
+public:
+  IrFunction *f;
+  vector<Identifier *> vars;            // in order of first appearance
+  map<Identifier *, int> var_index;
+  vector<vector<int> > stacks;          // current value of each variable
+  vector<int> alias;                    // value read by each GETVAR
+  vector<int> undefs;                   // UNDEF value of each variable, or NO_VALUE
+  vector<IrInstr *> undef_defs;
+
+  SsaBuilder(IrFunction *f) {this->f = f;}
+
+  int Index(Identifier *v){
+    map<Identifier *, int>::iterator i = var_index.find(v);
+    if(i != var_index.end())
+      return i->second;
+    vars.push_back(v);
+    stacks.push_back(vector<int>());
+    undefs.push_back(NO_VALUE);
+    return var_index[v] = vars.size() - 1;
+  }
+
+  int Top(int var){
+    if(!stacks[var].empty())
+      return stacks[var].back();
+    if(undefs[var] == NO_VALUE){
+      IrInstr *in = f->NewInstr(IR_UNDEF, f->NewValue());
+      in->var = vars[var];
+      undef_defs.push_back(in);
+      undefs[var] = in->dst;
+    }
+    return undefs[var];
+  }
+
+  // Only variables read in some block before being written there can
+  // need a phi (Briggs' semi-pruned form)
+  void PlacePhis(){
+    vector<bool> global;
+    vector<vector<IrBlock *> > def_blocks;
+    for(int i = 0; i<f->blocks.size(); i++){
+      IrBlock *b = f->blocks[i];
+      vector<bool> killed(vars.size(), false);
+      for(int j = 0; j<b->instrs.size(); j++){
+        IrInstr *in = b->instrs[j];
+        if(in->op != IR_GETVAR && in->op != IR_SETVAR)
+          continue;
+        int v = Index(in->var);
+        if(v >= global.size()){
+          global.resize(v + 1, false);
+          def_blocks.resize(v + 1);
+          killed.resize(v + 1, false);
+        }
+        if(in->op == IR_GETVAR && !killed[v])
+          global[v] = true;
+        if(in->op == IR_SETVAR){
+          killed[v] = true;
+          if(def_blocks[v].empty() || def_blocks[v].back() != b)
+            def_blocks[v].push_back(b);
+        }
+      }
+    }
+
+    vector<int> has_phi(f->num_block_ids, -1);
+    vector<int> queued(f->num_block_ids, -1);
+    for(int v = 0; v<vars.size(); v++){
+      if(!global[v])
+        continue;
+      vector<IrBlock *> work = def_blocks[v];
+      for(int i = 0; i<work.size(); i++)
+        queued[work[i]->id] = v;
+      while(!work.empty()){
+        IrBlock *d = work.back();
+        work.pop_back();
+        for(int i = 0; i<d->frontier.size(); i++){
+          IrBlock *b = d->frontier[i];
+          if(has_phi[b->id] == v)
+            continue;
+          IrInstr *phi = f->NewInstr(IR_PHI, f->NewValue());
+          phi->var = vars[v];
+          phi->args.assign(b->preds.size(), NO_VALUE);
+          b->instrs.insert(b->instrs.begin(), phi);
+          has_phi[b->id] = v;
+          if(queued[b->id] != v){
+            queued[b->id] = v;
+            work.push_back(b);
+          }
+        }
+      }
+    }
+  }
+
+  int Resolve(int v){
+    while(v != NO_VALUE && v < alias.size() && alias[v] != NO_VALUE)
+      v = alias[v];
+    return v;
+  }
+
+  void Rename(IrBlock *b){
+    vector<int> pushed;
+    vector<IrInstr *> kept;
+    for(int i = 0; i<b->instrs.size(); i++){
+      IrInstr *in = b->instrs[i];
+      if(in->op == IR_PHI){
+        int v = Index(in->var);
+        stacks[v].push_back(in->dst);
+        pushed.push_back(v);
+        kept.push_back(in);
+        continue;
+      }
+      for(int j = 0; j<in->args.size(); j++)
+        in->args[j] = Resolve(in->args[j]);
+      if(in->op == IR_GETVAR){
+        alias[in->dst] = Top(Index(in->var));
+        continue;
+      }
+      if(in->op == IR_SETVAR){
+        int v = Index(in->var);
+        stacks[v].push_back(in->args[0]);
+        pushed.push_back(v);
+        continue;
+      }
+      kept.push_back(in);
+    }
+    b->instrs = kept;
+
+    for(int i = 0; i<b->succs.size(); i++){
+      IrBlock *s = b->succs[i];
+      int n = s->PredIndex(b);
+      for(int j = 0; j<s->instrs.size() && s->instrs[j]->op == IR_PHI; j++){
+        IrInstr *phi = s->instrs[j];
+        phi->args[n] = Top(Index(phi->var));
+      }
+    }
+
+    for(int i = 0; i<b->dom_children.size(); i++)
+      Rename(b->dom_children[i]);
+
+    for(int i = 0; i<pushed.size(); i++)
+      stacks[pushed[i]].pop_back();
+  }
+
+  void Build(){
+    PlacePhis();
+    // Values made from here on never appear in a GETVAR
+    alias.assign(f->num_values, NO_VALUE);
+    Rename(f->blocks[0]);
+    vector<IrInstr *> &entry = f->blocks[0]->instrs;
+    entry.insert(entry.begin(), undef_defs.begin(), undef_defs.end());
+  }
+};
+
+void BuildSsa(IrFunction *f){
+  SsaBuilder s(f);
+  s.Build();
+}
+
+void RemoveDeadValues(IrFunction *f){
+  vector<IrInstr *> def(f->num_values, NULL);
+  vector<bool> live(f->num_values, false);
+  vector<IrInstr *> work;
+  for(int i = 0; i<f->blocks.size(); i++){
+    for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+      IrInstr *in = f->blocks[i]->instrs[j];
+      if(in->dst != NO_VALUE)
+        def[in->dst] = in;
+      if(!in->IsPure())
+        work.push_back(in);
+    }
+  }
+  while(!work.empty()){
+    IrInstr *in = work.back();
+    work.pop_back();
+    for(int k = 0; k<in->args.size(); k++){
+      int v = in->args[k];
+      if(v == NO_VALUE || live[v])
+        continue;
+      live[v] = true;
+      if(def[v])
+        work.push_back(def[v]);
+    }
+  }
+  for(int i = 0; i<f->blocks.size(); i++){
+    vector<IrInstr *> &instrs = f->blocks[i]->instrs;
+    int n = 0;
+    for(int j = 0; j<instrs.size(); j++){
+      if(!instrs[j]->IsPure() || live[instrs[j]->dst])
+        instrs[n++] = instrs[j];
+    }
+    instrs.resize(n);
+  }
+}
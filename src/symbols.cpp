@@ -0,0 +1,90 @@
+#include "symbols.h"
+#include <string.h>
+
+using namespace std;
+
+thread_local SymbolTable *symbols;
+
+static const int INITIAL_SLOTS = 256;
+
+// FNV-1a
+static unsigned Hash(const char *text, int len){
+  unsigned h = 2166136261u;
+  for(int i = 0; i<len; i++){
+    h ^= (unsigned char) text[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+SymbolTable::SymbolTable(){
+  slots.assign(INITIAL_SLOTS, NO_SYMBOL);
+}
+
+void SymbolTable::Grow(){
+  vector<int> old;
+  old.swap(slots);
+  slots.assign(old.size() * 2, NO_SYMBOL);
+  unsigned mask = slots.size() - 1;
+  for(int i = 0; i<old.size(); i++){
+    if(old[i] == NO_SYMBOL)
+      continue;
+    unsigned s = hashes[old[i]] & mask;
+    while(slots[s] != NO_SYMBOL)
+      s = (s + 1) & mask;
+    slots[s] = old[i];
+  }
+}
+
+int SymbolTable::Intern(const char *text, int len){
+  unsigned h = Hash(text, len);
+  unsigned mask = slots.size() - 1;
+  unsigned s = h & mask;
+  while(slots[s] != NO_SYMBOL){
+    int sym = slots[s];
+    if(hashes[sym] == h && names[sym].size() == len &&
+       memcmp(names[sym].data(), text, len) == 0)
+      return sym;
+    s = (s + 1) & mask;
+  }
+  int sym = names.size();
+  names.push_back(string(text, len));
+  hashes.push_back(h);
+  bindings.push_back(NULL);
+  globals.push_back(NULL);
+  slots[s] = sym;
+  // Keep the table at most half full
+  if(2 * names.size() > slots.size())
+    Grow();
+  return sym;
+}
+
+void SymbolTable::PushScope(){
+  scope_starts.push_back(shadowed.size());
+}
+
+void SymbolTable::PopScope(){
+  int start = scope_starts.back();
+  scope_starts.pop_back();
+  while(shadowed.size() > start){
+    bindings[shadowed.back().first] = shadowed.back().second;
+    shadowed.pop_back();
+  }
+}
+
+void SymbolTable::Declare(int sym, Identifier *id){
+  shadowed.push_back(make_pair(sym, bindings[sym]));
+  bindings[sym] = id;
+}
+
+Identifier *SymbolTable::Lookup(int sym) const{
+  return bindings[sym];
+}
+
+void SymbolTable::DeclareGlobal(int sym, Declaration *d){
+  globals[sym] = d;
+}
+
+Declaration *SymbolTable::LookupGlobal(int sym) const{
+  return globals[sym];
+}
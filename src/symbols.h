@@ -0,0 +1,58 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Declaration;
+class Identifier;
+
+#define NO_SYMBOL -1
+
+// Every identifier spelling gets a small dense id when the lexer first
+// sees it, so the rest of the compiler compares and indexes ints.
+//
+// Scopes are kept as one binding per symbol (the innermost visible
+// declaration) plus an undo log: entering a block costs nothing, each
+// declaration pushes the binding it shadows and leaving the block pops
+// them back. A lookup is a single array access however deep the nesting.
+class SymbolTable{
+public:
+  SymbolTable();
+
+  // Id of text[0..len), made on first sight
+  int Intern(const char *text, int len);
+  int Intern(const string &text) {return Intern(text.data(), text.size());}
+  const string &Name(int sym) const {return names[sym];}
+  int NumSymbols() const {return names.size();}
+
+  // Locals and parameters, while their function is being parsed
+  void PushScope();
+  void PopScope();
+  void Declare(int sym, Identifier *id);
+  Identifier *Lookup(int sym) const;
+
+  // Functions and global variables, visible from every function whatever
+  // the order of declaration
+  void DeclareGlobal(int sym, Declaration *d);
+  Declaration *LookupGlobal(int sym) const;
+
+private:
+  vector<string> names;
+  vector<unsigned> hashes;
+  vector<int> slots;            // open addressing, power of two, NO_SYMBOL if free
+
+  vector<Identifier *> bindings;
+  vector<Declaration *> globals;
+  vector<pair<int, Identifier *> > shadowed;
+  vector<int> scope_starts;     // size of shadowed when each open scope began
+
+  void Grow();
+};
+
+// Symbols of the compilation in progress on this thread
+extern thread_local SymbolTable *symbols;
+
+#endif
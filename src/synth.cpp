@@ -0,0 +1,241 @@
+#include "synth.h"
+#include <stdio.h>
+
+using namespace std;
+
+#define NUM_GLOBALS 4
+#define ARRAY_SIZE 4
+#define TRIP_COUNT 4
+
+SynthOptions DefaultSynthOptions(){
+  SynthOptions o;
+  o.functions = 50;
+  o.statements = 40;
+  o.depth = 3;
+  o.expr_depth = 3;
+  o.dims = 2;
+  o.identifiers = 8;
+  o.seed = 1;
+  return o;
+}
+
+class Synth{
+public:
+  Synth(const SynthOptions &opts) : o(opts) {
+    state = opts.seed ? opts.seed : 1;
+    indent = 0;
+    loops = 0;
+    counters = o.depth > o.dims ? o.depth : o.dims;
+    if(o.identifiers < 2)
+      o.identifiers = 2;
+  }
+
+  string Program(){
+    for(int i = 0; i<NUM_GLOBALS; i++)
+      Line("int g" + Num(i) + ";");
+    if(o.dims > 0)
+      Line("int ga" + Dims() + ";");
+    for(int i = 0; i<o.functions; i++)
+      Function(i);
+    Line("int main(){");
+    indent++;
+    Line("int r;");
+    Line("r = 0;");
+    if(o.functions > 0)
+      Line("r = f" + Num(o.functions - 1) + "(1, 2);");
+    Line("return 0;");
+    indent--;
+    Line("}");
+    return out;
+  }
+
+private:
+  SynthOptions o;
+  unsigned state;
+  string out;
+  int indent;
+  int loops;            // counters in use by the enclosing loops
+  int counters;         // loop counters every function declares
+
+  // xorshift, so that the programs are the same everywhere
+  unsigned Next(){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  int Pick(int n) {return Next() % n;}
+
+  static string Num(int n){
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", n);
+    return buf;
+  }
+
+  void Line(const string &s){
+    out.append(2 * indent, ' ');
+    out += s;
+    out += '\n';
+  }
+
+  string Dims(){
+    string s;
+    for(int i = 0; i<o.dims; i++)
+      s += "[" + Num(ARRAY_SIZE) + "]";
+    return s;
+  }
+
+  // Within bounds: a counter of an enclosing loop or a constant
+  string Element(const string &array){
+    string s = array;
+    for(int i = 0; i<o.dims; i++)
+      s += "[" + (loops > 0 && Pick(2) ? "l" + Num(Pick(loops)) : Num(Pick(ARRAY_SIZE))) + "]";
+    return s;
+  }
+
+  string Local() {return "v" + Num(Pick(o.identifiers));}
+
+  string Leaf(){
+    switch(Pick(o.dims > 0 ? 7 : 5)){
+    case 0: return Num(Pick(100));
+    case 1: return Pick(2) ? "p" : "q";
+    case 2: return "g" + Num(Pick(NUM_GLOBALS));
+    case 3: return loops > 0 ? "l" + Num(Pick(loops)) : Local();
+    case 5: return Element("a");
+    case 6: return Element("ga");
+    default: return Local();
+    }
+  }
+
+  string IntExpr(int d){
+    if(d <= 0 || Pick(4) == 0)
+      return Leaf();
+    switch(Pick(6)){
+    case 0: return "(" + IntExpr(d - 1) + " + " + IntExpr(d - 1) + ")";
+    case 1: return "(" + IntExpr(d - 1) + " - " + IntExpr(d - 1) + ")";
+    case 2: return "(" + IntExpr(d - 1) + " * " + IntExpr(d - 1) + ")";
+    // Never by zero
+    case 3: return "(" + IntExpr(d - 1) + " / " + Num(1 + Pick(9)) + ")";
+    case 4: return "(" + IntExpr(d - 1) + " % " + Num(1 + Pick(9)) + ")";
+    default: return "-(" + IntExpr(d - 1) + ")";
+    }
+  }
+
+  string BoolExpr(int d){
+    const char *rel[] = {" < ", " > ", " == ", " != "};
+    if(d <= 1 || Pick(3) == 0)
+      return IntExpr(d - 1) + rel[Pick(4)] + IntExpr(d - 1);
+    switch(Pick(3)){
+    case 0: return "(" + BoolExpr(d - 1) + " && " + BoolExpr(d - 1) + ")";
+    case 1: return "(" + BoolExpr(d - 1) + " || " + BoolExpr(d - 1) + ")";
+    default: return "!(" + BoolExpr(d - 1) + ")";
+    }
+  }
+
+  string Target(){
+    if(o.dims > 0 && Pick(3) == 0)
+      return Element(Pick(2) ? "a" : "ga");
+    return Pick(8) ? Local() : "g" + Num(Pick(NUM_GLOBALS));
+  }
+
+  void Assignment(){
+    Line(Target() + " = " + IntExpr(o.expr_depth) + ";");
+  }
+
+  // Statements of a block, budget of them at most
+  void Body(int &budget, int depth){
+    int n = 1 + Pick(budget < 4 ? budget : 4);
+    for(int i = 0; i<n && budget > 0; i++)
+      Statement(budget, depth);
+  }
+
+  void Block(int &budget, int depth){
+    Line("{");
+    indent++;
+    Body(budget, depth);
+    indent--;
+    Line("}");
+  }
+
+  void Statement(int &budget, int depth){
+    budget--;
+    if(depth >= o.depth || budget == 0 || Pick(3)){
+      Assignment();
+      return;
+    }
+    string counter = "l" + Num(loops);
+    switch(Pick(4)){
+    case 0:
+      Line("if(" + BoolExpr(o.expr_depth) + ")");
+      Block(budget, depth + 1);
+      if(budget > 0 && Pick(2)){
+        Line("else");
+        Block(budget, depth + 1);
+      }
+      break;
+    case 1:
+      Line("for(" + counter + " = 0; " + counter + " < " + Num(TRIP_COUNT) + "; " +
+           counter + " = " + counter + " + 1)");
+      loops++;
+      Block(budget, depth + 1);
+      loops--;
+      break;
+    case 2:
+      Line(counter + " = 0;");
+      Line("while(" + counter + " < " + Num(TRIP_COUNT) + "){");
+      indent++;
+      loops++;
+      Body(budget, depth + 1);
+      loops--;
+      Line(counter + " = " + counter + " + 1;");
+      indent--;
+      Line("}");
+      break;
+    default:
+      Block(budget, depth + 1);
+    }
+  }
+
+  void Function(int f){
+    Line("int f" + Num(f) + "(int p, int q){");
+    indent++;
+    for(int i = 0; i<o.identifiers; i++)
+      Line("int v" + Num(i) + ";");
+    for(int i = 0; i<counters; i++)
+      Line("int l" + Num(i) + ";");
+    if(o.dims > 0)
+      Line("int a" + Dims() + ";");
+
+    // Nothing is read before it is written
+    for(int i = 0; i<o.identifiers; i++)
+      Line("v" + Num(i) + " = p + " + Num(i) + ";");
+    if(o.dims > 0){
+      string element = "a";
+      for(int i = 0; i<o.dims; i++){
+        string l = "l" + Num(i);
+        Line("for(" + l + " = 0; " + l + " < " + Num(ARRAY_SIZE) + "; " + l + " = " + l + " + 1)");
+        indent++;
+        element += "[" + l + "]";
+      }
+      Line(element + " = q;");
+      indent -= o.dims;
+    }
+
+    int budget = o.statements;
+    while(budget > 0)
+      Statement(budget, 0);
+
+    // Each function calls the one before it once, so a run visits them all
+    string ret = IntExpr(o.expr_depth);
+    if(f > 0)
+      ret += " + f" + Num(f - 1) + "(" + Local() + ", " + Local() + ")";
+    Line("return " + ret + ";");
+    indent--;
+    Line("}");
+  }
+};
+
+string SynthProgram(const SynthOptions &opts){
+  return Synth(opts).Program();
+}
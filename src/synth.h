@@ -0,0 +1,28 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <string>
+
+using namespace std;
+
+// Shape of a synthetic program. Every knob scales one thing, so that the
+// cost of compiling can be measured against it alone.
+struct SynthOptions{
+  int functions;        // besides main()
+  int statements;       // per function, nested ones included
+  int depth;            // how deep if/for/while/blocks nest
+  int expr_depth;       // operators on the longest path of an expression
+  int dims;             // dimensions of the arrays, 0 for none
+  int identifiers;      // scalar locals per function
+  unsigned seed;
+};
+
+// Small defaults that bench scales up from
+SynthOptions DefaultSynthOptions();
+
+// A valid program of the accepted subset, the same for the same options.
+// Loops run a fixed number of times and a function only calls the one
+// before it, so the program also terminates when run.
+string SynthProgram(const SynthOptions &opts);
+
+#endif
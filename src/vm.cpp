@@ -0,0 +1,790 @@
+#include "vm.h"
+#include "errors.h"
+#include "mips.h"
+#include "opt.h"
+#include "report.h"
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+// Words of the stack all frames are carved from: the depth of recursion
+// a program gets before it is stopped
+#define VM_STACK_WORDS (1 << 22)
+#define MAX_SLOT 65535
+
+// Whether evaluating e may assign a variable, so that a value read from
+// the variable's slot before e has to be copied first
+static bool Assigns(Expression *e){
+  if(e == NULL)
+    return false;
+  if(OpExpression *o = As<OpExpression>(e))
+    return o->op->op == ASSIGN || Assigns(o->lhs) || Assigns(o->rhs);
+  if(Access *a = As<Access>(e)){
+    if(Assigns(a->base_offset))
+      return true;
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++){
+      if(Assigns((*a->access_list)[i]))
+        return true;
+    }
+  }
+  if(Call *c = As<Call>(e)){
+    for(int i = 0; i<c->args->size(); i++){
+      if(Assigns((*c->args)[i]))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Translates the statements of one function into bytecode in the order
+// Emit() evaluates them: right operands before left ones, call arguments
+// last to first. A value lives in a slot: the variable's own when it is
+// a scalar local, otherwise a temporary. Temporaries are a stack that is
+// popped back at the end of every expression.
+class BytecodeLowering{
+public:
+  VmFunction *f;
+  const map<FuncDecl *, int> &index;
+  const map<Identifier *, int> &global_offsets;
+  map<Identifier *, int> slots;         // scalar locals and parameters
+  map<Identifier *, int> arrays;        // local arrays, bytes from array_start
+  int array_bytes;
+  int first_temp;
+  int top;                              // first free temporary
+  vector<int> labels;                   // instruction index of each label
+  vector<int> jumps;                    // instructions to point at their label
+  vector<int> frame_refs;               // instructions addressing local arrays
+  int line;
+
+  BytecodeLowering(VmFunction *f, const map<FuncDecl *, int> &index,
+                   const map<Identifier *, int> &global_offsets)
+    : f(f), index(index), global_offsets(global_offsets){
+    array_bytes = 0;
+    line = 0;
+    vector<Identifier *> *params = f->fd->param_list;
+    for(int i = 0; i<params->size(); i++)
+      slots[(*params)[i]] = i + 1;
+    top = params->size() + 1;
+    Declare(f->fd->stmt_block);
+    first_temp = f->frame_size = top;
+  }
+
+  // Gives every local a statement uses its slot or its bytes of array
+  void Declare(Ast *n){
+    if(n == NULL)
+      return;
+    switch(n->kind){
+    case K_EXPR_STMT:
+      Declare(As<ExprStatement>(n)->expr);
+      break;
+    case K_SEL_STMT: {
+      SelStatement *s = As<SelStatement>(n);
+      Declare(s->test);
+      Declare(s->body_true);
+      Declare(s->body_false);
+      break;
+    }
+    case K_ITER_STMT: {
+      IterStatement *it = As<IterStatement>(n);
+      if(it->loop_type == FOR){
+        Declare(it->init);
+        Declare(it->cond);
+      }
+      Declare(it->expr);
+      Declare(it->body);
+      break;
+    }
+    case K_STMT_BLOCK: {
+      StatementBlock *sb = As<StatementBlock>(n);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        Declare((*sb->stmt_list)[i]);
+      break;
+    }
+    case K_RETURN_STMT:
+      Declare(As<ReturnStatement>(n)->expr);
+      break;
+    case K_OP_EXPR:
+      Declare(As<OpExpression>(n)->lhs);
+      Declare(As<OpExpression>(n)->rhs);
+      break;
+    case K_CALL: {
+      Call *c = As<Call>(n);
+      for(int i = 0; i<c->args->size(); i++)
+        Declare((*c->args)[i]);
+      break;
+    }
+    case K_ACCESS: {
+      Access *a = As<Access>(n);
+      Identifier *id = a->id;
+      if(!id->is_global && !id->is_array && slots.count(id) == 0)
+        slots[id] = top++;
+      if(!id->is_global && id->is_array && arrays.count(id) == 0){
+        arrays[id] = array_bytes;
+        int words = 1;
+        for(int i = 0; i<id->dim_list->size(); i++)
+          words *= (*id->dim_list)[i]->val;
+        array_bytes += words * VAR_SIZE;
+      }
+      Declare(a->base_offset);
+      for(int i = 0; a->is_array && i<a->access_list->size(); i++)
+        Declare((*a->access_list)[i]);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  int Temp(){
+    if(top >= f->frame_size)
+      f->frame_size = top + 1;
+    return top++;
+  }
+
+  void Emit(int op, int a, int b, int c, int imm){
+    VmInstr in;
+    in.op = op;
+    in.a = a;
+    in.b = b;
+    in.c = c;
+    in.imm = imm;
+    f->code.push_back(in);
+    f->lines.push_back(line);
+  }
+
+  int NewLabel(){
+    labels.push_back(-1);
+    return labels.size() - 1;
+  }
+
+  void Place(int label){
+    labels[label] = f->code.size();
+  }
+
+  void Jump(int op, int a, int b, int c, int label){
+    jumps.push_back(f->code.size());
+    Emit(op, a, b, c, label);
+  }
+
+  // The value in slot, copied to a temporary when it is a variable's
+  // and what is evaluated before it is used may assign the variable
+  int Keep(int slot, bool assigns){
+    if(slot == 0 || slot >= first_temp || !assigns)
+      return slot;
+    int t = Temp();
+    Emit(VM_MOVE, t, slot, 0, 0);
+    return t;
+  }
+
+  // Address of an element of memory: byte disp + b + VAR_SIZE * c, b
+  // and c being slots (0 when there is nothing to add). A subscript of
+  // stride VAR_SIZE goes in c as it is, the others are scaled and
+  // summed in b. Evaluates in the order of Access::EmitIndex().
+  int Address(Access *a, int *c, int *disp){
+    vector<pair<int, int> > terms;      // slot and stride
+    *disp = 0;
+    for(int i = 0; a->is_array && i<a->access_list->size(); i++){
+      Expression *e = (*a->access_list)[i];
+      int stride = a->id->strides[i];
+      if(IntConst *k = As<IntConst>(e))
+        *disp += k->val * stride;
+      else
+        terms.push_back(make_pair(Keep(Value(e, -1), AssignsAfter(a, i)), stride));
+    }
+    if(a->base_offset)
+      terms.push_back(make_pair(Value(a->base_offset, -1), 1));
+    *disp += a->id->is_global ? global_offsets.at(a->id) : arrays.at(a->id);
+
+    *c = 0;
+    int b = 0;
+    for(int i = 0; i<terms.size(); i++){
+      int v = terms[i].first;
+      int stride = terms[i].second;
+      if(stride == VAR_SIZE && *c == 0){
+        *c = v;
+        continue;
+      }
+      if(stride != 1){
+        int t = Temp();
+        Emit(VM_MULI, t, v, 0, stride);
+        v = t;
+      }
+      if(b == 0)
+        b = v;
+      else{
+        int t = Temp();
+        Emit(VM_ADD, t, b, v, 0);
+        b = t;
+      }
+    }
+    return b;
+  }
+
+  // Whether what of a is evaluated after subscript i may assign
+  static bool AssignsAfter(Access *a, int i){
+    for(int j = i + 1; j<a->access_list->size(); j++){
+      if(Assigns((*a->access_list)[j]))
+        return true;
+    }
+    return Assigns(a->base_offset);
+  }
+
+  // A load or store; those of local arrays get their final offset in
+  // Finish(), once the temporaries are counted
+  void Memory(int op, Access *a, int val, int b, int c, int disp){
+    if(!a->id->is_global)
+      frame_refs.push_back(f->code.size());
+    Emit(op, val, b, c, disp);
+  }
+
+  // Stores val in an element of memory and returns the slot that still
+  // holds the value afterwards
+  int Store(Access *a, int val){
+    val = Keep(val, Assigns(a));
+    int c, disp;
+    int b = Address(a, &c, &disp);
+    Memory(a->id->is_global ? VM_STOREG : VM_STOREF, a, val, b, c, disp);
+    return val;
+  }
+
+  // Result of an instruction into dst, or a new temporary when dst is -1
+  int Result(int mark, int dst){
+    top = mark;
+    return dst >= 0 ? dst : Temp();
+  }
+
+  // Evaluates e into a slot, dst if it is not -1
+  int Value(Expression *e, int dst){
+    int mark = top;
+    int r;
+    if(e->loc)
+      line = e->loc->first_line;
+    if(IntConst *c = As<IntConst>(e)){
+      r = Result(mark, dst);
+      Emit(VM_CONST, r, 0, 0, c->val);
+      return r;
+    }
+    if(BoolConst *c = As<BoolConst>(e)){
+      r = Result(mark, dst);
+      Emit(VM_CONST, r, 0, 0, c->val ? 1 : 0);
+      return r;
+    }
+
+    if(Access *a = As<Access>(e)){
+      Identifier *id = a->id;
+      if(!id->is_global && !id->is_array){
+        int slot = slots.at(id);
+        if(dst >= 0 && dst != slot)
+          Emit(VM_MOVE, dst, slot, 0, 0);
+        return dst >= 0 ? dst : slot;
+      }
+      int c, disp;
+      int b = Address(a, &c, &disp);
+      r = Result(mark, dst);
+      Memory(id->is_global ? VM_LOADG : VM_LOADF, a, r, b, c, disp);
+      return r;
+    }
+    if(Call *c = As<Call>(e)){
+      int n = c->args->size();
+      int first = top;
+      for(int i = 0; i<n; i++)
+        Temp();
+      for(int i = n - 1; i>=0; i--)
+        Value((*c->args)[i], first + i);
+      r = Result(mark, dst);
+      Emit(VM_CALL, r, n ? first : 0, n, index.at(c->fd));
+      return r;
+    }
+    if(OpExpression *o = As<OpExpression>(e)){
+      int op = o->op->op;
+      if(op == ASSIGN){
+        Access *a = As<Access>(o->lhs);
+        if(!a->id->is_global && !a->id->is_array){
+          int slot = Value(o->rhs, slots.at(a->id));
+          if(dst >= 0 && dst != slot)
+            Emit(VM_MOVE, dst, slot, 0, 0);
+          top = mark;
+          return dst >= 0 ? dst : slot;
+        }
+        int b = Store(a, Value(o->rhs, -1));
+        top = b == mark ? mark + 1 : mark;
+        if(dst < 0 || dst == b)
+          return b;
+        Emit(VM_MOVE, dst, b, 0, 0);
+        top = mark;
+        return dst;
+      }
+      if(op == AND_OP || op == OR_OP){
+        r = Result(mark, dst);
+        int no = NewLabel();
+        int done = NewLabel();
+        JumpOn(o, false, no);
+        Emit(VM_CONST, r, 0, 0, 1);
+        Jump(VM_JUMP, 0, 0, 0, done);
+        Place(no);
+        Emit(VM_CONST, r, 0, 0, 0);
+        Place(done);
+        return r;
+      }
+      if(o->lhs == NULL){
+        if(op == PLUS)
+          return Value(o->rhs, dst);
+        int b = Value(o->rhs, -1);
+        r = Result(mark, dst);
+        switch(op){
+        case NOT: Emit(VM_NOT, r, b, 0, 0); break;
+        case MINUS: Emit(VM_NEG, r, b, 0, 0); break;
+        case INC_OP: Emit(VM_ADDI, r, b, 0, 1); break;
+        case DEC_OP: Emit(VM_ADDI, r, b, 0, -1); break;
+        default: Emit(VM_MOVE, r, b, 0, 0); break;
+        }
+        return r;
+      }
+      // An operand that is a constant goes into the instruction
+      IntConst *k = As<IntConst>(o->rhs);
+      if(k && (op == PLUS || op == MINUS || op == STAR || op == LT)){
+        int a = Value(o->lhs, -1);
+        r = Result(mark, dst);
+        switch(op){
+        case PLUS: Emit(VM_ADDI, r, a, 0, k->val); break;
+        case MINUS: Emit(VM_ADDI, r, a, 0, 0u - k->val); break;
+        case STAR: Emit(VM_MULI, r, a, 0, k->val); break;
+        case LT: Emit(VM_LTI, r, a, 0, k->val); break;
+        }
+        return r;
+      }
+      k = As<IntConst>(o->lhs);
+      if(k && (op == PLUS || op == STAR)){
+        int b = Value(o->rhs, -1);
+        r = Result(mark, dst);
+        Emit(op == PLUS ? VM_ADDI : VM_MULI, r, b, 0, k->val);
+        return r;
+      }
+      int b = Keep(Value(o->rhs, -1), Assigns(o->lhs));
+      int a = Value(o->lhs, -1);
+      r = Result(mark, dst);
+      switch(op){
+      case PLUS: Emit(VM_ADD, r, a, b, 0); break;
+      case MINUS: Emit(VM_SUB, r, a, b, 0); break;
+      case STAR: Emit(VM_MUL, r, a, b, 0); break;
+      case DIVIDE: Emit(VM_DIV, r, a, b, 0); break;
+      case MODULUS: Emit(VM_MOD, r, a, b, 0); break;
+      case LT: Emit(VM_LT, r, a, b, 0); break;
+      case GT: Emit(VM_LT, r, b, a, 0); break;
+      case EQ_OP: Emit(VM_EQ, r, a, b, 0); break;
+      case NE_OP: Emit(VM_NE, r, a, b, 0); break;
+      default: Emit(VM_MOVE, r, a, 0, 0); break;
+      }
+      return r;
+    }
+    // Strings and doubles never get past the checker
+    r = Result(mark, dst);
+    Emit(VM_CONST, r, 0, 0, 0);
+    return r;
+  }
+
+  // Jumps to label when test is when, comparing in the branch itself
+  // when the test is a comparison. The right operand of && and || is
+  // only evaluated when the left one leaves the outcome open.
+  void JumpOn(Expression *test, bool when, int label){
+    int mark = top;
+    OpExpression *o = As<OpExpression>(test);
+    int op = o ? o->op->op : 0;
+    if(op == NOT){
+      JumpOn(o->rhs, !when, label);
+      return;
+    }
+    if(op == AND_OP || op == OR_OP){
+      // Both operands must agree for a && b to be true or a || b false
+      if(when == (op == AND_OP)){
+        int decided = NewLabel();
+        JumpOn(o->lhs, !when, decided);
+        JumpOn(o->rhs, when, label);
+        Place(decided);
+      }
+      else{
+        JumpOn(o->lhs, when, label);
+        JumpOn(o->rhs, when, label);
+      }
+      return;
+    }
+    if(op == LT || op == GT || op == EQ_OP || op == NE_OP){
+      IntConst *k = As<IntConst>(o->rhs);
+      if(op == LT && k){
+        Jump(when ? VM_JLTI : VM_JNLTI, Value(o->lhs, -1), 0, k->val, label);
+        top = mark;
+        return;
+      }
+      int b = Keep(Value(o->rhs, -1), Assigns(o->lhs));
+      int a = Value(o->lhs, -1);
+      switch(op){
+      case LT: Jump(when ? VM_JLT : VM_JNLT, a, b, 0, label); break;
+      case GT: Jump(when ? VM_JLT : VM_JNLT, b, a, 0, label); break;
+      case EQ_OP: Jump(when ? VM_JEQ : VM_JNE, a, b, 0, label); break;
+      case NE_OP: Jump(when ? VM_JNE : VM_JEQ, a, b, 0, label); break;
+      }
+    }
+    else
+      Jump(when ? VM_JNZ : VM_JZ, Value(test, -1), 0, 0, label);
+    top = mark;
+  }
+
+  void Lower(Statement *s){
+    if(s == NULL)
+      return;
+    int mark = top;
+    if(Is<ExprStatement>(s)){
+      ExprStatement *es = As<ExprStatement>(s);
+      if(es->expr)
+        Value(es->expr, -1);
+    }
+    else if(Is<SelStatement>(s)){
+      SelStatement *sel = As<SelStatement>(s);
+      int other = NewLabel();
+      JumpOn(sel->test, false, other);
+      Lower(sel->body_true);
+      if(sel->body_false){
+        int join = NewLabel();
+        Jump(VM_JUMP, 0, 0, 0, join);
+        Place(other);
+        Lower(sel->body_false);
+        Place(join);
+      }
+      else
+        Place(other);
+    }
+    else if(Is<IterStatement>(s)){
+      IterStatement *it = As<IterStatement>(s);
+      if(it->loop_type == FOR)
+        Lower(it->init);
+      // Tested once ahead of the loop and then at the bottom, so that an
+      // iteration takes one branch
+      int body = NewLabel();
+      int exit = NewLabel();
+      Expression *test = it->loop_type == FOR ? it->cond->expr : it->expr;
+      if(test)
+        JumpOn(test, false, exit);
+      Place(body);
+      Lower(it->body);
+      if(it->loop_type == FOR && it->expr)
+        Value(it->expr, -1);
+      if(test)
+        JumpOn(test, true, body);
+      else
+        Jump(VM_JUMP, 0, 0, 0, body);
+      Place(exit);
+    }
+    else if(Is<StatementBlock>(s)){
+      StatementBlock *sb = As<StatementBlock>(s);
+      for(int i = 0; i<sb->stmt_list->size(); i++)
+        Lower((*sb->stmt_list)[i]);
+    }
+    else if(Is<ReturnStatement>(s)){
+      ReturnStatement *r = As<ReturnStatement>(s);
+      Call *c = r->tail_call ? As<Call>(r->expr) : NULL;
+      if(c){
+        int n = c->args->size();
+        int first = top;
+        for(int i = 0; i<n; i++)
+          Temp();
+        for(int i = n - 1; i>=0; i--)
+          Value((*c->args)[i], first + i);
+        Emit(VM_TAILCALL, 0, n ? first : 0, n, index.at(c->fd));
+      }
+      else
+        Emit(VM_RET, r->expr ? Value(r->expr, -1) : 0, 0, 0, 0);
+    }
+    top = mark;
+  }
+
+  // Points the jumps at their labels and the local arrays past the
+  // temporaries; false if the slots do not fit the operands
+  bool Finish(){
+    // Falling off the end returns 0
+    Emit(VM_RET, 0, 0, 0, 0);
+    for(int i = 0; i<jumps.size(); i++){
+      VmInstr &in = f->code[jumps[i]];
+      in.imm = labels[in.imm];
+    }
+    f->array_start = f->frame_size;
+    for(int i = 0; i<frame_refs.size(); i++)
+      f->code[frame_refs[i]].imm += f->array_start * VAR_SIZE;
+    f->frame_size += array_bytes / VAR_SIZE;
+    return f->array_start <= MAX_SLOT;
+  }
+};
+
+VmProgram *CompileToBytecode(const vector<FuncDecl *> &functions){
+  VmProgram *p = ast_arena->New<VmProgram>();
+  p->main = -1;
+  p->global_words = 0;
+  map<Identifier *, int> offsets;
+  for(map<string, Declaration *>::iterator i = global_sym_table->begin();
+      i != global_sym_table->end(); ++i){
+    Identifier *id = As<Identifier>(i->second);
+    if(id == NULL)
+      continue;
+    int words = 1;
+    for(int j = 0; id->is_array && j<id->dim_list->size(); j++)
+      words *= (*id->dim_list)[j]->val;
+    offsets[id] = p->global_words * VAR_SIZE;
+    p->globals.push_back(id);
+    p->global_offsets.push_back(p->global_words * VAR_SIZE);
+    p->global_words += words;
+  }
+
+  map<FuncDecl *, int> index;
+  p->functions.resize(functions.size());
+  for(int i = 0; i<functions.size(); i++){
+    index[functions[i]] = i;
+    p->functions[i].fd = functions[i];
+    if(functions[i]->name == "main")
+      p->main = i;
+  }
+  for(int i = 0; i<functions.size(); i++){
+    BytecodeLowering l(&p->functions[i], index, offsets);
+    l.Lower(functions[i]->stmt_block);
+    if(!l.Finish()){
+      Formatted(functions[i]->loc, "Bytecode: '%s' needs more than %d slots",
+                functions[i]->name.c_str(), MAX_SLOT);
+      return NULL;
+    }
+  }
+  return p;
+}
+
+// Where a call returns to
+struct VmReturn{
+  VmFunction *fn;
+  int *fp;
+  const VmInstr *pc;
+};
+
+bool RunBytecode(VmProgram *p, FILE *out){
+  vector<int> globals(p->global_words, 0);
+  // Frames are cleared as they are pushed: what is never reached is
+  // never touched
+  unique_ptr<int[]> stack(new int[VM_STACK_WORDS]);
+  vector<VmReturn> calls;
+  unsigned global_bytes = p->global_words * VAR_SIZE;
+  int *stack_end = &stack[0] + VM_STACK_WORDS;
+  const char *error = NULL;
+  int exit_code = 0;
+
+  VmFunction *fn = &p->functions[p->main];
+  int *fp = &stack[0];
+  const VmInstr *pc = &fn->code[0];
+  // Bytes of the frame the local arrays take
+  unsigned array_lo = fn->array_start * VAR_SIZE;
+  unsigned array_len = (fn->frame_size - fn->array_start) * VAR_SIZE;
+  if(fn->frame_size > VM_STACK_WORDS){
+    error = "recursion too deep";
+    goto failed;
+  }
+  memset(fp, 0, fn->frame_size * sizeof(int));
+
+  {
+    // Threaded dispatch: every handler jumps straight to the next one
+    // (a GNU extension, as the rest of the tree already assumes g++)
+    static void *dispatch[NUM_VM_OPS] = {
+      &&op_const, &&op_move,
+      &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod,
+      &&op_lt, &&op_eq, &&op_ne,
+      &&op_addi, &&op_muli, &&op_lti, &&op_neg, &&op_not,
+      &&op_loadg, &&op_storeg, &&op_loadf, &&op_storef,
+      &&op_jump, &&op_jz, &&op_jnz, &&op_jlt, &&op_jnlt, &&op_jlti, &&op_jnlti,
+      &&op_jeq, &&op_jne,
+      &&op_call, &&op_tailcall, &&op_ret,
+    };
+#define NEXT goto *dispatch[pc->op]
+#define A fp[pc->a]
+#define B fp[pc->b]
+#define C fp[pc->c]
+// Arithmetic wraps around, as on MIPS
+#define WRAP(x) ((int) (unsigned) (x))
+#define TARGET (&fn->code[0] + pc->imm)
+
+    NEXT;
+  op_const: A = pc->imm; pc++; NEXT;
+  op_move: A = B; pc++; NEXT;
+  op_add: A = WRAP((unsigned) B + (unsigned) C); pc++; NEXT;
+  op_sub: A = WRAP((unsigned) B - (unsigned) C); pc++; NEXT;
+  op_mul: A = WRAP((unsigned) B * (unsigned) C); pc++; NEXT;
+  op_div:
+    if(C == 0)
+      goto divide_by_zero;
+    A = C == -1 ? WRAP(0u - B) : B / C;
+    pc++;
+    NEXT;
+  op_mod:
+    if(C == 0)
+      goto divide_by_zero;
+    A = C == -1 ? 0 : B % C;
+    pc++;
+    NEXT;
+  op_lt: A = B < C; pc++; NEXT;
+  op_eq: A = B == C; pc++; NEXT;
+  op_ne: A = B != C; pc++; NEXT;
+  op_addi: A = WRAP((unsigned) B + (unsigned) pc->imm); pc++; NEXT;
+  op_muli: A = WRAP((unsigned) B * (unsigned) pc->imm); pc++; NEXT;
+  op_lti: A = B < pc->imm; pc++; NEXT;
+  op_neg: A = WRAP(0u - B); pc++; NEXT;
+  op_not: A = B ^ 1; pc++; NEXT;
+  op_loadg: {
+    unsigned at = (unsigned) B + pc->imm + (unsigned) C * VAR_SIZE;
+    if(at >= global_bytes || at % VAR_SIZE)
+      goto stray;
+    A = globals[at / VAR_SIZE];
+    pc++;
+    NEXT;
+  }
+  op_storeg: {
+    unsigned at = (unsigned) B + pc->imm + (unsigned) C * VAR_SIZE;
+    if(at >= global_bytes || at % VAR_SIZE)
+      goto stray;
+    globals[at / VAR_SIZE] = A;
+    pc++;
+    NEXT;
+  }
+  op_loadf: {
+    unsigned at = (unsigned) B + pc->imm + (unsigned) C * VAR_SIZE;
+    if(at - array_lo >= array_len || at % VAR_SIZE)
+      goto stray;
+    A = fp[at / VAR_SIZE];
+    pc++;
+    NEXT;
+  }
+  op_storef: {
+    unsigned at = (unsigned) B + pc->imm + (unsigned) C * VAR_SIZE;
+    if(at - array_lo >= array_len || at % VAR_SIZE)
+      goto stray;
+    fp[at / VAR_SIZE] = A;
+    pc++;
+    NEXT;
+  }
+  op_jump: pc = TARGET; NEXT;
+  op_jz: pc = A == 0 ? TARGET : pc + 1; NEXT;
+  op_jnz: pc = A != 0 ? TARGET : pc + 1; NEXT;
+  op_jlt: pc = A < B ? TARGET : pc + 1; NEXT;
+  op_jnlt: pc = A < B ? pc + 1 : TARGET; NEXT;
+  op_jlti: pc = A < pc->c ? TARGET : pc + 1; NEXT;
+  op_jnlti: pc = A < pc->c ? pc + 1 : TARGET; NEXT;
+  op_jeq: pc = A == B ? TARGET : pc + 1; NEXT;
+  op_jne: pc = A != B ? TARGET : pc + 1; NEXT;
+  op_call: {
+    VmFunction *callee = &p->functions[pc->imm];
+    int *callee_fp = fp + fn->frame_size;
+    if(callee->frame_size > stack_end - callee_fp){
+      error = "recursion too deep";
+      goto failed;
+    }
+    VmReturn ret = {fn, fp, pc};
+    calls.push_back(ret);
+    memset(callee_fp, 0, callee->frame_size * sizeof(int));
+    for(int i = 0; i<pc->c; i++)
+      callee_fp[1 + i] = fp[pc->b + i];
+    fn = callee;
+    fp = callee_fp;
+    pc = &fn->code[0];
+    array_lo = fn->array_start * VAR_SIZE;
+    array_len = (fn->frame_size - fn->array_start) * VAR_SIZE;
+    NEXT;
+  }
+  op_tailcall: {
+    // The callee's frame replaces this one, so its return goes to our
+    // caller; the arguments sit above the parameters they become
+    VmFunction *callee = &p->functions[pc->imm];
+    if(callee->frame_size > stack_end - fp){
+      error = "recursion too deep";
+      goto failed;
+    }
+    memmove(fp + 1, fp + pc->b, pc->c * sizeof(int));
+    memset(fp + 1 + pc->c, 0, (callee->frame_size - 1 - pc->c) * sizeof(int));
+    fn = callee;
+    pc = &fn->code[0];
+    array_lo = fn->array_start * VAR_SIZE;
+    array_len = (fn->frame_size - fn->array_start) * VAR_SIZE;
+    NEXT;
+  }
+  op_ret: {
+    int val = A;
+    if(calls.empty()){
+      exit_code = val;
+      goto done;
+    }
+    VmReturn &ret = calls.back();
+    fn = ret.fn;
+    fp = ret.fp;
+    pc = ret.pc;
+    calls.pop_back();
+    array_lo = fn->array_start * VAR_SIZE;
+    array_len = (fn->frame_size - fn->array_start) * VAR_SIZE;
+    A = val;
+    pc++;
+    NEXT;
+  }
+#undef NEXT
+#undef A
+#undef B
+#undef C
+#undef WRAP
+#undef TARGET
+
+  divide_by_zero:
+    error = "division by zero";
+    goto failed;
+  stray:
+    error = "access outside of its array";
+    goto failed;
+  }
+
+failed:
+  {
+    int line = fn->lines.empty() ? 0 : fn->lines[pc - &fn->code[0]];
+    Formatted(NULL, "Run: %s in '%s', line %d", error, fn->fd->name.c_str(), line);
+    return false;
+  }
+
+done:
+  fprintf(out, "exit %d\n", exit_code);
+  for(int i = 0; i<p->globals.size(); i++){
+    Identifier *id = p->globals[i];
+    int first = p->global_offsets[i] / VAR_SIZE;
+    int end = i + 1 < p->globals.size() ? p->global_offsets[i + 1] / VAR_SIZE : p->global_words;
+    int row = id->is_array ? id->dim_list->back()->val : 1;
+    fprintf(out, "%s:\n", id->name.c_str());
+    for(int w = first; w<end; w++){
+      fprintf(out, "%08x ", globals[w]);
+      if((w - first + 1) % row == 0)
+        fprintf(out, "\n");
+    }
+  }
+  return true;
+}
+
+void RunProgram(const vector<FuncDecl *> &functions){
+  if(options.inline_calls){
+    PhaseTimer timer(PH_OPTIMIZE);
+    InlineCalls(functions);
+  }
+  ComputeModSets();
+  for(int i = 0; i<functions.size(); i++){
+    PhaseTimer timer(PH_OPTIMIZE);
+    OptimizeFunction(functions[i]);
+  }
+  VmProgram *p;
+  {
+    PhaseTimer timer(PH_GENERATE);
+    p = CompileToBytecode(functions);
+  }
+  if(p == NULL)
+    return;
+  if(p->main < 0){
+    NoMainFound();
+    return;
+  }
+  RunBytecode(p, asm_out);
+}
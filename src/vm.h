@@ -0,0 +1,80 @@
+#ifndef VM_H
+#define VM_H
+
+#include "ast.h"
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+// Register bytecode for running a checked program without MIPS. Every
+// function gets a frame of int slots: slot 0 is always zero, then the
+// parameters, the scalar locals and the temporaries of its expressions,
+// which operands a, b and c name, and last its local arrays. Memory is
+// addressed in bytes, as the strides and hoisted offsets of Access are.
+
+enum VmOp{
+  VM_CONST,     // a = imm
+  VM_MOVE,      // a = b
+  VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD, VM_LT, VM_EQ, VM_NE,   // a = b op c
+  VM_ADDI,      // a = b + imm
+  VM_MULI,      // a = b * imm
+  VM_LTI,       // a = b < imm
+  VM_NEG,       // a = -b
+  VM_NOT,       // a = b ^ 1
+  VM_LOADG,     // a = global word at byte imm + b + 4 * c
+  VM_STOREG,    // global word at byte imm + b + 4 * c = a
+  VM_LOADF,     // a = frame word at byte imm + b + 4 * c
+  VM_STOREF,    // frame word at byte imm + b + 4 * c = a
+  VM_JUMP,      // to imm
+  VM_JZ,        // to imm if a == 0
+  VM_JNZ,       // to imm if a != 0
+  VM_JLT,       // to imm if a < b
+  VM_JNLT,      // to imm unless a < b
+  VM_JLTI,      // to imm if a < c, c being a constant
+  VM_JNLTI,     // to imm unless a < c
+  VM_JEQ,       // to imm if a == b
+  VM_JNE,       // to imm if a != b
+  VM_CALL,      // a = function imm of the c slots from b
+  VM_TAILCALL,  // return function imm of the c slots from b, in this frame
+  VM_RET,       // return a
+  NUM_VM_OPS
+};
+
+struct VmInstr{
+  unsigned char op;
+  unsigned short a, b;
+  int c;
+  int imm;
+};
+
+struct VmFunction{
+  FuncDecl *fd;
+  int array_start;              // first slot of the local arrays
+  int frame_size;               // slots
+  vector<VmInstr> code;
+  vector<int> lines;            // source line of each instruction
+};
+
+struct VmProgram{
+  vector<VmFunction> functions;
+  int main;                     // index of main() in functions
+  int global_words;
+  vector<Identifier *> globals; // in table order, with their byte offsets
+  vector<int> global_offsets;
+};
+
+// Lowers the checked (and optimized) functions and lays out the globals.
+// Reports a function too big for the slot operands and returns NULL.
+VmProgram *CompileToBytecode(const vector<FuncDecl *> &functions);
+
+// Runs main(). On success prints "exit N" and every global a row of its
+// last dimension per line, words as %08x, and returns true. A division
+// by zero, a stray access or a runaway recursion is reported on diag_out.
+bool RunBytecode(VmProgram *p, FILE *out);
+
+// -run: optimizes the checked functions as for MIPS, then compiles and
+// runs them, with the results on asm_out
+void RunProgram(const vector<FuncDecl *> &functions);
+
+#endif
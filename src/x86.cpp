@@ -0,0 +1,616 @@
+#include "x86.h"
+#include "ir.h"
+#include "errors.h"
+#include "mips.h"
+#include "opt.h"
+#include "options.h"
+#include "report.h"
+#include <stdarg.h>
+#include <algorithm>
+#include <map>
+#include <string>
+
+using namespace std;
+
+enum X86Reg{RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+static const char *reg64[] = {
+  "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+  "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"};
+static const char *reg32[] = {
+  "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+  "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"};
+
+// Arguments in order. None of them ever holds a value, so a call can
+// load them in any order, and neither do %eax, %ecx and %edx, which are
+// scratch for operands, results and division.
+static const int arg_regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+#define NUM_ARG_REGS 6
+static const int temp_regs[] = {R10, R11};
+static const int saved_regs[] = {RBX, R12, R13, R14, R15};
+
+static bool IsSaved(int r){
+  return find(saved_regs, saved_regs + sizeof(saved_regs)/sizeof(int), r) !=
+    saved_regs + sizeof(saved_regs)/sizeof(int);
+}
+
+static bool ByStart(const ValueInterval *a, const ValueInterval *b){
+  return a->start < b->start;
+}
+
+static string Format(const char *format, ...){
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  return buf;
+}
+
+// Generates one SSA function into the program's text, as EmitIr() does
+// for MIPS: phis become copies, values get registers by linear scan and
+// the rest live in 4-byte slots below the saved registers, next to the
+// local arrays
+class X86Emitter{
+public:
+  IrFunction *f;
+  string &text;
+  int &num_labels;              // of the whole program, for unique names
+  vector<IrInstr *> def;
+  vector<int> reg;              // register of every value, -1 when in memory
+  vector<int> slot;             // %rbp offset of the others, 0 for no location
+  vector<bool> fused;           // comparisons only a branch right after reads
+  vector<int> label;            // label of each block id, -1 if never jumped to
+  int next_block;               // block id laid out after the current one
+  vector<int> saved;            // callee-saved registers the function uses
+  map<Identifier *, int> arrays;        // %rbp offset of the local arrays
+  int arrays_start, arrays_bytes;
+  int frame_bytes;              // below the saved registers
+
+  X86Emitter(IrFunction *f, string &text, int &num_labels)
+    : f(f), text(text), num_labels(num_labels) {}
+
+  void Line(const char *format, ...){
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    text += '\t';
+    text += buf;
+    text += '\n';
+  }
+
+  bool IsConst(int v){
+    return def[v] && (def[v]->op == IR_CONST || def[v]->op == IR_UNDEF);
+  }
+
+  bool Located(int v){
+    return IsConst(v) || reg[v] >= 0 || slot[v] != 0;
+  }
+
+  bool InMemory(int v){
+    return !IsConst(v) && reg[v] < 0;
+  }
+
+  // Operand text of a value: an immediate, a register or a frame slot
+  string Loc(int v){
+    if(def[v] && def[v]->op == IR_UNDEF)
+      return "$0";
+    if(def[v] && def[v]->op == IR_CONST)
+      return Format("$%d", def[v]->imm);
+    if(reg[v] >= 0)
+      return reg32[reg[v]];
+    return Format("%d(%%rbp)", slot[v]);
+  }
+
+  void Move(const string &src, const string &dst){
+    if(src == dst)
+      return;
+    if(src[0] != '%' && src[0] != '$' && dst[0] != '%'){
+      Line("movl %s, %%eax", src.c_str());
+      Line("movl %%eax, %s", dst.c_str());
+      return;
+    }
+    Line("movl %s, %s", src.c_str(), dst.c_str());
+  }
+
+  // Puts a result computed into register r where v lives
+  void Def(const string &r, int v){
+    if(Located(v))
+      Move(r, Loc(v));
+  }
+
+  // Register to compute v into, %eax when v lives in memory
+  string Target(int v){
+    return reg[v] >= 0 ? reg32[reg[v]] : "%eax";
+  }
+
+  // Linear scan as in EmitIr(): values live across a call get
+  // callee-saved registers, only pressure sends one to memory
+  void AllocateRegisters(){
+    vector<ValueInterval> intervals;
+    BuildIntervals(f, def, intervals);
+    vector<ValueInterval *> order;
+    for(int i = 0; i<intervals.size(); i++)
+      order.push_back(&intervals[i]);
+    sort(order.begin(), order.end(), ByStart);
+
+    reg.assign(f->num_values, -1);
+    bool in_use[R15 + 1] = {false};
+    bool saved_used[R15 + 1] = {false};
+    vector<ValueInterval *> active;
+    vector<ValueInterval *> spilled;
+    for(int n = 0; n<order.size(); n++){
+      ValueInterval *cur = order[n];
+      for(int i = 0; i<active.size(); ){
+        if(active[i]->end < cur->start){
+          in_use[reg[active[i]->value]] = false;
+          active.erase(active.begin() + i);
+        }
+        else
+          i++;
+      }
+      int r = -1;
+      if(!cur->crosses_call){
+        for(int i = 0; i<sizeof(temp_regs)/sizeof(int) && r < 0; i++)
+          if(!in_use[temp_regs[i]])
+            r = temp_regs[i];
+      }
+      for(int i = 0; i<sizeof(saved_regs)/sizeof(int) && r < 0; i++)
+        if(!in_use[saved_regs[i]])
+          r = saved_regs[i];
+      if(r < 0){
+        ValueInterval *victim = NULL;
+        for(int i = 0; i<active.size(); i++){
+          if(cur->crosses_call && !IsSaved(reg[active[i]->value]))
+            continue;
+          if(victim == NULL || active[i]->end > victim->end)
+            victim = active[i];
+        }
+        if(victim == NULL || victim->end <= cur->end){
+          spilled.push_back(cur);
+          continue;
+        }
+        r = reg[victim->value];
+        reg[victim->value] = -1;
+        spilled.push_back(victim);
+        active.erase(find(active.begin(), active.end(), victim));
+      }
+      reg[cur->value] = r;
+      in_use[r] = true;
+      if(IsSaved(r))
+        saved_used[r] = true;
+      active.push_back(cur);
+    }
+    for(int i = 0; i<sizeof(saved_regs)/sizeof(int); i++)
+      if(saved_used[saved_regs[i]])
+        saved.push_back(saved_regs[i]);
+
+    // Below the saved registers: the local arrays, then a slot for
+    // every value in memory
+    int offset = -8 * (int) saved.size();
+    for(int i = 0; i<f->blocks.size(); i++){
+      for(int j = 0; j<f->blocks[i]->instrs.size(); j++){
+        Identifier *id = f->blocks[i]->instrs[j]->var;
+        int op = f->blocks[i]->instrs[j]->op;
+        if((op != IR_LOAD && op != IR_STORE) || id->is_global || arrays.count(id))
+          continue;
+        int words = 1;
+        for(int k = 0; id->is_array && k<id->dim_list->size(); k++)
+          words *= (*id->dim_list)[k]->val;
+        offset -= words * VAR_SIZE;
+        arrays[id] = offset;
+      }
+    }
+    arrays_start = offset;
+    arrays_bytes = -8 * (int) saved.size() - offset;
+    slot.assign(f->num_values, 0);
+    for(int i = 0; i<spilled.size(); i++){
+      offset -= VAR_SIZE;
+      slot[spilled[i]->value] = offset;
+    }
+    frame_bytes = -offset - 8 * saved.size();
+    // %rsp stays 16-byte aligned at calls
+    frame_bytes += (16 - (-offset) % 16) % 16;
+  }
+
+  // Flags for args[0] against args[1] of a comparison
+  void Compare(int a, int b){
+    string la = Loc(a), lb = Loc(b);
+    if(IsConst(a) || (InMemory(a) && InMemory(b))){
+      Line("movl %s, %%eax", la.c_str());
+      la = "%eax";
+    }
+    Line("cmpl %s, %s", lb.c_str(), la.c_str());
+  }
+
+  static const char *Condition(int op, bool taken){
+    switch(op){
+    case IR_LT: return taken ? "l" : "ge";
+    case IR_EQ: return taken ? "e" : "ne";
+    default: return taken ? "ne" : "e";
+    }
+  }
+
+  // Element of a global or local array, through %rcx and %rdx
+  string Address(IrInstr *in, int offset_arg){
+    Identifier *id = in->var;
+    int disp = in->imm;
+    bool indexed = offset_arg < in->args.size();
+    if(indexed && IsConst(in->args[offset_arg])){
+      IrInstr *c = def[in->args[offset_arg]];
+      disp += c->op == IR_CONST ? c->imm : 0;
+      indexed = false;
+    }
+    if(indexed)
+      Line("movslq %s, %%rcx", Loc(in->args[offset_arg]).c_str());
+    if(!id->is_global)
+      return indexed ? Format("%d(%%rbp,%%rcx)", arrays[id] + disp) :
+        Format("%d(%%rbp)", arrays[id] + disp);
+    if(!indexed)
+      return Format("v_%s%+d(%%rip)", id->name.c_str(), disp);
+    Line("leaq v_%s(%%rip), %%rdx", id->name.c_str());
+    return Format("%d(%%rdx,%%rcx)", disp);
+  }
+
+  void Divide(IrInstr *in){
+    int b = in->args[1];
+    Line("movl %s, %%eax", Loc(in->args[0]).c_str());
+    int c = IsConst(b) && def[b]->op == IR_CONST ? def[b]->imm : 0;
+    if(IsConst(b) && c == -1){
+      // The one quotient that does not fit wraps instead of trapping,
+      // as on MIPS
+      Line("negl %%eax");
+      Line("xorl %%edx, %%edx");
+    }
+    else if(IsConst(b)){
+      Line("movl $%d, %%ecx", c);
+      Line("cltd");
+      Line("idivl %%ecx");
+    }
+    else{
+      Line("movl %s, %%ecx", Loc(b).c_str());
+      Line("cmpl $-1, %%ecx");
+      Line("je 1f");
+      Line("cltd");
+      Line("idivl %%ecx");
+      Line("jmp 2f");
+      text += "1:\n";
+      Line("negl %%eax");
+      Line("xorl %%edx, %%edx");
+      text += "2:\n";
+    }
+    Def(in->op == IR_DIV ? "%eax" : "%edx", in->dst);
+  }
+
+  void EmitBinary(IrInstr *in){
+    int op = in->op;
+    if(op == IR_DIV || op == IR_MOD){
+      Divide(in);
+      return;
+    }
+    int a = in->args[0], b = in->args[1];
+    if(op == IR_LT || op == IR_EQ || op == IR_NE){
+      if(fused[in->dst])
+        return;
+      Compare(a, b);
+      Line("set%s %%al", Condition(op, true));
+      Line("movzbl %%al, %%eax");
+      Def("%eax", in->dst);
+      return;
+    }
+    string d = Target(in->dst);
+    if(Loc(b) == d){
+      if(op == IR_SUB)
+        d = "%eax";
+      else
+        swap(a, b);
+    }
+    const char *name = op == IR_ADD ? "addl" : op == IR_SUB ? "subl" : "imull";
+    Move(Loc(a), d);
+    Line("%s %s, %s", name, Loc(b).c_str(), d.c_str());
+    Def(d, in->dst);
+  }
+
+  // Pops the frame and leaves through ret, or through a jump that makes
+  // the next function return to our caller instead
+  void Epilogue(const string &exit = "ret"){
+    if(saved.empty()){
+      Line("leave");
+      Line("%s", exit.c_str());
+      return;
+    }
+    Line("leaq %d(%%rbp), %%rsp", -8 * (int) saved.size());
+    for(int i = saved.size() - 1; i>=0; i--)
+      Line("popq %s", reg64[saved[i]]);
+    Line("popq %%rbp");
+    Line("%s", exit.c_str());
+  }
+
+  // Only calls that pass everything in registers: stack arguments would
+  // have to go where our own return address is
+  bool EmitTailCall(IrInstr *in){
+    if(in->args.size() > NUM_ARG_REGS)
+      return false;
+    for(int i = 0; i<in->args.size(); i++)
+      Line("movl %s, %s", Loc(in->args[i]).c_str(), reg32[arg_regs[i]]);
+    Epilogue("jmp f_" + in->callee->name);
+    return true;
+  }
+
+  void EmitInstr(IrInstr *in){
+    string d;
+    switch(in->op){
+    case IR_CONST:
+    case IR_UNDEF:
+    case IR_PARAM:
+      break;
+    case IR_COPY:
+      if(Located(in->dst))
+        Move(Loc(in->args[0]), Loc(in->dst));
+      break;
+    case IR_NEG:
+    case IR_NOT:
+      d = Target(in->dst);
+      Move(Loc(in->args[0]), d);
+      if(in->op == IR_NEG)
+        Line("negl %s", d.c_str());
+      else
+        Line("xorl $1, %s", d.c_str());
+      Def(d, in->dst);
+      break;
+    case IR_LOAD:
+      d = Target(in->dst);
+      Line("movl %s, %s", Address(in, 0).c_str(), d.c_str());
+      Def(d, in->dst);
+      break;
+    case IR_STORE:
+      d = Loc(in->args[0]);
+      if(InMemory(in->args[0])){
+        Line("movl %s, %%eax", d.c_str());
+        d = "%eax";
+      }
+      Line("movl %s, %s", d.c_str(), Address(in, 1).c_str());
+      break;
+    case IR_CALL: {
+      int n = in->args.size();
+      int on_stack = n > NUM_ARG_REGS ? n - NUM_ARG_REGS : 0;
+      if(on_stack % 2)
+        Line("subq $8, %%rsp");
+      for(int i = n - 1; i >= NUM_ARG_REGS; i--){
+        if(IsConst(in->args[i]))
+          Line("pushq %s", Loc(in->args[i]).c_str());
+        else{
+          Line("movl %s, %%eax", Loc(in->args[i]).c_str());
+          Line("pushq %%rax");
+        }
+      }
+      for(int i = 0; i<n && i<NUM_ARG_REGS; i++)
+        Line("movl %s, %s", Loc(in->args[i]).c_str(), reg32[arg_regs[i]]);
+      Line("call f_%s", in->callee->name.c_str());
+      if(on_stack)
+        Line("addq $%d, %%rsp", 8 * (on_stack + on_stack % 2));
+      Def("%eax", in->dst);
+      break;
+    }
+    case IR_JUMP:
+      if(in->target[0]->id != next_block)
+        Line("jmp .L%d", label[in->target[0]->id]);
+      break;
+    case IR_BRANCH: {
+      int v = in->args[0];
+      int op = IR_NE;
+      if(fused[v]){
+        op = def[v]->op;
+        Compare(def[v]->args[0], def[v]->args[1]);
+      }
+      else if(reg[v] >= 0)
+        Line("testl %s, %s", reg32[reg[v]], reg32[reg[v]]);
+      else{
+        Line("movl %s, %%eax", Loc(v).c_str());
+        Line("testl %%eax, %%eax");
+      }
+      if(in->target[1]->id == next_block)
+        Line("j%s .L%d", Condition(op, true), label[in->target[0]->id]);
+      else{
+        Line("j%s .L%d", Condition(op, false), label[in->target[1]->id]);
+        if(in->target[0]->id != next_block)
+          Line("jmp .L%d", label[in->target[0]->id]);
+      }
+      break;
+    }
+    case IR_RET:
+      if(!in->args.empty())
+        Line("movl %s, %%eax", Loc(in->args[0]).c_str());
+      else
+        Line("xorl %%eax, %%eax");
+      Epilogue();
+      break;
+    default:
+      EmitBinary(in);
+      break;
+    }
+  }
+
+  void PlaceLabels(){
+    label.assign(f->num_block_ids, -1);
+    for(int i = 0; i<f->blocks.size(); i++){
+      IrInstr *t = f->blocks[i]->Terminator();
+      for(int k = 0; k<2; k++){
+        bool jumps = t->op == IR_BRANCH || (t->op == IR_JUMP && k == 0);
+        if(jumps && label[t->target[k]->id] < 0)
+          label[t->target[k]->id] = num_labels++;
+      }
+    }
+  }
+
+  void Emit(){
+    FindDefinitions(f, def);
+    EliminatePhis(f, def);
+    AllocateRegisters();
+    // A fused comparison sets the flags the branch tests, not a register
+    FuseComparisons(f, fused);
+    PlaceLabels();
+
+    FuncDecl *fd = f->fd;
+    text += "f_" + fd->name + ":\n";
+    Line("pushq %%rbp");
+    Line("movq %%rsp, %%rbp");
+    for(int i = 0; i<saved.size(); i++)
+      Line("pushq %s", reg64[saved[i]]);
+    if(frame_bytes > 0)
+      Line("subq $%d, %%rsp", frame_bytes);
+    // Parameters from their registers, or from above the return address
+    vector<IrInstr *> &entry = f->blocks[0]->instrs;
+    for(int i = 0; i<entry.size(); i++){
+      IrInstr *in = entry[i];
+      if(in->op != IR_PARAM || !Located(in->dst))
+        continue;
+      if(in->imm < NUM_ARG_REGS)
+        Move(reg32[arg_regs[in->imm]], Loc(in->dst));
+      else
+        Move(Format("%d(%%rbp)", 16 + 8 * (in->imm - NUM_ARG_REGS)), Loc(in->dst));
+    }
+    // Local arrays start out zero, as on the simulator and the VM
+    if(arrays_bytes > 0){
+      Line("leaq %d(%%rbp), %%rdi", arrays_start);
+      Line("movl $%d, %%ecx", arrays_bytes / VAR_SIZE);
+      Line("xorl %%eax, %%eax");
+      Line("rep stosl");
+    }
+
+    for(int i = 0; i<f->blocks.size(); i++){
+      IrBlock *b = f->blocks[i];
+      next_block = i + 1 < f->blocks.size() ? f->blocks[i + 1]->id : -1;
+      if(label[b->id] >= 0)
+        text += Format(".L%d:\n", label[b->id]);
+      for(int j = 0; j<b->instrs.size(); j++){
+        if(IsTailCall(b, j) && EmitTailCall(b->instrs[j]))
+          break;
+        EmitInstr(b->instrs[j]);
+      }
+    }
+  }
+};
+
+// main() of the executable: runs the program's and prints its globals
+// like RunBytecode(), %rbx keeping the exit code
+static void EmitMain(string &text, const vector<Identifier *> &globals){
+  text += "\t.globl main\n";
+  text += "main:\n";
+  text += "\tpushq %rbx\n";
+  text += "\tcall f_main\n";
+  text += "\tmovl %eax, %ebx\n";
+  text += "\tleaq .Lexit(%rip), %rdi\n";
+  text += "\tmovl %ebx, %esi\n";
+  text += "\txorl %eax, %eax\n";
+  text += "\tcall printf@PLT\n";
+  for(int i = 0; i<globals.size(); i++){
+    Identifier *id = globals[i];
+    int words = 1;
+    for(int k = 0; id->is_array && k<id->dim_list->size(); k++)
+      words *= (*id->dim_list)[k]->val;
+    text += Format("\tleaq .Lname%d(%%rip), %%rdi\n", i);
+    text += "\tcall puts@PLT\n";
+    text += "\tleaq v_" + id->name + "(%rip), %rdi\n";
+    text += Format("\tmovl $%d, %%esi\n", words);
+    text += Format("\tmovl $%d, %%edx\n", id->is_array ? id->dim_list->back()->val : 1);
+    text += "\tcall .Lprint_words\n";
+  }
+  text += "\tmovl %ebx, %eax\n";
+  text += "\tpopq %rbx\n";
+  text += "\tret\n";
+
+  // %esi words from %rdi, %edx to a line
+  text += ".Lprint_words:\n";
+  text += "\tpushq %rbx\n";
+  text += "\tpushq %r12\n";
+  text += "\tpushq %r13\n";
+  text += "\tpushq %r14\n";
+  text += "\tpushq %r15\n";
+  text += "\tmovq %rdi, %r12\n";
+  text += "\tmovl %esi, %r13d\n";
+  text += "\tmovl %edx, %r14d\n";
+  text += "\txorl %ebx, %ebx\n";
+  text += "\txorl %r15d, %r15d\n";
+  text += "1:\n";
+  text += "\tcmpl %r13d, %ebx\n";
+  text += "\tjge 2f\n";
+  text += "\tleaq .Lword(%rip), %rdi\n";
+  text += "\tmovl (%r12,%rbx,4), %esi\n";
+  text += "\txorl %eax, %eax\n";
+  text += "\tcall printf@PLT\n";
+  text += "\tincl %ebx\n";
+  text += "\tincl %r15d\n";
+  text += "\tcmpl %r14d, %r15d\n";
+  text += "\tjne 1b\n";
+  text += "\tmovl $10, %edi\n";
+  text += "\tcall putchar@PLT\n";
+  text += "\txorl %r15d, %r15d\n";
+  text += "\tjmp 1b\n";
+  text += "2:\n";
+  text += "\tpopq %r15\n";
+  text += "\tpopq %r14\n";
+  text += "\tpopq %r13\n";
+  text += "\tpopq %r12\n";
+  text += "\tpopq %rbx\n";
+  text += "\tret\n";
+
+  text += "\t.section .rodata\n";
+  text += ".Lexit:\n\t.string \"exit %d\\n\"\n";
+  text += ".Lword:\n\t.string \"%08x \"\n";
+  for(int i = 0; i<globals.size(); i++)
+    text += Format(".Lname%d:\n", i) + "\t.string \"" + globals[i]->name + ":\"\n";
+}
+
+void GenerateX86Program(const vector<FuncDecl *> &functions){
+  bool found_main = false;
+  if(options.inline_calls){
+    PhaseTimer timer(PH_OPTIMIZE);
+    InlineCalls(functions);
+  }
+  ComputeModSets();
+  for(int i = 0; i<functions.size(); i++){
+    PhaseTimer timer(PH_OPTIMIZE);
+    OptimizeFunction(functions[i]);
+    if(functions[i]->name == "main")
+      found_main = true;
+  }
+  if(!found_main){
+    NoMainFound();
+    return;
+  }
+
+  string text = "\t.text\n";
+  int num_labels = 0;
+  for(int i = 0; i<functions.size(); i++){
+    PhaseTimer timer(PH_EMIT);
+    IrFunction *f = BuildIr(functions[i], options.dce);
+    if(options.dump_ir)
+      DumpIr(f, diag_out);
+    X86Emitter e(f, text, num_labels);
+    e.Emit();
+  }
+
+  vector<Identifier *> globals;
+  for(map<string, Declaration *>::iterator i = global_sym_table->begin();
+      i != global_sym_table->end(); ++i){
+    if(Identifier *id = As<Identifier>(i->second))
+      globals.push_back(id);
+  }
+  EmitMain(text, globals);
+  text += "\t.bss\n";
+  text += "\t.align 4\n";
+  for(int i = 0; i<globals.size(); i++){
+    int words = 1;
+    for(int k = 0; globals[i]->is_array && k<globals[i]->dim_list->size(); k++)
+      words *= (*globals[i]->dim_list)[k]->val;
+    text += "v_" + globals[i]->name + ":\n";
+    text += Format("\t.zero %d\n", words * VAR_SIZE);
+  }
+  text += "\t.section .note.GNU-stack,\"\",@progbits\n";
+
+  PhaseTimer timer(PH_OUTPUT);
+  fputs(text.c_str(), asm_out);
+}
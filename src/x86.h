@@ -0,0 +1,16 @@
+#ifndef X86_H
+#define X86_H
+
+#include "ast.h"
+#include <vector>
+
+using namespace std;
+
+// -target=x86-64: native code in GNU as syntax for the System V ABI,
+// generated from the SSA IR of every optimized function and written to
+// asm_out. Functions become f_name and globals v_name; the main() it
+// defines calls f_main and prints what -run prints, "exit N" and the
+// globals, before returning f_main's result. Link with gcc (or cc).
+void GenerateX86Program(const vector<FuncDecl *> &functions);
+
+#endif
@@ -0,0 +1,53 @@
+int calls;
+int r[8];
+
+bool positive(int v){
+	calls = calls + 1;
+	return v > 0;
+}
+
+bool both(int x, int y){
+	return positive(x) && positive(y);
+}
+
+bool either(int x, int y){
+	return positive(x) || positive(y);
+}
+
+bool inside(int i, int n){
+	return i > 0 - 1 && i < n && !(i == 3);
+}
+
+int main(){
+	int i;
+	int n;
+	n = 0;
+	for(i = 0; i < 10 && positive(i + 1); i = i + 1){
+		if(i == 2 || i == 5 || positive(0 - i)){
+			n = n + 10;
+		}
+		else{
+			n = n + 1;
+		}
+	}
+	r[0] = n;
+	r[1] = calls;
+	if(both(0, 1)){
+		r[2] = 1;
+	}
+	if(either(1, 0) && !positive(0)){
+		r[3] = 1;
+	}
+	r[4] = calls;
+	n = 0;
+	i = 8;
+	while(i != 0 && (inside(i, 6) || i > 6)){
+		n = n + i;
+		i = i - 1;
+	}
+	r[5] = n;
+	if(r[0] > 20 && r[1] != 0){
+		return calls;
+	}
+	return 0;
+}
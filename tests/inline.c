@@ -0,0 +1,55 @@
+int g;
+int r[8];
+
+int sign(int v){
+	if(v < 0){
+		return 0 - 1;
+	}
+	if(v > 0){
+		return 1;
+	}
+	return 0;
+}
+
+int clamp(int v, int hi){
+	if(v > hi){
+		return hi;
+	}
+	return v;
+}
+
+int bump(){
+	g = g + 1;
+	return g;
+}
+
+void store(int i, int v){
+	if(v < 0){
+		return;
+	}
+	r[i] = v;
+}
+
+int twice(int v){
+	return clamp(v, 50) + clamp(v, 50);
+}
+
+int main(){
+	int i;
+	int n;
+	n = 0;
+	for(i = 0 - 3; i < 4; i = i + 1){
+		n = n + sign(i) * 10 + clamp(i * i, 4);
+	}
+	r[0] = n;
+	g = 5;
+	n = bump() + g;
+	r[1] = n;
+	n = bump();
+	r[2] = n + g;
+	store(3, 0 - 1);
+	store(4, twice(40));
+	store(5, sign(0 - 7) + 2);
+	r[6] = twice(g);
+	return r[1] + r[2] + r[4];
+}
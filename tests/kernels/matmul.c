@@ -0,0 +1,34 @@
+// Integer matrix product, repeated; the result is folded into the exit code
+int a[120][120];
+int b[120][120];
+int c[120][120];
+
+int multiply(int n){
+  int i; int j; int k; int s;
+  for(i = 0; i<n; i=i+1){
+    for(j = 0; j<n; j=j+1){
+      s = 0;
+      for(k = 0; k<n; k=k+1){
+        s = s + a[i][k]*b[k][j];
+      }
+      c[i][j] = s;
+    }
+  }
+  return c[n-1][n-1];
+}
+
+int main(){
+  int i; int j; int r; int sum;
+  for(i = 0; i<120; i=i+1){
+    for(j = 0; j<120; j=j+1){
+      a[i][j] = i+j+1;
+      b[i][j] = (i+1)*(j+1) % 17;
+    }
+  }
+  sum = 0;
+  for(r = 0; r<40; r=r+1){
+    a[r][r] = a[r][r] + r;
+    sum = sum + multiply(120);
+  }
+  return sum % 251;
+}
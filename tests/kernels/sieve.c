@@ -0,0 +1,27 @@
+// Sieve of Eratosthenes, repeated; branchy loops over a local array
+int count(int n){
+  int flags[200000];
+  int i; int j; int found;
+  for(i = 0; i<n; i=i+1){
+    flags[i] = 0;
+  }
+  found = 0;
+  for(i = 2; i<n; i=i+1){
+    if(flags[i] == 0){
+      found = found + 1;
+      for(j = i+i; j<n; j=j+i){
+        flags[j] = 1;
+      }
+    }
+  }
+  return found;
+}
+
+int main(){
+  int r; int total;
+  total = 0;
+  for(r = 0; r<60; r=r+1){
+    total = total + count(200000 - r);
+  }
+  return total % 251;
+}
@@ -0,0 +1,41 @@
+int r[4];
+
+int sum(int n, int acc){
+	if(n == 0){
+		return acc;
+	}
+	return sum(n - 1, acc + n);
+}
+
+bool even(int n){
+	if(n == 0){
+		return n == 0;
+	}
+	return odd(n - 1);
+}
+
+bool odd(int n){
+	if(n == 0){
+		return n != 0;
+	}
+	return even(n - 1);
+}
+
+int gcd(int a, int b){
+	if(b == 0){
+		return a;
+	}
+	return gcd(b, a % b);
+}
+
+int main(){
+	r[0] = sum(100000, 0);
+	if(even(100001)){
+		r[1] = 1;
+	}
+	else{
+		r[1] = 2;
+	}
+	r[2] = gcd(1071, 462);
+	return gcd(84, 36);
+}